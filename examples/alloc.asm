@@ -0,0 +1,49 @@
+;; builds a linked list of 1000 heap allocated nodes, then sums and frees it, 1000 times over
+;;
+;; node layout:
+;;    0 <int> value
+;;    4 <int> address of the next node, 0 for the last one
+;;
+movi $u #0              ; round
+movi $d #0              ; sum of every list
+
+:round
+        ifei $u #1000
+        jmp :build
+        jmp :exit
+
+:build
+        movi $a #0      ; head of the list
+        movi $i #0
+    :build_loop
+        ifei $i #1000
+        jmp :build_node
+        jmp :sum_loop
+    :build_node
+        alloc $b #8     ; ALLOC returns 0 if the heap is out of room
+        movi &$b $i     ; node.value = $i
+        movi $c $b
+        addi $c #4
+        movi &$c $a     ; node.next = head
+        movi $a $b      ; head = node
+        addi $i #1
+        jmp :build_loop
+
+    :sum_loop
+        ifi $a #0       ; until the end of the list
+        jmp :next_round
+        addi $d &$a
+        movi $b $a
+        movi $c $a
+        addi $c #4
+        movi $a &$c     ; head = node.next
+        free $b         ; the freed block is handed out again by the next ALLOC of its size
+        jmp :sum_loop
+
+:next_round
+        addi $u #1
+        jmp :round
+
+:exit
+printi $d
+printc #10
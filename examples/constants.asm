@@ -13,7 +13,7 @@ printb .hex  ;; truncated, because Constant is Int32, but reading Int8
 printc #10
 
 
-printi .bin  ;; should collide, with next constant value (since it is reading Int32)
+printi .bin  ;; reads past the Int8, into whatever follows it in the constant pool (since it is reading Int32)
 printc #10
 
 
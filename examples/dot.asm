@@ -0,0 +1,42 @@
+;; dot product of two 4096 element float arrays, 1000 times with VMULF/VSUMF,
+;; dot_loop.asm does the same an element at a time
+.x 0.5
+.y 2.0
+movi $a #16384          ; x
+movi $b #32768          ; y
+movi $c #49152          ; scratch copy of x
+movi $d #4096           ; elements
+
+movi $i $a              ; x[i] = 0.5, y[i] = 2.0
+movi $j $b
+ldcf $k .x
+ldcf $u .y
+:fill
+        ifei $i $b
+        jmp :fill_element
+        jmp :fill_end
+:fill_element
+        movf &$i $k
+        movf &$j $u
+        addi $i #4
+        addi $j #4
+        jmp :fill
+:fill_end
+
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :dot
+        jmp :exit
+:dot
+        movi $i $d
+        slli $i #2
+        memcpy $c $a $i ; the products overwrite the scratch copy
+        vmulf $c $b $d
+        vsumf $k $c $d
+        addi $u #1
+        jmp :round
+
+:exit
+printf $k
+printc #10
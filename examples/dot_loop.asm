@@ -0,0 +1,51 @@
+;; dot product of two 4096 element float arrays, 1000 times an element at a time,
+;; dot.asm does the same with VMULF/VSUMF
+.x 0.5
+.y 2.0
+.zero 0.0
+movi $a #16384          ; x
+movi $b #32768          ; y
+
+movi $i $a              ; x[i] = 0.5, y[i] = 2.0
+movi $j $b
+ldcf $k .x
+ldcf $u .y
+:fill
+        ifei $i $b
+        jmp :fill_element
+        jmp :fill_end
+:fill_element
+        movf &$i $k
+        movf &$j $u
+        addi $i #4
+        addi $j #4
+        jmp :fill
+:fill_end
+
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :dot
+        jmp :exit
+:dot
+        ldcf $k .zero
+        movi $i $a
+        movi $j $b
+:dot_loop
+        ifei $i $b
+        jmp :dot_element
+        jmp :next_round
+:dot_element
+        movf $d &$i
+        mulf $d &$j
+        addf $k $d
+        addi $i #4
+        addi $j #4
+        jmp :dot_loop
+:next_round
+        addi $u #1
+        jmp :round
+
+:exit
+printf $k
+printc #10
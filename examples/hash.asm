@@ -0,0 +1,22 @@
+;; 32 bit FNV-1a hash of a 16 KiB buffer, 1000 times over, with the SYSCALL_HASH host function,
+;; hash_loop.asm does the same a byte at a time in guest code
+movi $i #4096           ; buffer
+movi $c #16384          ; length
+movi $d #97
+memset $i $d $c         ; buffer bytes = 'a'
+
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :hash
+        jmp :exit
+:hash
+        movi $a $i      ; the arguments go in $a and $b
+        movi $b $c
+        syscall #0      ; SYSCALL_HASH, checks the range once and hashes the bytes in place, $a = hash
+        addi $u #1
+        jmp :round
+
+:exit
+printi $a
+printc #10
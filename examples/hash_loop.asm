@@ -0,0 +1,38 @@
+;; 32 bit FNV-1a hash of a 16 KiB buffer, 1000 times over, a byte at a time in guest code,
+;; hash.asm does the same with the SYSCALL_HASH host function
+.basis 0x811c9dc5
+.prime 0x01000193
+movi $i #4096           ; buffer
+movi $c #16384          ; length
+movi $d #97
+memset $i $d $c         ; buffer bytes = 'a'
+ldci $k .prime
+
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :hash
+        jmp :exit
+:hash
+        ldci $b .basis
+        movi $a $i
+        movi $j $i
+        addi $j $c
+    :hash_byte
+        ifei $a $j
+        jmp :hash_step
+        jmp :hash_end
+    :hash_step
+        movi $d #0
+        movb $d &$a     ; the byte, zero extended
+        xori $b $d
+        muli $b $k
+        addi $a #1
+        jmp :hash_byte
+    :hash_end
+        addi $u #1
+        jmp :round
+
+:exit
+printi $b
+printc #10
@@ -0,0 +1,86 @@
+/*
+ * A host that embeds liblitavm, see Embedding in the README:
+ *
+ *   cc -O2 -Isrc examples/host.c -L. -llitavm -lm -o host && ./host
+ *
+ * It runs programs that fail at run time and checks that a failed run returns its
+ * status, and that the VM resets and runs again the same way, with every option the
+ * error can unwind through.  It exits with 1 if one of them doesn't.
+ */
+#include <stdio.h>
+#include "litavm.h"
+
+typedef struct HostProgram {
+    const char* name;
+    const char* assembly;
+    int         status;     /* of each run */
+} HostProgram;
+
+static const HostProgram programs[] = {
+    { "divide by zero in a hot loop",
+        ":loop\n"
+        "movi $b #1000\n"
+        "subi $b $i\n"
+        "movi $a #7\n"
+        "divi $a $b\n"
+        "addi $i #1\n"
+        "jmp :loop\n", LITAVM_RUNTIME_ERROR },
+    { "access violation in a hot loop",
+        ".big 2000000\n"
+        "movi $i #0\n"
+        ":loop\n"
+        "addi $i #1\n"
+        "ifi $i #5000\n"
+        "jmp :loop\n"
+        "ldci $a .big\n"
+        "movi &$a #1\n", LITAVM_RUNTIME_ERROR },
+    { "stack overflow",
+        ":loop\n"
+        "pushi $a\n"
+        "jmp :loop\n", LITAVM_RUNTIME_ERROR },
+    { "hot loop",
+        "movi $i #0\n"
+        ":loop\n"
+        "addi $i #1\n"
+        "ifi $i #5000\n"
+        "jmp :loop\n", LITAVM_OK },
+};
+
+static const uint32_t options[] = {
+    0,
+    LITAVM_TRACE_LOOPS,
+    LITAVM_GUARDED_RAM,
+    LITAVM_TRACE_LOOPS | LITAVM_GUARDED_RAM,
+    LITAVM_JIT,
+    LITAVM_JIT | LITAVM_GUARDED_RAM,
+};
+
+int main(void) {
+    int failures = 0;
+    for(size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        for(size_t k = 0; k < sizeof(programs) / sizeof(programs[0]); k++) {
+            LitaVmConfig config = { 0, 0, options[i] };
+            LitaVm* vm = litavmCreate(&config);
+            if(!vm || litavmLoad(vm, programs[k].assembly) != LITAVM_OK) {
+                printf("FAILED to load '%s' with options 0x%x\n", programs[k].name, options[i]);
+                failures++;
+                litavmDestroy(vm);
+                continue;
+            }
+
+            for(int run = 0; run < 3; run++) {
+                int status = litavmExecute(vm);
+                if(status != programs[k].status) {
+                    printf("FAILED '%s' with options 0x%x, run %d returned %d instead of %d\n",
+                        programs[k].name, options[i], run, status, programs[k].status);
+                    failures++;
+                }
+                litavmReset(vm);
+            }
+            litavmDestroy(vm);
+        }
+    }
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
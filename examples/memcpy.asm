@@ -0,0 +1,23 @@
+;; fills a 16 KiB buffer and copies it 1000 times with MEMSET/MEMCPY,
+;; memcpy_loop.asm does the same a byte at a time
+movi $a #4096           ; destination
+movi $b #32768          ; source
+movi $c #16384          ; length
+
+movi $d #7
+memset $b $d $c         ; source bytes = 7
+
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :copy
+        jmp :exit
+:copy
+        memcpy $a $b $c ; checks both ranges once, then copies with the host's vectorized memmove
+        addi $u #1
+        jmp :round
+
+:exit
+memcmp $a $b $c         ; 0 when the buffers are equal
+printi $a
+printc #10
@@ -0,0 +1,54 @@
+;; fills a 16 KiB buffer and copies it 1000 times a byte at a time,
+;; memcpy.asm does the same with MEMSET/MEMCPY
+movi $b #32768          ; source
+movi $c #49152          ; end of the source
+:fill_loop
+        ifei $b $c
+        jmp :fill_byte
+        jmp :fill_end
+:fill_byte
+        movb &$b #7     ; source bytes = 7
+        addi $b #1
+        jmp :fill_loop
+:fill_end
+
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :copy
+        jmp :exit
+:copy
+        movi $a #4096   ; destination
+        movi $b #32768
+:copy_loop
+        ifei $b $c
+        jmp :copy_byte
+        jmp :next_round
+:copy_byte
+        movb &$a &$b
+        addi $a #1
+        addi $b #1
+        jmp :copy_loop
+:next_round
+        addi $u #1
+        jmp :round
+
+:exit
+movi $a #4096           ; 0 when the buffers are equal
+movi $b #32768
+movi $d #0
+:compare_loop
+        ifei $b $c
+        jmp :compare_byte
+        jmp :compare_end
+:compare_byte
+        ifeb &$a &$b   ; sets $d if a byte differs
+        movi $d #1
+        ifeb &$b &$a
+        movi $d #1
+        addi $a #1
+        addi $b #1
+        jmp :compare_loop
+:compare_end
+printi $d
+printc #10
@@ -0,0 +1,25 @@
+;; prints "Hello World" a character at a time, followed by the round, 100000 times over,
+;; best redirected to a file or /dev/null
+.text "Hello World "
+
+movi $u #0              ; round
+:round
+        ifei $u #100000
+        jmp :line
+        jmp :exit
+:line
+        ldca $a .text
+    :print_loop
+        ifb &$a #0
+        jmp :print_end_loop
+        printc &$a      ; collects in the Vm's output buffer, no stdio call per character
+        addi $a #1
+        jmp :print_loop
+    :print_end_loop
+        printi $u
+        printc #10
+        addi $u #1
+        jmp :round
+
+:exit
+flush                   ; hands the buffer to stdout now instead of when the program ends
@@ -0,0 +1,24 @@
+;; prints an int and a float per line, 500000 lines, best redirected to a file or /dev/null;
+;; build with -DLITA_PRINTF_FORMAT to time the same output through snprintf
+.step 0.37
+.start -1000.0
+
+ldcf $c .step
+ldcf $k .start
+movi $u #0              ; round
+:round
+        ifei $u #500000
+        jmp :line
+        jmp :exit
+:line
+        movi $a $u
+        subi $a #250000
+        printi $a       ; digit pairs, straight into the output buffer
+        printc #32
+        printf $k       ; the exact "%f" rounding, without snprintf
+        printc #10
+        addf $k $c
+        addi $u #1
+        jmp :round
+
+:exit
@@ -0,0 +1,40 @@
+;; y = a * x + y over 4096 element float arrays, 1000 times with VFMAF,
+;; saxpy_loop.asm does the same an element at a time
+.a 0.25
+.x 0.5
+.y 2.0
+movi $a #16384          ; x
+movi $b #32768          ; y
+movi $d #4096           ; elements
+
+movi $i $a              ; x[i] = 0.5, y[i] = 2.0
+movi $j $b
+ldcf $k .x
+ldcf $u .y
+:fill
+        ifei $i $b
+        jmp :fill_element
+        jmp :fill_end
+:fill_element
+        movf &$i $k
+        movf &$j $u
+        addi $i #4
+        addi $j #4
+        jmp :fill
+:fill_end
+
+ldcf $c .a
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :saxpy
+        jmp :exit
+:saxpy
+        vfmaf $b $a $c $d
+        addi $u #1
+        jmp :round
+
+:exit
+vsumf $k $b $d          ; 4096 * (2.0 + 1000 * 0.125)
+printf $k
+printc #10
@@ -0,0 +1,64 @@
+;; y = a * x + y over 4096 element float arrays, 1000 times an element at a time,
+;; saxpy.asm does the same with VFMAF
+.a 0.25
+.x 0.5
+.y 2.0
+.zero 0.0
+movi $a #16384          ; x
+movi $b #32768          ; y
+
+movi $i $a              ; x[i] = 0.5, y[i] = 2.0
+movi $j $b
+ldcf $k .x
+ldcf $u .y
+:fill
+        ifei $i $b
+        jmp :fill_element
+        jmp :fill_end
+:fill_element
+        movf &$i $k
+        movf &$j $u
+        addi $i #4
+        addi $j #4
+        jmp :fill
+:fill_end
+
+ldcf $c .a
+movi $u #0              ; round
+:round
+        ifei $u #1000
+        jmp :saxpy
+        jmp :exit
+:saxpy
+        movi $i $a
+        movi $j $b
+:saxpy_loop
+        ifei $i $b
+        jmp :saxpy_element
+        jmp :next_round
+:saxpy_element
+        movf $d &$i
+        mulf $d $c
+        addf &$j $d
+        addi $i #4
+        addi $j #4
+        jmp :saxpy_loop
+:next_round
+        addi $u #1
+        jmp :round
+
+:exit
+ldcf $k .zero           ; 4096 * (2.0 + 1000 * 0.125)
+movi $j $b
+movi $d #49152
+:sum_loop
+        ifei $j $d
+        jmp :sum_element
+        jmp :sum_end
+:sum_element
+        addf $k &$j
+        addi $j #4
+        jmp :sum_loop
+:sum_end
+printf $k
+printc #10
@@ -0,0 +1,45 @@
+;; counts the lines and bytes of input.txt, reading it 1 MiB at a time with SYSCALL_READ,
+;; wc_map.asm does the same on the file mapped into RAM.  Any text file will do, to time
+;; a 1 GiB one:
+;;
+;;    base64 /dev/urandom | head -c 1073741824 > input.txt
+;;    litavm -r 4194304 examples/wc.asm
+;;
+.path "input.txt"
+.buffer 1048576
+.chunk 1048576
+
+ldca $a .path
+movi $b #0              ; to read
+syscall #2              ; SYSCALL_OPEN, $a = handle
+movi $k $a
+movi $j #10             ; '\n'
+movi $u #0              ; lines
+movi $d #0              ; bytes
+
+:read
+        movi $a $k
+        ldci $b .buffer
+        ldci $c .chunk
+        syscall #3      ; SYSCALL_READ, the bytes go straight from the stdio buffer, or the file, into RAM
+        ifi $a #0       ; until the end of the file, or an error
+        jmp :done
+        addi $d $a
+        addi $b $a
+        movb &$b #0     ; the 0 after the chunk ends the scan
+        ldci $i .buffer
+    :scan
+        strchr $i $i $j ; the next newline, 0 at the end of the chunk
+        ifi $i #0
+        jmp :read
+        addi $u #1
+        addi $i #1
+        jmp :scan
+
+:done
+movi $a $k
+syscall #5              ; SYSCALL_CLOSE
+printi $u
+printc #32
+printi $d
+printc #10
@@ -0,0 +1,34 @@
+;; counts the lines and bytes of input.txt, loading it into RAM with SYSCALL_MAP, which
+;; maps the file instead of reading it where the RAM is mapped.  To time a 1 GiB file, see
+;; wc.asm, with enough RAM to hold it:
+;;
+;;    litavm -r 1200000000 --lazy-ram examples/wc_map.asm
+;;
+.path "input.txt"
+
+ldca $a .path
+movi $b $h              ; from past the constants
+movi $c $sp
+subi $c $h
+subi $c #4097           ; to clear of the stack, with a byte to spare for the 0 after the data
+syscall #6              ; SYSCALL_MAP, $a = address of the data, $b = its length
+movi $d $b              ; bytes
+movi $i $a
+addi $a $b
+movb &$a #0             ; the 0 after the data ends the scan
+movi $j #10             ; '\n'
+movi $u #0              ; lines
+
+:scan
+        strchr $i $i $j ; the next newline, 0 at the end of the data
+        ifi $i #0
+        jmp :done
+        addi $u #1
+        addi $i #1
+        jmp :scan
+
+:done
+printi $u
+printc #32
+printi $d
+printc #10
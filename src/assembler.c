@@ -49,6 +49,7 @@ typedef struct Constant {
         char*   stringVal;
     } as;
 
+    struct Constant* original;  /* the identical constant defined first, whose copy this one shares */
     struct Constant* next;
 } Constant;
 
@@ -64,9 +65,14 @@ typedef struct Program {
 
     Constant* constants;
     size_t numberOfConstants;
+    size_t numberOfDistinctConstants;
 
     Label*  labels;
     size_t  numberOfLabels;
+
+    /* the results, freed with the program if it fails to assemble */
+    Address*     constantAddresses;
+    Instruction* code;
 } Program;
 
 static void parseError(const char* format, ...) {
@@ -76,7 +82,7 @@ static void parseError(const char* format, ...) {
     va_end(args);
     fputs("\n", stderr);
 
-    exit(32);
+    litaExit(32);
 }
 
 static AssemblerInstruction* makeAssemblerInstruction(size_t lineNumber) {
@@ -109,6 +115,9 @@ static void freeConstants(Constant* constants) {
     Constant* i = constants;
     while(i) {
         Constant* next = i->next;
+        if(i->kind == STRING) {
+            litaFree(i->as.stringVal);
+        }
         litaFree(i);
 
         i = next;
@@ -125,6 +134,13 @@ static void freeLabels(Label* labels) {
     }
 }
 
+/* the parsed program, not the results */
+static void freeProgram(Program* program) {
+    freeAssemberInstruction(program->instrs);    
+    freeConstants(program->constants);
+    freeLabels(program->labels);
+}
+
 static int findConstantIndex(Program* program, const char* constantName) {
     Constant* i = program->constants;
     while(i) {
@@ -273,6 +289,16 @@ static Instruction parseArg2(Program* program, AssemblerInstruction* instr, char
     return instruction;
 }
 
+/* the second and third register arguments of the extended opcodes, see OPCODE_EXT */
+static Instruction parseExtArg(AssemblerInstruction* instr, char* arg, int shift) {
+    int registerIndex = cpuGetRegisterIndex(arg);
+    if(registerIndex < 0) {
+        parseError("Invalid register name: '%s', the argument must be a register at line: %d", arg, instr->lineNumber);
+    }
+
+    return registerIndex << shift;
+}
+
 static Instruction parseJmp(Program* program, AssemblerInstruction* instr, char* arg) {
     if(arg[0] == ':') {
         Label* label = findLabel(program, arg);
@@ -298,6 +324,7 @@ static Instruction parseJmp(Program* program, AssemblerInstruction* instr, char*
 static Instruction* parseInstructions(Program* program) {
     AssemblerInstruction* instrs = program->instrs;
     Instruction* result = (Instruction*)litaMalloc(sizeof(Instruction) * (program->numberOfInstructions + 1));
+    program->code = result;
     
     size_t i = 0;
     while(instrs) {
@@ -317,6 +344,10 @@ static Instruction* parseInstructions(Program* program) {
                 }
 
                 Instruction instruction = opcode << (ARG1_SIZE + ARG2_SIZE);
+                if(opcode >= FIRST_EXT_OPCODE) {
+                    instruction = (Instruction)(((uint32_t)OPCODE_EXT << OPCODE_SHIFT) | 
+                        ((uint32_t)(opcode - FIRST_EXT_OPCODE) << EXT_OPCODE_SHIFT));
+                }
 
                 Instruction arg1 = 0;
                 Instruction arg2 = 0;
@@ -328,7 +359,14 @@ static Instruction* parseInstructions(Program* program) {
                         break;
                     }
                     default: {
-                        
+                        if(opcode >= FIRST_EXT_OPCODE) {
+                            static const int shifts[] = { ARG2_SIZE, EXT_ARG2_SHIFT, EXT_ARG3_SHIFT, EXT_ARG4_SHIFT };
+                            for(size_t a = 0; a < expectedNumArgs; a++) {
+                                arg2 |= parseExtArg(instrs, instrs->args[a + 1], shifts[a]);
+                            }
+                            break;
+                        }
+
                         switch(expectedNumArgs) {           
                             case 0: {
                                 break;     
@@ -369,13 +407,13 @@ static void parseConstant(AssemblerInstruction* instrs, Constant* constant, char
     }
     
     if(arg[0] == '\"') {
-        if(argLen > 1 && arg[argLen - 1] != '\"') {
+        if(argLen < 2 || arg[argLen - 1] != '\"') {
             parseError("Constant string expression missing closing '\"' at line: %d", instrs->lineNumber);
         }
 
         char* str = (char*)litaMalloc(sizeof(char) * (argLen - 1));
         memcpy(str, arg + 1, argLen - 2);
-        str[argLen - 1] = 0;
+        str[argLen - 2] = 0;
         
         constant->kind = STRING;
         constant->as.stringVal = str;
@@ -458,6 +496,68 @@ static void parseConstant(AssemblerInstruction* instrs, Constant* constant, char
 }
 
 
+/* orders the constants by kind and value, 0 if they are identical */
+static int compareConstantValues(const Constant* x, const Constant* y) {
+    if(x->kind != y->kind) {
+        return x->kind < y->kind ? -1 : 1;
+    }
+
+    int result = 0;
+    switch(x->kind) {
+        case INT32: result = (x->as.int32Val > y->as.int32Val) - (x->as.int32Val < y->as.int32Val); break;
+        case INT8:  result = (x->as.int8Val > y->as.int8Val) - (x->as.int8Val < y->as.int8Val); break;
+        case FLOAT: result = memcmp(&x->as.floatVal, &y->as.floatVal, sizeof(float)); break;
+        case STRING: result = strcmp(x->as.stringVal, y->as.stringVal); break;
+    }
+    return result;
+}
+
+/* qsort order of the constants, the identical ones in the order they are defined */
+static int compareConstants(const void* a, const void* b) {
+    const Constant* x = *(const Constant**)a;
+    const Constant* y = *(const Constant**)b;
+
+    int result = compareConstantValues(x, y);
+    return result ? result : (x->index > y->index) - (x->index < y->index);
+}
+
+/* 
+ * Points every constant that has the same kind and value as an earlier one at that one, 
+ * returns the number of distinct constants
+ */
+static size_t internConstants(Program* program) {
+    if(program->numberOfConstants < 2) {
+        return program->numberOfConstants;
+    }
+
+    Constant** sorted = (Constant**)litaMalloc(sizeof(Constant*) * program->numberOfConstants);
+    size_t n = 0;
+    for(Constant* c = program->constants; c; c = c->next) {
+        sorted[n++] = c;
+    }
+
+    qsort(sorted, n, sizeof(Constant*), compareConstants);
+    size_t distinct = 1;
+    for(size_t i = 1; i < n; i++) {
+        Constant* previous = sorted[i - 1];
+        if(compareConstantValues(sorted[i], previous)) {
+            distinct++;
+        }
+        else {
+            sorted[i]->original = previous->original ? previous->original : previous;
+        }
+    }
+
+    litaFree(sorted);
+    return distinct;
+}
+
+/*
+ * Lays out the constant pool from address 0, one copy per distinct constant if the pool is
+ * protected and one per constant otherwise.  The constants are grouped by kind, the 4 byte
+ * ones first so each of them is naturally aligned without padding, then the bytes and the
+ * strings.  The constant operands refer to the slots, which are numbered in this order.
+ */
 static Address* parseConstants(Vm* vm, Program* program) {
     Address* result = NULL;
     AssemblerInstruction* instrs = program->instrs;
@@ -478,8 +578,11 @@ static Address* parseConstants(Vm* vm, Program* program) {
             Constant* c = (Constant*)litaMalloc(sizeof(Constant));            
             c->index = index++;
             c->name = name;            
-            parseConstant(instrs, c, arg, argLen);
+            c->kind = INT32;
+            c->original = NULL;
+            c->next = NULL;
 
+            // in the list before it is parsed, so it is freed with the program if it fails to
             if(!program->constants) {            
                 program->constants = c;
             }
@@ -489,47 +592,67 @@ static Address* parseConstants(Vm* vm, Program* program) {
 
             current = c;
             program->numberOfConstants++;
+            parseConstant(instrs, c, arg, argLen);
         }
         
         instrs = instrs->next;        
     }
+
+    // identical constants only share a copy if the guest can't store into it, in writable
+    // RAM each constant is a slot of its own
+    program->numberOfDistinctConstants = vm->protectConstants ? internConstants(program) : program->numberOfConstants;
+
+    static const ConstantKind layout[] = { INT32, FLOAT, INT8, STRING };
     Address ramAddress = 0;
-    if(program->numberOfConstants > 0) {
-        result = (Address*)litaMalloc(sizeof(Address) * program->numberOfConstants);        
+    size_t slot = 0;
+    if(program->numberOfDistinctConstants > 0) {
+        result = (Address*)litaMalloc(sizeof(Address) * program->numberOfDistinctConstants);        
+        program->constantAddresses = result;
         Ram* ram = vm->ram;
-        Constant* c = program->constants;
-        size_t i = 0;
-        while(c) {                        
-            result[i++] = ramAddress;
-            switch(c->kind) {
-                case INT32: {
-                    ramStoreInt32(ram, ramAddress, c->as.int32Val);
-                    ramAddress += 4;
-                    break;
+        for(size_t k = 0; k < sizeof(layout) / sizeof(layout[0]); k++) {
+            for(Constant* c = program->constants; c; c = c->next) {
+                if(c->kind != layout[k] || c->original) {
+                    continue;
                 }
-                case FLOAT: {                    
-                    ramStoreFloat(ram, ramAddress, c->as.floatVal);
-                    ramAddress += 4;
-                    break;
-                }
-                case INT8: {                    
-                    ramStoreInt8(ram, ramAddress, c->as.int8Val);
-                    ramAddress += 1;
-                    break;
-                }
-                case STRING: {
-                    size_t len = strlen(c->as.stringVal);
-                    ramStoreString(ram, ramAddress, c->as.stringVal, len);
-                    ramAddress += len + 1;
-                    break;
+
+                c->index = slot;
+                result[slot++] = ramAddress;
+                switch(c->kind) {
+                    case INT32: {
+                        ramStoreInt32(ram, ramAddress, c->as.int32Val);
+                        ramAddress += 4;
+                        break;
+                    }
+                    case FLOAT: {                    
+                        ramStoreFloat(ram, ramAddress, c->as.floatVal);
+                        ramAddress += 4;
+                        break;
+                    }
+                    case INT8: {                    
+                        ramStoreInt8(ram, ramAddress, c->as.int8Val);
+                        ramAddress += 1;
+                        break;
+                    }
+                    case STRING: {
+                        size_t len = strlen(c->as.stringVal);
+                        ramStoreString(ram, ramAddress, c->as.stringVal, len);
+                        ramAddress += len + 1;
+                        break;
+                    }
                 }
             }
-
-            c = c->next;
         }
 
+        for(Constant* c = program->constants; c; c = c->next) {
+            if(c->original) {
+                c->index = c->original->index;
+            }
+        }
     }
     vm->cpu->h.as.address = ramAddress;
+    if(vm->protectConstants) {
+        vmProtectConstants(vm, ramAddress);
+    }
 
     return result;
 }
@@ -545,6 +668,7 @@ static void parseLabels(Program* program) {
             Label* label = (Label*)litaMalloc(sizeof(Label));
             label->address = instrs->address;
             label->name = labelName;
+            label->next = NULL;
             
             if(!program->labels) {
                 program->labels = label;
@@ -692,16 +816,76 @@ void parse(Program* program, const char* assembly) {
 }
 
 
+static void debugInfoAddName(DebugInfo* debug, const char* name, Address value) {
+    buf_push(debug->nameOffsets, (Address)buf_len(debug->names));
+    buf_push(debug->values, value);
+    do {
+        buf_push(debug->names, *name);
+    } while(*name++);
+}
+
+/* copies the names and lines out of the program, which is freed once it is compiled */
+static void collectDebugInfo(Program* program, Address* constants, DebugInfo* debug) {
+    Constant* constant = program->constants;
+    for(AssemblerInstruction* instr = program->instrs; instr; instr = instr->next) {
+        switch(instr->kind) {
+            case BYTECODE_DEF: {
+                buf_push(debug->lines, (uint32_t)instr->lineNumber);
+                break;
+            }
+            case LABEL_DEF: {
+                debugInfoAddName(debug, instr->args[0], instr->address);
+                break;
+            }
+            case CONSTANT_DEF: {
+                // the constants are in the order they are defined in
+                debugInfoAddName(debug, constant->name, constants[constant->index]);
+                constant = constant->next;
+                break;
+            }
+            default: break;
+        }
+    }
+}
+
 Bytecode* compile(Vm* vm, const char* assembly) {
+    return compileDebug(vm, assembly, NULL);
+}
+
+void debugInfoFree(DebugInfo* debug) {
+    buf_free(debug->names);
+    buf_free(debug->nameOffsets);
+    buf_free(debug->values);
+    buf_free(debug->lines);
+}
+
+Bytecode* compileDebug(Vm* vm, const char* assembly, DebugInfo* debug) {
     Program program = {
         .instrs = NULL,
         .numberOfInstructions = 0,        
         .constants = NULL,
         .numberOfConstants = 0,
+        .numberOfDistinctConstants = 0,
         .labels = NULL,
-        .numberOfLabels = 0
+        .numberOfLabels = 0,
+        .constantAddresses = NULL,
+        .code = NULL
     };
 
+    // the error of a litavm call frees the program before it ends the call, see litaExit
+    jmp_buf* callerJump = litaErrorJump;
+    jmp_buf errorJump;
+    if(callerJump) {
+        if(setjmp(errorJump)) {
+            litaErrorJump = callerJump;
+            freeProgram(&program);
+            litaFree(program.constantAddresses);
+            litaFree(program.code);
+            litaExit(litaErrorStatus);
+        }
+        litaErrorJump = &errorJump;
+    }
+
     parse(&program, assembly);        
     parseLabels(&program);
 
@@ -710,24 +894,43 @@ Bytecode* compile(Vm* vm, const char* assembly) {
 
     Bytecode* code = (Bytecode*)litaMalloc(sizeof(Bytecode));
     code->constants = constants;
-    code->numOfConstants = program.numberOfConstants;
+    code->numOfConstants = program.numberOfDistinctConstants;
     code->instrs = instructions;
     code->length = program.numberOfInstructions;
     code->pc = 0;
+    code->decoded = NULL;
+    code->verified = 0;
+    code->file = NULL;
+
+    if(debug) {
+        collectDebugInfo(&program, constants, debug);
+    }
 
     // TODO - remove AssemblerInstruction heap allocations
     // construct bytecode instructions per line parsing iteration        
-    freeAssemberInstruction(program.instrs);    
-    freeConstants(program.constants);
-    freeLabels(program.labels);
+    freeProgram(&program);
+    litaErrorJump = callerJump;
 
     return code;
 }
 
-void      disassemble(Bytecode* code) {    
+void      disassemble(Bytecode* code, const DebugInfo* debug) {    
+    size_t name = 0;
     for(size_t i = 0; i < code->length; i++) {
         Instruction instr = code->instrs[i];
 
+        // the labels are in the order they are defined in, which is the order of their instructions
+        for(; debug && name < buf_len(debug->values); name++) {
+            const char* label = debug->names + debug->nameOffsets[name];
+            if(label[0] != ':') {
+                continue;
+            }
+            if(debug->values[name] > i) {
+                break;
+            }
+            printf("%s\n", label);
+        }
+
         Opcode opcode = OPCODE(instr);
         printf("%-5zu   %s ", i, OpcodeStr[opcode]);
         switch(opcode) {
@@ -736,6 +939,16 @@ void      disassemble(Bytecode* code) {
                 printf("%d", ARG_JMP_VALUE(instr));
                 break;
             default: {
+                if(opcode >= FIRST_EXT_OPCODE) {
+                    Address regs[] = { 
+                        ARG1_VALUE(instr), EXT_ARG2_VALUE(instr), EXT_ARG3_VALUE(instr), EXT_ARG4_VALUE(instr) 
+                    };
+                    for(size_t a = 0; a < opcodeNumArgs(opcode); a++) {
+                        printf(a ? " %s" : "%s", RegisterNames[regs[a]]);
+                    }
+                    break;
+                }
+
                 switch(opcodeNumArgs(opcode)) {
                     case 2:
                         if(IS_ARG1_ADDR(instr)) {
@@ -781,6 +994,9 @@ void      disassemble(Bytecode* code) {
             }
         }
 
+        if(debug && i < buf_len(debug->lines)) {
+            printf("\t; line %u", debug->lines[i]);
+        }
         printf("\n");
     }
 }
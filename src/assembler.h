@@ -4,7 +4,27 @@
 #include "bytecode.h"
 #include "vm.h"
 
+/* bumped whenever the same source assembles to different code, it is part of the key of the compile cache */
+#define ASSEMBLER_VERSION 1
+
+/*
+ * What compileDebug keeps of the source for the symbol and debug sections of an .lbc,
+ * and for the disassembly
+ */
+typedef struct DebugInfo {
+    char*     names;       /* buf, the 0 terminated label and constant names with their ':' or '.' */
+    Address*  nameOffsets; /* buf, where each name starts in names */
+    Address*  values;      /* buf, per name the instruction of a label or the address of a constant */
+    uint32_t* lines;       /* buf, the source line of each instruction */
+} DebugInfo;
+
 Bytecode* compile(Vm* vm, const char* assembly);
-void      disassemble(Bytecode* code);
+
+/* compile that also fills in the DebugInfo, which must be zeroed */
+Bytecode* compileDebug(Vm* vm, const char* assembly, DebugInfo* debug);
+void      debugInfoFree(DebugInfo* debug);
+
+/* with the DebugInfo, if not NULL, the labels and source lines are shown too */
+void      disassemble(Bytecode* code, const DebugInfo* debug);
 
 #endif
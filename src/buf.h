@@ -1,6 +1,8 @@
 #ifndef LITA_BUF_H
 #define LITA_BUF_H
 
+#include <stddef.h>
+
 // Taken from Bitwise project -- credit pervognsen
 
 typedef struct BufHdr {
@@ -1,11 +1,128 @@
 #include <stdint.h>
 #include "bytecode.h"
+#include "lbc.h"
 #include "common.h"
 
+const char* OpcodeStr[] = {
+    [NOOP] = "NOOP",
+    [MOVI] = "MOVI",   
+    [MOVF] = "MOVF",   
+    [MOVB] = "MOVB",   
+    
+    [LDCI] = "LDCI",   
+    [LDCF] = "LDCF",   
+    [LDCB] = "LDCB",   
+    [LDCA] = "LDCA",   
+    
+    [PUSHI] = "PUSHI", 
+    [PUSHF] = "PUSHF", 
+    [PUSHB] = "PUSHB", 
+    
+    [POPI] = "POPI",  
+    [POPF] = "POPF",  
+    [POPB] = "POPB",  
+    
+    [DUPI] = "DUPI",  
+    [DUPF] = "DUPF",  
+    [DUPB] = "DUPB",  
+    
+    [IFI] = "IFI",  
+    [IFF] = "IFF",  
+    [IFB] = "IFB",  
+    
+    [IFEI] = "IFEI",
+    [IFEF] = "IFEF",
+    [IFEB] = "IFEB",
+    
+    [JMP] = "JMP",   
+    
+    [PRINTI] = "PRINTI", 
+    [PRINTF] = "PRINTF", 
+    [PRINTB] = "PRINTB", 
+    [PRINTC] = "PRINTC", 
+    
+    [CALL] = "CALL", 
+    [RET] = "RET",   
+    
+    [ADDI] = "ADDI", 
+    [ADDF] = "ADDF", 
+    [ADDB] = "ADDB", 
+    
+    [SUBI] = "SUBI", 
+    [SUBF] = "SUBF", 
+    [SUBB] = "SUBB", 
+    
+    [MULI] = "MULI", 
+    [MULF] = "MULF", 
+    [MULB] = "MULB", 
+    
+    [DIVI] = "DIVI", 
+    [DIVF] = "DIVF", 
+    [DIVB] = "DIVB", 
+    
+    [MODI] = "MODI", 
+    [MODF] = "MODF", 
+    [MODB] = "MODB", 
+    
+    [ORI] = "ORI",   
+    [ORB] = "ORB",   
+    
+    [ANDI] = "ANDI",  
+    [ANDB] = "ANDB",  
+    
+    [NOTI] = "NOTI",  
+    [NOTB] = "NOTB",  
+    
+    [XORI] = "XORI",  
+    [XORB] = "XORB",  
+    
+    [SZRLI] = "SZRLI",
+    [SZRLB] = "SZRLB",
+    
+    [SRLI] = "SRLI", 
+    [SRLB] = "SRLB", 
+    
+    [SLLI] = "SLLI", 
+    [SLLB] = "SLLB",
+
+    [ALLOC] = "ALLOC",
+    [FREE] = "FREE",
+    [REALLOC] = "REALLOC",
+
+    [SYSCALL] = "SYSCALL",
+
+    [MEMCPY] = "MEMCPY",
+    [MEMSET] = "MEMSET",
+    [MEMCMP] = "MEMCMP",
+
+    [STRLEN] = "STRLEN",
+    [STRCMP] = "STRCMP",
+    [STRCHR] = "STRCHR",
+    [PRINTS] = "PRINTS",
+
+    [VADDI] = "VADDI",
+    [VADDF] = "VADDF",
+    [VSUBI] = "VSUBI",
+    [VSUBF] = "VSUBF",
+    [VMULI] = "VMULI",
+    [VMULF] = "VMULF",
+    [VMINI] = "VMINI",
+    [VMINF] = "VMINF",
+    [VMAXI] = "VMAXI",
+    [VMAXF] = "VMAXF",
+    [VFMAI] = "VFMAI",
+    [VFMAF] = "VFMAF",
+    [VSUMI] = "VSUMI",
+    [VSUMF] = "VSUMF",
+
+    [FLUSH] = "FLUSH"
+};
+
 
 Opcode opcodeFromString(const char* opcodeStr) {
     for(size_t i = 0; i < MAX_OPCODES; i++) {
-        if(!strCmpIgnoreCase(OpcodeStr[i], opcodeStr)) {
+        // the opcode numbers between the two formats have no name
+        if(OpcodeStr[i] && !strCmpIgnoreCase(OpcodeStr[i], opcodeStr)) {
             return i;
         }
     }
@@ -17,6 +134,7 @@ size_t opcodeNumArgs(Opcode opcode) {
     switch(opcode) {
         case RET:
         case NOOP: 
+        case FLUSH:
             return 0;
         case PUSHI:
         case PUSHF:
@@ -33,16 +151,105 @@ size_t opcodeNumArgs(Opcode opcode) {
         case PRINTB:
         case PRINTC:
         case CALL:
+        case FREE:
+        case SYSCALL:
+        case PRINTS:
             return 1;
+        case MEMCPY:
+        case MEMSET:
+        case MEMCMP:
+        case STRCHR:
+        case VADDI: case VADDF:
+        case VSUBI: case VSUBF:
+        case VMULI: case VMULF:
+        case VMINI: case VMINF:
+        case VMAXI: case VMAXF:
+        case VSUMI: case VSUMF:
+            return 3;
+        case VFMAI:
+        case VFMAF:
+            return 4;
         default: 
             return 2;
     }
 }
 
+Arg2Type opcodeArg2Type(Opcode opcode) {
+    switch(opcode) {
+        case NOOP:
+        case RET:
+        case FLUSH:
+            return ARG2_NONE;
+        case MOVF:
+        case PUSHF:
+        case IFF:
+        case IFEF:
+        case PRINTF:
+        case ADDF:
+        case SUBF:
+        case MULF:
+        case DIVF:
+        case MODF:
+            return ARG2_VALUE_FLOAT;
+        case LDCI:
+        case LDCB:
+            return ARG2_CONST_INT;
+        case LDCF:
+            return ARG2_CONST_FLOAT;
+        case LDCA:
+            return ARG2_CONST_ADDR;
+        case POPI:
+        case POPF:
+        case POPB:
+        case DUPI:
+        case DUPF:
+        case DUPB:
+            return ARG2_DEST_REG;
+        case JMP:
+        case CALL:
+            return ARG2_TARGET;
+        default:
+            return opcode >= FIRST_EXT_OPCODE ? ARG2_EXT_REGS : ARG2_VALUE_INT;
+    }
+}
+
+size_t opcodeArg2Size(Opcode opcode) {
+    switch(opcode) {
+        case MOVB:
+        case LDCB:
+        case PUSHB:
+        case IFB:
+        case IFEB:
+        case PRINTB:
+        case PRINTC:
+        case ADDB:
+        case SUBB:
+        case MULB:
+        case DIVB:
+        case MODB:
+        case ORB:
+        case ANDB:
+        case NOTB:
+        case XORB:
+        case SZRLB:
+        case SRLB:
+        case SLLB:
+            return 1;
+        default:
+            return 4;
+    }
+}
+
 void bytecodeFree(Bytecode* code) {
     if(code) {
-        litaFree(code->constants);
-        litaFree(code->instrs);
+        if(code->file) {
+            lbcClose(code->file);
+        }
+        else {
+            litaFree(code->constants);
+            litaFree(code->instrs);
+        }
+        litaFree(code->decoded);
         litaFree(code);
     }
 }
@@ -38,7 +38,32 @@ typedef uint32_t Address;
 // 0b000000_1111_1111_1111_1111_1111_1111    
 #define ARG_JMP_VALUE_MASK 0xffffff
 
-#define OPCODE(instruction) (instruction >> OPCODE_SHIFT)
+/*
+ * Extended instruction format.  The opcodes that don't fit the 6 bit opcode field have 
+ * OPCODE_EXT in it and their number, counted from FIRST_EXT_OPCODE, in the top 8 bits
+ * of the second argument.  They take up to four register arguments, the first one in the
+ * usual first argument bits (which has no address bit) and the others after the 
+ * extended opcode number, with room for a fourth one.
+ */
+#define OPCODE_EXT 0x3f
+#define FIRST_EXT_OPCODE 64
+#define EXT_OPCODE_SHIFT 13
+// 0b1111_1111
+#define EXT_OPCODE_MASK 0xff
+#define EXT_ARG2_SHIFT 9
+#define EXT_ARG3_SHIFT 5
+#define EXT_ARG4_SHIFT 1
+// 0b1111
+#define EXT_ARG_MASK 0xf
+
+#define OPCODE_FIELD(instruction) ((instruction >> OPCODE_SHIFT) & OPCODE_MASK)
+#define OPCODE(instruction) (OPCODE_FIELD(instruction) == OPCODE_EXT                      \
+    ? FIRST_EXT_OPCODE + ((instruction >> EXT_OPCODE_SHIFT) & EXT_OPCODE_MASK)           \
+    : OPCODE_FIELD(instruction))
+
+#define EXT_ARG2_VALUE(instruction) ((instruction >> EXT_ARG2_SHIFT) & EXT_ARG_MASK)
+#define EXT_ARG3_VALUE(instruction) ((instruction >> EXT_ARG3_SHIFT) & EXT_ARG_MASK)
+#define EXT_ARG4_VALUE(instruction) ((instruction >> EXT_ARG4_SHIFT) & EXT_ARG_MASK)
 
 #define IS_ARG1_ADDR(instruction) (((instruction >> ARG1_SHIFT) & ARG1_ADDR_MASK) != 0)
 #define ARG1_VALUE(instruction) ((instruction >> ARG1_SHIFT) & ARG1_VALUE_MASK)
@@ -132,95 +157,70 @@ typedef enum Opcode {
     SLLI,  // Bitwise shift left logical operator for integer SLLI $a $b => $a << $b
     SLLB,  // Bitwise shift left logical operator for byte SLLB $a $b => $a << $b
 
+    ALLOC,   // Allocates a heap block of $b bytes ALLOC $a $b => $a = address of the block, 0 if there is no room
+    FREE,    // Frees the heap block at address $a, nothing happens for 0
+    REALLOC, // Resizes the heap block at address $a to $b bytes REALLOC $a $b => $a = address of the moved block, 0 if there is no room
+
+    SYSCALL, // Calls the host function registered under the number $b, see vmRegisterSyscall
+
+    // 63 is OPCODE_EXT, the extended opcodes follow
+
+    MEMCPY = FIRST_EXT_OPCODE, // Copies $c bytes from address $b to address $a, the ranges may overlap MEMCPY $a $b $c
+    MEMSET,  // Fills $c bytes at address $a with the byte $b MEMSET $a $b $c
+    MEMCMP,  // Compares $c bytes at addresses $a and $b MEMCMP $a $b $c => $a = -1, 0 or 1
+
+    STRLEN,  // Length of the null terminated string at address $b STRLEN $a $b => $a = length
+    STRCMP,  // Compares the null terminated strings at addresses $a and $b STRCMP $a $b => $a = -1, 0 or 1
+    STRCHR,  // Finds the byte $c in the null terminated string at address $b STRCHR $a $b $c => $a = address of the byte, 0 if it isn't there
+    PRINTS,  // Prints the null terminated string at address $a
+
+    // Packed vector operations over the $c int/float elements of the arrays at addresses $a and $b
+    VADDI,   // VADDI $a $b $c => $a[i] = $a[i] + $b[i]
+    VADDF,   // VADDF $a $b $c => $a[i] = $a[i] + $b[i]
+    VSUBI,   // VSUBI $a $b $c => $a[i] = $a[i] - $b[i]
+    VSUBF,   // VSUBF $a $b $c => $a[i] = $a[i] - $b[i]
+    VMULI,   // VMULI $a $b $c => $a[i] = $a[i] * $b[i]
+    VMULF,   // VMULF $a $b $c => $a[i] = $a[i] * $b[i]
+    VMINI,   // VMINI $a $b $c => $a[i] = min($a[i], $b[i])
+    VMINF,   // VMINF $a $b $c => $a[i] = min($a[i], $b[i])
+    VMAXI,   // VMAXI $a $b $c => $a[i] = max($a[i], $b[i])
+    VMAXF,   // VMAXF $a $b $c => $a[i] = max($a[i], $b[i])
+    VFMAI,   // Multiply-add by the value of $c VFMAI $a $b $c $d => $a[i] = $a[i] + $b[i] * $c for $d elements
+    VFMAF,   // Multiply-add by the value of $c VFMAF $a $b $c $d => $a[i] = $a[i] + $b[i] * $c for $d elements
+    VSUMI,   // Sum of the $c elements of the array at address $b VSUMI $a $b $c => $a = sum
+    VSUMF,   // Sum of the $c elements of the array at address $b VSUMF $a $b $c => $a = sum
+
+    FLUSH,   // Writes out the buffered output of the print opcodes
+
     MAX_OPCODES
 } Opcode;
 
-const char* OpcodeStr[] = {
-    [NOOP] = "NOOP",
-    [MOVI] = "MOVI",   
-    [MOVF] = "MOVF",   
-    [MOVB] = "MOVB",   
-    
-    [LDCI] = "LDCI",   
-    [LDCF] = "LDCF",   
-    [LDCB] = "LDCB",   
-    [LDCA] = "LDCA",   
-    
-    [PUSHI] = "PUSHI", 
-    [PUSHF] = "PUSHF", 
-    [PUSHB] = "PUSHB", 
-    
-    [POPI] = "POPI",  
-    [POPF] = "POPF",  
-    [POPB] = "POPB",  
-    
-    [DUPI] = "DUPI",  
-    [DUPF] = "DUPF",  
-    [DUPB] = "DUPB",  
-    
-    [IFI] = "IFI",  
-    [IFF] = "IFF",  
-    [IFB] = "IFB",  
-    
-    [IFEI] = "IFEI",
-    [IFEF] = "IFEF",
-    [IFEB] = "IFEB",
-    
-    [JMP] = "JMP",   
-    
-    [PRINTI] = "PRINTI", 
-    [PRINTF] = "PRINTF", 
-    [PRINTB] = "PRINTB", 
-    [PRINTC] = "PRINTC", 
-    
-    [CALL] = "CALL", 
-    [RET] = "RET",   
-    
-    [ADDI] = "ADDI", 
-    [ADDF] = "ADDF", 
-    [ADDB] = "ADDB", 
-    
-    [SUBI] = "SUBI", 
-    [SUBF] = "SUBF", 
-    [SUBB] = "SUBB", 
-    
-    [MULI] = "MULI", 
-    [MULF] = "MULF", 
-    [MULB] = "MULB", 
-    
-    [DIVI] = "DIVI", 
-    [DIVF] = "DIVF", 
-    [DIVB] = "DIVB", 
-    
-    [MODI] = "MODI", 
-    [MODF] = "MODF", 
-    [MODB] = "MODB", 
-    
-    [ORI] = "ORI",   
-    [ORB] = "ORB",   
-    
-    [ANDI] = "ANDI",  
-    [ANDB] = "ANDB",  
-    
-    [NOTI] = "NOTI",  
-    [NOTB] = "NOTB",  
-    
-    [XORI] = "XORI",  
-    [XORB] = "XORB",  
-    
-    [SZRLI] = "SZRLI",
-    [SZRLB] = "SZRLB",
-    
-    [SRLI] = "SRLI", 
-    [SRLB] = "SRLB", 
-    
-    [SLLI] = "SLLI", 
-    [SLLB] = "SLLB"  
-};
+/* the assembler names of the opcodes, NULL for the numbers without an opcode */
+extern const char* OpcodeStr[];
 
 Opcode opcodeFromString(const char* opcodeStr);
 size_t opcodeNumArgs(Opcode opcode);
 
+/* how an opcode interprets its second argument when it is not a register */
+typedef enum Arg2Type {
+    ARG2_NONE,
+    ARG2_VALUE_INT,   // immediate value or constant lookup
+    ARG2_VALUE_FLOAT, // constant lookup, immediate values are not supported for floats
+    ARG2_CONST_INT,   // LDCI/LDCB: immediate value or constant lookup, regardless of the register bit
+    ARG2_CONST_FLOAT, // LDCF: always a constant lookup
+    ARG2_CONST_ADDR,  // LDCA: the address of the constant
+    ARG2_DEST_REG,    // POP/DUP: the register to store into
+    ARG2_TARGET,      // JMP/CALL: the instruction index to jump to
+    ARG2_EXT_REGS,    // extended opcodes: the second and third register
+} Arg2Type;
+
+Arg2Type opcodeArg2Type(Opcode opcode);
+
+/* the bytes a second argument that is not a register reads from RAM, 1 for the byte opcodes */
+size_t opcodeArg2Size(Opcode opcode);
+
+struct DecodedInstr;
+
 typedef struct Bytecode {
     Address* constants;
     size_t   numOfConstants;
@@ -229,6 +229,9 @@ typedef struct Bytecode {
     Address length;
     Address pc;
 
+    struct DecodedInstr* decoded; /* the instructions decoded for the interpreter, see vmDecode */
+    int verified;                 /* the VERIFIED_* properties proven by verify */
+    struct LbcFile* file;         /* the mapped .lbc the instructions and constants are in, NULL if they are allocated */
 } Bytecode;
 
 void bytecodeFree(Bytecode* code);
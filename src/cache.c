@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "cache.h"
+#include "lbc.h"
+#include "buf.h"
+#include "common.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define LITA_COMPILE_CACHE 1
+    #include <unistd.h>
+    #include <errno.h>
+    #include <dirent.h>
+    #include <sys/stat.h>
+    #include <sys/time.h>
+#else
+    #define LITA_COMPILE_CACHE 0
+#endif
+
+/* a temporary file this old was left by a process that died while writing it */
+#define CACHE_STALE_SECONDS (60 * 60)
+
+#if LITA_COMPILE_CACHE
+/* 64 bit FNV-1a */
+static uint64_t cacheHash(uint64_t hash, const void* bytes, size_t len) {
+    const unsigned char* p = (const unsigned char*) bytes;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* the entry of the source, a buf.  The protected pool of the Vm changes how it is assembled */
+static char* cachePath(CompileCache* cache, Vm* vm, const char* assembly) {
+    uint32_t versions[] = { ASSEMBLER_VERSION, LBC_VERSION, (uint32_t)(vm->protectConstants != 0) };
+    size_t len = strlen(assembly);
+    uint64_t hash = cacheHash(0xcbf29ce484222325ull, versions, sizeof(versions));
+    hash = cacheHash(hash, assembly, len);
+
+    char* path = NULL;
+    buf_printf(path, "%s/%016llx-%llx.lbc", cache->dir, (unsigned long long)hash, (unsigned long long)len);
+    return path;
+}
+
+static int cacheHasSuffix(const char* name, const char* suffix) {
+    size_t nameLen = strlen(name);
+    size_t suffixLen = strlen(suffix);
+    return nameLen >= suffixLen && !strcmp(name + nameLen - suffixLen, suffix);
+}
+
+typedef struct CacheEntry {
+    char*    path;      /* buf */
+    time_t   used;      /* the modification time, which hits bump */
+    uint64_t size;
+} CacheEntry;
+
+static int compareCacheEntries(const void* a, const void* b) {
+    const CacheEntry* x = (const CacheEntry*)a;
+    const CacheEntry* y = (const CacheEntry*)b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+/* removes the entries used least recently until the others fit, except for 'keep' */
+static void cacheEvict(CompileCache* cache, const char* keep) {
+    DIR* dir = opendir(cache->dir);
+    if(!dir) {
+        return;
+    }
+
+    CacheEntry* entries = NULL;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+    for(struct dirent* item = readdir(dir); item; item = readdir(dir)) {
+        int isEntry = cacheHasSuffix(item->d_name, ".lbc");
+        if(!isEntry && !cacheHasSuffix(item->d_name, ".tmp")) {
+            continue;
+        }
+
+        CacheEntry entry = { NULL, 0, 0 };
+        buf_printf(entry.path, "%s/%s", cache->dir, item->d_name);
+        struct stat info;
+        if(stat(entry.path, &info)) {
+            buf_free(entry.path);
+            continue;
+        }
+
+        if(!isEntry) {
+            if(now - info.st_mtime > CACHE_STALE_SECONDS) {
+                unlink(entry.path);
+            }
+            buf_free(entry.path);
+            continue;
+        }
+
+        entry.used = info.st_mtime;
+        entry.size = (uint64_t)info.st_size;
+        total += entry.size;
+        buf_push(entries, entry);
+    }
+    closedir(dir);
+
+    qsort(entries, buf_len(entries), sizeof(CacheEntry), compareCacheEntries);
+    for(size_t i = 0; i < buf_len(entries); i++) {
+        if(total > cache->maxSize && strcmp(entries[i].path, keep) && !unlink(entries[i].path)) {
+            total -= entries[i].size;
+            cache->evictions++;
+        }
+        buf_free(entries[i].path);
+    }
+    buf_free(entries);
+}
+
+/* writes the entry next to where it goes and renames it into place */
+static void cacheStore(CompileCache* cache, const char* path, Vm* vm, Bytecode* code, DebugInfo* debug) {
+    char* temporary = NULL;
+    buf_printf(temporary, "%s.%ld.tmp", path, (long)getpid());
+    if(lbcWrite(temporary, vm, code, debug) && !rename(temporary, path)) {
+        cacheEvict(cache, path);
+    }
+    else {
+        unlink(temporary);
+        cache->failedWrites++;
+    }
+    buf_free(temporary);
+}
+#endif
+
+CompileCache* cacheInit(const char* dir, uint64_t maxSize) {
+#if LITA_COMPILE_CACHE
+    struct stat info;
+    if((mkdir(dir, 0777) && errno != EEXIST) || stat(dir, &info) || !S_ISDIR(info.st_mode)) {
+        return NULL;
+    }
+
+    CompileCache* cache = (CompileCache*) litaMalloc(sizeof(CompileCache));
+    memset(cache, 0, sizeof(CompileCache));
+    buf_printf(cache->dir, "%s", dir);
+    cache->maxSize = maxSize ? maxSize : CACHE_DEFAULT_MAX_SIZE;
+    return cache;
+#else
+    (void)dir;
+    (void)maxSize;
+    return NULL;
+#endif
+}
+
+void cacheFree(CompileCache* cache) {
+    if(cache) {
+        buf_free(cache->dir);
+        litaFree(cache);
+    }
+}
+
+Bytecode* cacheCompile(CompileCache* cache, Vm* vm, const char* assembly, DebugInfo* debug) {
+#if LITA_COMPILE_CACHE
+    char* path = cachePath(cache, vm, assembly);
+    LbcFile* file = lbcOpenValid(path);
+    if(file) {
+        cache->hits++;
+        // the entry is now the one used most recently
+        utimes(path, NULL);
+        buf_free(path);
+
+        if(debug) {
+            lbcReadDebug(file, debug);
+        }
+        return lbcLoad(vm, file);
+    }
+
+    // the entry keeps the names and lines even if this run has no use for them
+    cache->misses++;
+    DebugInfo kept = { 0 };
+    Bytecode* code = compileDebug(vm, assembly, debug ? debug : &kept);
+    cacheStore(cache, path, vm, code, debug ? debug : &kept);
+    debugInfoFree(&kept);
+    buf_free(path);
+    return code;
+#else
+    (void)cache;
+    return compileDebug(vm, assembly, debug);
+#endif
+}
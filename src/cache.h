@@ -0,0 +1,43 @@
+#ifndef LITA_CACHE_H
+#define LITA_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bytecode.h"
+#include "assembler.h"
+#include "vm.h"
+
+/*
+ * The compile cache, a directory of .lbc files named after a hash of the source they were
+ * assembled from, the assembler and .lbc versions and whether the pool is protected, which
+ * changes how the constants are laid out.  A program that was assembled before is mapped
+ * from its file instead, see lbc.h.  An entry is written to a temporary file and renamed
+ * into place, so processes sharing the directory never see half of one.
+ * A hit bumps the modification time of the entry, and a process that adds an entry evicts
+ * the ones used least recently until the entries fit in the size bound.
+ *
+ * Only POSIX systems have a cache, elsewhere cacheInit returns NULL.
+ */
+#define CACHE_DEFAULT_MAX_SIZE (64 * 1024 * 1024)
+
+typedef struct CompileCache {
+    char*    dir;
+    uint64_t maxSize;     /* of the entries together, in bytes */
+
+    uint64_t hits;        /* the counters of this process */
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t failedWrites;
+} CompileCache;
+
+/* the cache in 'dir', which is created if it doesn't exist, NULL if it can't be used.  'maxSize' 0 picks CACHE_DEFAULT_MAX_SIZE */
+CompileCache* cacheInit(const char* dir, uint64_t maxSize);
+void          cacheFree(CompileCache* cache);
+
+/*
+ * compileDebug through the cache, the code of a hit keeps its entry mapped until
+ * bytecodeFree.  'debug' may be NULL, otherwise it is filled in on a hit too.
+ */
+Bytecode*     cacheCompile(CompileCache* cache, Vm* vm, const char* assembly, DebugInfo* debug);
+
+#endif
@@ -3,13 +3,25 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <setjmp.h>
 
 #include "common.h"
 
-#ifndef _WINDOWS    
+#ifdef _WIN32
     #define strcasecmp _stricmp
 #endif
 
+LITA_THREAD_LOCAL jmp_buf* litaErrorJump = NULL;
+LITA_THREAD_LOCAL int      litaErrorStatus = 0;
+
+void litaExit(int status) {
+    if(litaErrorJump) {
+        litaErrorStatus = status;
+        longjmp(*litaErrorJump, 1);
+    }
+    exit(status);
+}
+
 void* litaMalloc(size_t size) {
     return malloc(size);
 }
@@ -30,7 +42,7 @@ char* readFile(const char* path) {
 
     if (file == NULL) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(1);
+        litaExit(1);
     }
 
     fseek(file, 0L, SEEK_END);
@@ -41,7 +53,8 @@ char* readFile(const char* path) {
 
     if (buffer == NULL) {
         fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(1);
+        fclose(file);
+        litaExit(1);
     }
   
 
@@ -49,7 +62,9 @@ char* readFile(const char* path) {
 
     if (bytesRead < fileSize) {
         fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(1);
+        litaFree(buffer);
+        fclose(file);
+        litaExit(1);
     }
   
     buffer[bytesRead] = '\0';
@@ -1,6 +1,8 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <setjmp.h>
+
 #define MIN(x, y) ((x) <= (y) ? (x) : (y))
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
 #define CLAMP_MAX(x, max) MIN(x, max)
@@ -11,6 +13,32 @@
 #define ALIGN_DOWN_PTR(p, a) ((void *)ALIGN_DOWN((uintptr_t)(p), (a)))
 #define ALIGN_UP_PTR(p, a) ((void *)ALIGN_UP((uintptr_t)(p), (a)))
 
+/* keeps an error path out of the hot functions that call it */
+#if defined(__GNUC__) || defined(__clang__)
+    #define LITA_COLD __attribute__((noinline, cold))
+#elif defined(_MSC_VER)
+    #define LITA_COLD __declspec(noinline)
+#else
+    #define LITA_COLD
+#endif
+
+/* state of the running vmExecute, each thread has its own */
+#if defined(_MSC_VER)
+    #define LITA_THREAD_LOCAL __declspec(thread)
+#else
+    #define LITA_THREAD_LOCAL _Thread_local
+#endif
+
+/*
+ * Where the errors of the thread's running litavm call jump to, see litavm.c, with the exit
+ * status of the error in litaErrorStatus.  NULL for the litavm command, whose errors exit.
+ */
+extern LITA_THREAD_LOCAL jmp_buf* litaErrorJump;
+extern LITA_THREAD_LOCAL int      litaErrorStatus;
+
+/* ends the running litavm call with the status, or the process if there is none */
+void  litaExit(int status);
+
 void* litaMalloc(size_t size);
 void* litaRealloc(void* ptr, size_t newSize);
 void  litaFree(void* mem);
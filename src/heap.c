@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "heap.h"
+#include "buf.h"
+#include "common.h"
+
+#define HEAP_PAGE_ADDRESS(heap, page) ((heap)->start + (Address)(page) * HEAP_PAGE_SIZE)
+
+static uint32_t heapClassSize(uint8_t sizeClass) {
+    return 1u << (HEAP_MIN_BLOCK_SHIFT + sizeClass);
+}
+
+static uint8_t heapSizeClass(uint32_t size) {
+    uint8_t sizeClass = 0;
+    while(heapClassSize(sizeClass) < size) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+static uint32_t heapLowestBit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_ctzll(bits);
+#else
+    uint32_t bit = 0;
+    while(!((bits >> bit) & 1)) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static void heapUse(Heap* heap, uint64_t bytes) {
+    heap->stats.usedBytes += bytes;
+    heap->stats.peakUsedBytes = MAX(heap->stats.peakUsedBytes, heap->stats.usedBytes);
+}
+
+Heap* heapInit(Address start, Address end) {
+    // a block at address 0 would read as a failed allocation
+    uint64_t first = ALIGN_UP((uint64_t)MAX(start, 1), HEAP_PAGE_SIZE);
+    uint64_t last = ALIGN_DOWN((uint64_t)end, HEAP_PAGE_SIZE);
+
+    Heap* heap = (Heap*) litaMalloc(sizeof(Heap));
+    memset(heap, 0, sizeof(Heap));
+    heap->start = (Address) first;
+    heap->numOfPages = last > first ? (uint32_t)((last - first) / HEAP_PAGE_SIZE) : 0;
+    heap->pages = (HeapPage*) litaMalloc(MAX(heap->numOfPages, 1) * sizeof(HeapPage));
+    memset(heap->pages, 0, MAX(heap->numOfPages, 1) * sizeof(HeapPage));
+
+    if(heap->numOfPages) {
+        buf_push(heap->freeRuns, (HeapRun){ .page = 0, .count = heap->numOfPages });
+    }
+    return heap;
+}
+
+Heap* heapClone(Heap* heap) {
+    Heap* clone = (Heap*) litaMalloc(sizeof(Heap));
+    *clone = *heap;
+    clone->freeRuns = NULL;
+
+    clone->pages = (HeapPage*) litaMalloc(MAX(heap->numOfPages, 1) * sizeof(HeapPage));
+    memcpy(clone->pages, heap->pages, MAX(heap->numOfPages, 1) * sizeof(HeapPage));
+    for(uint32_t i = 0; i < heap->numOfPages; i++) {
+        if(heap->pages[i].slab) {
+            clone->pages[i].slab = (HeapSlab*) litaMalloc(sizeof(HeapSlab));
+            *clone->pages[i].slab = *heap->pages[i].slab;
+        }
+    }
+
+    for(size_t i = 0; i < buf_len(heap->freeRuns); i++) {
+        buf_push(clone->freeRuns, heap->freeRuns[i]);
+    }
+    for(int c = 0; c < HEAP_NUM_CLASSES; c++) {
+        clone->partial[c] = NULL;
+        for(size_t i = 0; i < buf_len(heap->partial[c]); i++) {
+            buf_push(clone->partial[c], heap->partial[c][i]);
+        }
+    }
+    return clone;
+}
+
+void heapFree(Heap* heap) {
+    if(heap) {
+        for(uint32_t i = 0; i < heap->numOfPages; i++) {
+            litaFree(heap->pages[i].slab);
+        }
+        for(int c = 0; c < HEAP_NUM_CLASSES; c++) {
+            buf_free(heap->partial[c]);
+        }
+        buf_free(heap->freeRuns);
+        litaFree(heap->pages);
+        litaFree(heap);
+    }
+}
+
+/* takes the first free run that fits, returns the index of its first page or -1 */
+static int64_t heapTakePages(Heap* heap, uint32_t count) {
+    size_t numOfRuns = buf_len(heap->freeRuns);
+    for(size_t i = 0; i < numOfRuns; i++) {
+        HeapRun* run = &heap->freeRuns[i];
+        if(run->count < count) {
+            continue;
+        }
+
+        uint32_t page = run->page;
+        run->page += count;
+        run->count -= count;
+        if(!run->count) {
+            memmove(run, run + 1, (numOfRuns - i - 1) * sizeof(HeapRun));
+            buf__hdr(heap->freeRuns)->len--;
+        }
+        return page;
+    }
+
+    return -1;
+}
+
+/* puts the pages back in the free runs, merging them with the runs they border */
+static void heapReturnPages(Heap* heap, uint32_t page, uint32_t count) {
+    size_t numOfRuns = buf_len(heap->freeRuns);
+    size_t low = 0, high = numOfRuns;
+    while(low < high) {
+        size_t mid = (low + high) / 2;
+        if(heap->freeRuns[mid].page < page) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    int mergesBefore = low > 0 && heap->freeRuns[low - 1].page + heap->freeRuns[low - 1].count == page;
+    int mergesAfter = low < numOfRuns && page + count == heap->freeRuns[low].page;
+    if(mergesBefore && mergesAfter) {
+        heap->freeRuns[low - 1].count += count + heap->freeRuns[low].count;
+        memmove(&heap->freeRuns[low], &heap->freeRuns[low + 1], (numOfRuns - low - 1) * sizeof(HeapRun));
+        buf__hdr(heap->freeRuns)->len--;
+    }
+    else if(mergesBefore) {
+        heap->freeRuns[low - 1].count += count;
+    }
+    else if(mergesAfter) {
+        heap->freeRuns[low].page = page;
+        heap->freeRuns[low].count += count;
+    }
+    else {
+        buf_fit(heap->freeRuns, numOfRuns + 1);
+        memmove(&heap->freeRuns[low + 1], &heap->freeRuns[low], (numOfRuns - low) * sizeof(HeapRun));
+        heap->freeRuns[low] = (HeapRun){ .page = page, .count = count };
+        buf__hdr(heap->freeRuns)->len++;
+    }
+}
+
+static void heapRemovePartial(Heap* heap, HeapSlab* slab) {
+    uint32_t* partial = heap->partial[slab->sizeClass];
+    uint32_t last = partial[buf_len(partial) - 1];
+    partial[slab->partialIndex] = last;
+    heap->pages[last].slab->partialIndex = slab->partialIndex;
+    buf__hdr(partial)->len--;
+}
+
+static void heapAddPartial(Heap* heap, uint32_t page) {
+    HeapSlab* slab = heap->pages[page].slab;
+    slab->partialIndex = (uint32_t) buf_len(heap->partial[slab->sizeClass]);
+    buf_push(heap->partial[slab->sizeClass], page);
+}
+
+static Address heapAllocSmall(Heap* heap, uint8_t sizeClass) {
+    uint32_t classSize = heapClassSize(sizeClass);
+    uint32_t blocks = HEAP_PAGE_SIZE / classSize;
+
+    if(!buf_len(heap->partial[sizeClass])) {
+        int64_t page = heapTakePages(heap, 1);
+        if(page < 0) {
+            return 0;
+        }
+
+        HeapSlab* slab = (HeapSlab*) litaMalloc(sizeof(HeapSlab));
+        memset(slab, 0, sizeof(HeapSlab));
+        slab->sizeClass = sizeClass;
+        for(uint32_t b = 0; b < blocks; b++) {
+            slab->free[b / 64] |= 1ull << (b % 64);
+        }
+        heap->pages[page].slab = slab;
+        heap->stats.slabBytes += HEAP_PAGE_SIZE;
+        heapAddPartial(heap, (uint32_t) page);
+    }
+
+    uint32_t* partial = heap->partial[sizeClass];
+    uint32_t page = partial[buf_len(partial) - 1];
+    HeapSlab* slab = heap->pages[page].slab;
+
+    uint32_t word = 0;
+    while(!slab->free[word]) {
+        word++;
+    }
+    uint32_t block = word * 64 + heapLowestBit(slab->free[word]);
+    slab->free[word] &= slab->free[word] - 1;
+
+    if(++slab->used == blocks) {
+        heapRemovePartial(heap, slab);
+    }
+
+    heap->stats.slabUsedBytes += classSize;
+    heapUse(heap, classSize);
+    return HEAP_PAGE_ADDRESS(heap, page) + block * classSize;
+}
+
+static Address heapAllocLarge(Heap* heap, uint32_t size) {
+    uint32_t count = (uint32_t)(((uint64_t)size + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE);
+    int64_t page = heapTakePages(heap, count);
+    if(page < 0) {
+        return 0;
+    }
+
+    heap->pages[page].run = count;
+    heapUse(heap, (uint64_t)count * HEAP_PAGE_SIZE);
+    return HEAP_PAGE_ADDRESS(heap, page);
+}
+
+Address heapAlloc(Heap* heap, uint32_t size) {
+    Address address = size <= HEAP_MAX_SMALL_BLOCK
+        ? heapAllocSmall(heap, heapSizeClass(size))
+        : heapAllocLarge(heap, size);
+
+    if(address) {
+        heap->stats.allocCount++;
+    }
+    else {
+        heap->stats.failedCount++;
+    }
+    return address;
+}
+
+/* the page holding the address, -1 if it isn't a heap address */
+static int64_t heapPageOf(Heap* heap, Address address) {
+    if(address < heap->start) {
+        return -1;
+    }
+
+    uint64_t page = (address - heap->start) / HEAP_PAGE_SIZE;
+    return page < heap->numOfPages ? (int64_t)page : -1;
+}
+
+uint32_t heapBlockSize(Heap* heap, Address address) {
+    int64_t page = heapPageOf(heap, address);
+    if(page < 0) {
+        return 0;
+    }
+
+    Address offset = address - HEAP_PAGE_ADDRESS(heap, page);
+    HeapSlab* slab = heap->pages[page].slab;
+    if(slab) {
+        uint32_t classSize = heapClassSize(slab->sizeClass);
+        uint32_t block = offset / classSize;
+        int isFree = (slab->free[block / 64] >> (block % 64)) & 1;
+        return (offset % classSize || isFree) ? 0 : classSize;
+    }
+
+    return offset ? 0 : heap->pages[page].run * HEAP_PAGE_SIZE;
+}
+
+int heapRelease(Heap* heap, Address address) {
+    uint32_t size = heapBlockSize(heap, address);
+    if(!size) {
+        return 0;
+    }
+
+    uint32_t page = (uint32_t) heapPageOf(heap, address);
+    HeapSlab* slab = heap->pages[page].slab;
+    if(slab) {
+        uint32_t blocks = HEAP_PAGE_SIZE / size;
+        uint32_t block = (address - HEAP_PAGE_ADDRESS(heap, page)) / size;
+        slab->free[block / 64] |= 1ull << (block % 64);
+        heap->stats.slabUsedBytes -= size;
+
+        if(slab->used-- == blocks) {
+            heapAddPartial(heap, page);
+        }
+        // an empty slab goes back to the free pages, so any size class or large block can use it
+        if(!slab->used) {
+            heapRemovePartial(heap, slab);
+            litaFree(slab);
+            heap->pages[page].slab = NULL;
+            heap->stats.slabBytes -= HEAP_PAGE_SIZE;
+            heapReturnPages(heap, page, 1);
+        }
+    }
+    else {
+        heapReturnPages(heap, page, heap->pages[page].run);
+        heap->pages[page].run = 0;
+    }
+
+    heap->stats.usedBytes -= size;
+    heap->stats.freeCount++;
+    return 1;
+}
+
+uint64_t heapFreeBytes(Heap* heap) {
+    uint64_t pages = 0;
+    for(size_t i = 0; i < buf_len(heap->freeRuns); i++) {
+        pages += heap->freeRuns[i].count;
+    }
+    return pages * HEAP_PAGE_SIZE;
+}
+
+uint64_t heapLargestFreeBytes(Heap* heap) {
+    uint64_t pages = 0;
+    for(size_t i = 0; i < buf_len(heap->freeRuns); i++) {
+        pages = MAX(pages, heap->freeRuns[i].count);
+    }
+    return pages * HEAP_PAGE_SIZE;
+}
@@ -0,0 +1,78 @@
+#ifndef LITA_HEAP_H
+#define LITA_HEAP_H
+
+#include <stdint.h>
+#include "bytecode.h"
+
+/*
+ * The allocator behind the ALLOC, FREE and REALLOC opcodes.  It hands out blocks of the
+ * guest address range between $h and the stack, while all of its bookkeeping lives in
+ * host memory, so a guest writing past the end of a block can't corrupt the allocator.
+ *
+ * The range is split into HEAP_PAGE_SIZE pages.  Small blocks are carved from slabs, pages
+ * holding blocks of a single size class, larger ones take runs of whole pages that are
+ * found first-fit in an address ordered list of the free runs, which coalesces them on free.
+ */
+#define HEAP_PAGE_SIZE        4096
+#define HEAP_MIN_BLOCK_SHIFT  4                                          /* 16 bytes */
+#define HEAP_NUM_CLASSES      8                                          /* 16, 32, .. 2048 bytes */
+#define HEAP_MAX_SMALL_BLOCK  (1 << (HEAP_MIN_BLOCK_SHIFT + HEAP_NUM_CLASSES - 1))
+#define HEAP_SLAB_WORDS       (HEAP_PAGE_SIZE / (1 << HEAP_MIN_BLOCK_SHIFT) / 64)
+
+typedef struct HeapSlab {
+    uint64_t free[HEAP_SLAB_WORDS];  /* a set bit per free block */
+    uint32_t used;                   /* blocks handed out */
+    uint32_t partialIndex;           /* position in Heap.partial, while the slab has free blocks */
+    uint8_t  sizeClass;
+} HeapSlab;
+
+typedef struct HeapPage {
+    HeapSlab* slab;  /* the slab the page holds, NULL otherwise */
+    uint32_t  run;   /* pages of the large block starting at this page, 0 otherwise */
+} HeapPage;
+
+typedef struct HeapRun {
+    uint32_t page;
+    uint32_t count;
+} HeapRun;
+
+typedef struct HeapStats {
+    uint64_t allocCount;
+    uint64_t freeCount;
+    uint64_t reallocCount;
+    uint64_t failedCount;     /* allocations that didn't fit, ALLOC returned 0 */
+
+    uint64_t usedBytes;       /* held by live blocks, rounded up to their size class or pages */
+    uint64_t peakUsedBytes;
+    uint64_t slabBytes;       /* in pages currently holding slabs */
+    uint64_t slabUsedBytes;   /* held by live blocks in slabs */
+} HeapStats;
+
+typedef struct Heap {
+    Address   start;          /* page aligned address of the first page */
+    uint32_t  numOfPages;
+    HeapPage* pages;
+    HeapRun*  freeRuns;       /* buf, ordered by page and never adjacent */
+    uint32_t* partial[HEAP_NUM_CLASSES]; /* buf, pages of the slabs with free blocks by size class */
+    HeapStats stats;
+} Heap;
+
+/* manages the whole pages in [start, end), which may be none */
+Heap*   heapInit(Address start, Address end);
+Heap*   heapClone(Heap* heap);
+void    heapFree(Heap* heap);
+
+/* returns 0 if there is no room, no block ever starts at address 0 */
+Address heapAlloc(Heap* heap, uint32_t size);
+
+/* returns false if the address isn't the start of a live block */
+int     heapRelease(Heap* heap, Address address);
+
+/* the usable size of the live block starting at the address, 0 if there is none */
+uint32_t heapBlockSize(Heap* heap, Address address);
+
+/* bytes in free pages and in the largest run of them */
+uint64_t heapFreeBytes(Heap* heap);
+uint64_t heapLargestFreeBytes(Heap* heap);
+
+#endif
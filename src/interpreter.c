@@ -0,0 +1,840 @@
+/*
+ * The interpreter loop.  This is a template that vm.c includes once per kind of RAM 
+ * access, it expects:
+ *
+ *   VM_INTERPRET           the name of the function
+ *   VM_INTERPRET_HANDLERS  the variable the handler addresses are published in
+ *   VM_CHECKED_RAM         whether the RAM accesses are range checked, the unchecked
+ *                          accesses rely on the guard pages of ramInitGuarded and
+ *                          the stores only check the read only constants
+ */
+#if VM_CHECKED_RAM
+    #define RAM_READ_INT32(address)        ramUncheckedReadInt32(mem, VM_RAM_CHECK((address), 4))
+    #define RAM_READ_INT8(address)         ramUncheckedReadInt8(mem, VM_RAM_CHECK((address), 1))
+    #define RAM_READ_FLOAT(address)        ramUncheckedReadFloat(mem, VM_RAM_CHECK((address), 4))
+    #define RAM_STORE_CHECK                VM_RAM_CHECK_STORE
+#else
+    #define RAM_READ_INT32(address)        ramUncheckedReadInt32(mem, (address))
+    #define RAM_READ_INT8(address)         ramUncheckedReadInt8(mem, (address))
+    #define RAM_READ_FLOAT(address)        ramUncheckedReadFloat(mem, (address))
+    #define RAM_STORE_CHECK                VM_RAM_CHECK_WRITABLE
+#endif
+
+/* the value is loaded before the address is checked, both may write the registers back */
+#define RAM_STORE(type, store, address, value)                     \
+    do {                                                           \
+        type storeValue = (value);                                 \
+        store(mem, RAM_STORE_CHECK((address), sizeof(type)), storeValue); \
+    } while(0)
+
+#define RAM_STORE_INT32(address,value) RAM_STORE(int32_t, ramUncheckedStoreInt32, (address), (value))
+#define RAM_STORE_INT8(address,value)  RAM_STORE(int8_t, ramUncheckedStoreInt8, (address), (value))
+#define RAM_STORE_FLOAT(address,value) RAM_STORE(float, ramUncheckedStoreFloat, (address), (value))
+
+/* the stack accesses, VM_STACK_CHECK has checked them against the stack bounds */
+#define STACK_READ_INT(address)          ramUncheckedReadInt32(ram->mem, (address))
+#define STACK_READ_INT8(address)         ramUncheckedReadInt8(ram->mem, (address))
+#define STACK_READ_FLOAT(address)        ramUncheckedReadFloat(ram->mem, (address))
+#define STACK_STORE_INT(address,value)   ramUncheckedStoreInt32(ram->mem, (address), (value))
+#define STACK_STORE_INT8(address,value)  ramUncheckedStoreInt8(ram->mem, (address), (value))
+#define STACK_STORE_FLOAT(address,value) ramUncheckedStoreFloat(ram->mem, (address), (value))
+
+#if LITA_THREADED_DISPATCH
+    // computed goto's are a GNU extension, which -pedantic-errors would otherwise reject
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wpedantic"
+    #ifdef __clang__
+        #pragma clang diagnostic ignored "-Wgnu-label-as-value"
+    #endif
+#endif
+
+/*
+ * Runs the decoded instruction stream starting at rec.  When invoked without a Vm,
+ * this only publishes the handler addresses (for the threaded dispatch engine) so 
+ * that vmDecode can store them in the decoded records.
+ */
+static void VM_INTERPRET(Vm* vm, Bytecode* code, DecodedInstr* rec) {
+#if LITA_THREADED_DISPATCH
+    static const void* dispatchTable[MAX_VM_OPCODES] = {
+        [NOOP] = &&op_NOOP,
+        [POPI] = &&op_POPI,
+        [POPF] = &&op_POPF,
+        [POPB] = &&op_POPB,
+        [DUPI] = &&op_DUPI,
+        [DUPF] = &&op_DUPF,
+        [DUPB] = &&op_DUPB,
+        [JMP] = &&op_JMP,
+        [PRINTI] = &&op_PRINTI,
+        [PRINTF] = &&op_PRINTF,
+        [PRINTB] = &&op_PRINTB,
+        [PRINTC] = &&op_PRINTC,
+        [CALL] = &&op_CALL,
+        [RET] = &&op_RET,
+        [ALLOC] = &&op_ALLOC,
+        [FREE] = &&op_FREE,
+        [REALLOC] = &&op_REALLOC,
+        [SYSCALL] = &&op_SYSCALL,
+        [MEMCPY] = &&op_MEMCPY,
+        [MEMSET] = &&op_MEMSET,
+        [MEMCMP] = &&op_MEMCMP,
+        [STRLEN] = &&op_STRLEN,
+        [STRCMP] = &&op_STRCMP,
+        [STRCHR] = &&op_STRCHR,
+        [PRINTS] = &&op_PRINTS,
+        [FLUSH] = &&op_FLUSH,
+        [VFMAI] = &&op_VFMAI,
+        [VFMAF] = &&op_VFMAF,
+        [VSUMI] = &&op_VSUMI,
+        [VSUMF] = &&op_VSUMF,
+
+#define VM_VECTOR_LABEL(op, kernel, kernelOp) [op] = &&op_##op,
+        VM_VECTOR_OPS(VM_VECTOR_LABEL)
+        [OP_HALT] = &&op_OP_HALT,
+        [OP_RET_UNCHECKED] = &&op_OP_RET_UNCHECKED,
+        [OP_SYNC_PC] = &&op_OP_SYNC_PC,
+        [OP_TRACE] = &&op_OP_TRACE,
+
+#define VM_VARIANT_LABEL(kind, op, type, sym, m1, m2) [op##_##m1##m2] = &&op_##op##_##m1##m2,
+#define VM_VARIANT_LABELS(kind, op, type, sym) VM_VARIANTS(VM_VARIANT_LABEL, kind, op, type, sym)
+        VM_SPECIALIZED_OPS(VM_VARIANT_LABELS)
+
+#define VM_COMPARE_JMP_LABEL(kind, op, type, sym, m1, m2) [op##_##m1##m2##_JMP] = &&op_##op##_##m1##m2##_JMP,
+#define VM_COMPARE_JMP_LABELS(kind, op, type, sym) VM_VARIANTS(VM_COMPARE_JMP_LABEL, kind, op, type, sym)
+        VM_COMPARE_OPS(VM_COMPARE_JMP_LABELS)
+
+        [ADDI_RI_JMP] = &&op_ADDI_RI_JMP,
+        [ADDI_RR_JMP] = &&op_ADDI_RR_JMP,
+        [SUBI_RI_JMP] = &&op_SUBI_RI_JMP,
+        [SUBI_RR_JMP] = &&op_SUBI_RR_JMP,
+        [MOVI_RI_ADDI_RR] = &&op_MOVI_RI_ADDI_RR,
+        [MOVI_RI_ADDI_RR_ADDI_RR] = &&op_MOVI_RI_ADDI_RR_ADDI_RR,
+#undef VM_VECTOR_LABEL
+#undef VM_VARIANT_LABEL
+#undef VM_VARIANT_LABELS
+#undef VM_COMPARE_JMP_LABEL
+#undef VM_COMPARE_JMP_LABELS
+    };
+
+    if(!vm) {
+        VM_INTERPRET_HANDLERS = dispatchTable;
+        return;
+    }
+#endif
+
+    Cpu32* cpu = vm->cpu;
+    Ram* ram = vm->ram;
+    char* mem = ram->mem;
+    DecodedInstr* base = code->decoded;
+    VmLoops* loops = vm->loops;
+
+    // the guest registers live in this local copy while running, which the compiler 
+    // knows RAM stores can't alias, and are only written back to the Cpu32 when they 
+    // can be observed
+    Register regs[MAX_REGISTERS];
+    memcpy(regs, cpu->regs, sizeof(regs));
+
+#if !VM_CHECKED_RAM
+    // an access out of the guarded RAM faults wherever it is, the fault handler writes the
+    // registers back from here, see vmSyncInterpreter
+    VmInterpreterState state = { cpu, regs, &rec };
+    VmInterpreterState* runningInterpreter = vmRunningInterpreter;
+    vmRunningInterpreter = &state;
+    #define VM_PUBLISH_REGS(r) (state.regs = (r))
+#else
+    #define VM_PUBLISH_REGS(r) ((void)0)
+#endif
+
+/* an expression, so the range checks of the RAM accesses can write the registers back */
+#define VM_SYNC_CPU()                                              \
+    (memcpy(cpu->regs, regs, sizeof(regs)),                        \
+     (void)(cpu->pc.as.address = rec->pc))
+
+/* 
+ * The addresses of the RAM accesses, which write the registers back to the Cpu32 before
+ * they fail, see CHECK_RANGE and CHECK_STORE_RANGE.  Guarded RAM only needs the check of
+ * the read only constants below ram->readOnly, its guard pages fault for the rest.
+ */
+#define VM_RAM_CHECK(address, len)                                 \
+    ((uint64_t)(address) + (len) >= ram->size                      \
+        ? (VM_SYNC_CPU(), ramRangeError(ram, (address), (len)))    \
+        : (address))
+
+#define VM_RAM_CHECK_STORE(address, len)                           \
+    ((uint64_t)(Address)((address) - ram->readOnly) + (len) >= ram->size - ram->readOnly \
+        ? (VM_SYNC_CPU(), ramStoreError(ram, (address), (len)), (address)) \
+        : (address))
+
+#define VM_RAM_CHECK_WRITABLE(address, len)                        \
+    ((address) < ram->readOnly                                     \
+        ? (VM_SYNC_CPU(), ramStoreError(ram, (address), (len)), (address)) \
+        : (address))
+
+/* 
+ * Errors unless the 'size' bytes at the address are on the stack, a single unsigned 
+ * compare that also catches the addresses below the limit wrapping around
+ */
+#define VM_STACK_CHECK(address, size, overflow)                    \
+    do {                                                           \
+        if((uint64_t)(Address)((address) - vm->stackLimit) + (size) > vm->stackSpan) { \
+            VM_SYNC_CPU();                                         \
+            vmStackError(vm, (overflow));                          \
+        }                                                          \
+    } while(0)
+
+/* lowers the high-water mark of the stack */
+#define VM_STACK_PEAK(sp)                                          \
+    do {                                                           \
+        if((sp) < vm->stackPeak) vm->stackPeak = (sp);             \
+    } while(0)
+
+#define VM_ERROR(...)                                              \
+    do {                                                           \
+        VM_SYNC_CPU();                                             \
+        vmError(__VA_ARGS__);                                      \
+    } while(0)
+
+#define SET_ARG1_INT(rec,value)                                                   \
+    do {                                                                          \
+        if (IS_DECODED_ARG1_ADDR(rec))                                            \
+            RAM_STORE_INT32(regs[(rec)->arg1].as.address,(value));        \
+        else regs[(rec)->arg1].as.iVal = (value);                            \
+    } while(0)
+
+#define SET_ARG1_FLOAT(rec,value)                                                 \
+    do {                                                                          \
+        if (IS_DECODED_ARG1_ADDR(rec))                                            \
+            RAM_STORE_FLOAT(regs[(rec)->arg1].as.address,(value));        \
+        else regs[(rec)->arg1].as.fVal = (value);                            \
+    } while(0)
+
+#define SET_ARG1_INT8(rec,value)                                                  \
+    do {                                                                          \
+        if (IS_DECODED_ARG1_ADDR(rec))                                            \
+            RAM_STORE_INT8(regs[(rec)->arg1].as.address,(value));         \
+        else regs[(rec)->arg1].as.bVal = (value);                            \
+    } while(0)
+
+#define GET_ARG1_INT(rec)                                                         \
+    (IS_DECODED_ARG1_ADDR(rec)                                                    \
+        ? RAM_READ_INT32(regs[(rec)->arg1].as.address)                            \
+        : regs[(rec)->arg1].as.iVal)
+
+#define GET_ARG2(type, rec)                                        \
+    (DECODED_ARG2_MODE(rec) == DECODED_ARG2_REG ? LOAD2_##type##_R(rec) :  \
+     DECODED_ARG2_MODE(rec) == DECODED_ARG2_ADDR ? LOAD2_##type##_M(rec) : \
+     DECODED_ARG2_MODE(rec) == DECODED_ARG2_IMM ? LOAD2_##type##_I(rec) :  \
+     LOAD2_##type##_K(rec))
+
+#define GET_ARG2_INT(rec)   GET_ARG2(INT, rec)
+#define GET_ARG2_FLOAT(rec) GET_ARG2(FLOAT, rec)
+#define GET_ARG2_INT8(rec)  GET_ARG2(INT8, rec)
+
+/* 
+ * Operand accessors of the specialized handlers, by value type and operand mode 
+ */
+#define VM_TYPE_INT   int32_t
+#define VM_TYPE_INT8  int8_t
+#define VM_TYPE_FLOAT float
+
+#define VM_SIZE_INT   ADDRESS_SIZE
+#define VM_SIZE_INT8  1
+#define VM_SIZE_FLOAT ADDRESS_SIZE
+
+#define LOAD1_INT_R(rec)           (regs[(rec)->arg1].as.iVal)
+#define LOAD1_INT_M(rec)           RAM_READ_INT32(regs[(rec)->arg1].as.address)
+#define STORE1_INT_R(rec,value)    (regs[(rec)->arg1].as.iVal = (value))
+#define STORE1_INT_M(rec,value)    RAM_STORE_INT32(regs[(rec)->arg1].as.address, (value))
+#define LOAD2_INT_R(rec)           (regs[(rec)->arg2.reg].as.iVal)
+#define LOAD2_INT_M(rec)           RAM_READ_INT32(regs[(rec)->arg2.reg].as.address)
+#define LOAD2_INT_I(rec)           ((rec)->arg2.iVal)
+#define LOAD2_INT_K(rec)           RAM_READ_INT32((rec)->arg2.address)
+
+#define LOAD1_INT8_R(rec)          (regs[(rec)->arg1].as.bVal)
+#define LOAD1_INT8_M(rec)          RAM_READ_INT8(regs[(rec)->arg1].as.address)
+#define STORE1_INT8_R(rec,value)   (regs[(rec)->arg1].as.bVal = (value))
+#define STORE1_INT8_M(rec,value)   RAM_STORE_INT8(regs[(rec)->arg1].as.address, (value))
+#define LOAD2_INT8_R(rec)          (regs[(rec)->arg2.reg].as.bVal)
+#define LOAD2_INT8_M(rec)          RAM_READ_INT8(regs[(rec)->arg2.reg].as.address)
+#define LOAD2_INT8_I(rec)          ((int8_t)(rec)->arg2.iVal)
+#define LOAD2_INT8_K(rec)          RAM_READ_INT8((rec)->arg2.address)
+
+#define LOAD1_FLOAT_R(rec)         (regs[(rec)->arg1].as.fVal)
+#define LOAD1_FLOAT_M(rec)         RAM_READ_FLOAT(regs[(rec)->arg1].as.address)
+#define STORE1_FLOAT_R(rec,value)  (regs[(rec)->arg1].as.fVal = (value))
+#define STORE1_FLOAT_M(rec,value)  RAM_STORE_FLOAT(regs[(rec)->arg1].as.address, (value))
+#define LOAD2_FLOAT_R(rec)         (regs[(rec)->arg2.reg].as.fVal)
+#define LOAD2_FLOAT_M(rec)         RAM_READ_FLOAT(regs[(rec)->arg2.reg].as.address)
+#define LOAD2_FLOAT_I(rec)         ((rec)->arg2.fVal)
+#define LOAD2_FLOAT_K(rec)         RAM_READ_FLOAT((rec)->arg2.address)
+
+/*
+ * Handler bodies of the specialized variants, see VM_SPECIALIZED_OPS
+ */
+#define VM_HANDLER(kind, op, type, sym, m1, m2) VM_HANDLER_##kind(op##_##m1##m2, type, sym, m1, m2)
+
+#define VM_HANDLER_MOVE(variant, type, sym, m1, m2)                \
+    VM_CASE(variant): {                                            \
+        STORE1_##type##_##m1(rec, LOAD2_##type##_##m2(rec));       \
+        VM_NEXT(0);                                                \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_HANDLER_PUSH(variant, type, sym, m1, m2)                \
+    VM_CASE(variant): {                                            \
+        VM_TYPE_##type value = LOAD2_##type##_##m2(rec);           \
+        Address sp = regs[REG_SP].as.address - VM_SIZE_##type;     \
+        VM_STACK_CHECK(sp, VM_SIZE_##type, 1);                     \
+                                                                   \
+        regs[REG_SP].as.address = sp;                              \
+        VM_STACK_PEAK(sp);                                         \
+        STACK_STORE_##type(sp, value);                             \
+        VM_NEXT(0);                                                \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_HANDLER_COMPARE(variant, type, sym, m1, m2)             \
+    VM_CASE(variant): {                                            \
+        VM_TYPE_##type yValue = LOAD2_##type##_##m2(rec);          \
+        VM_TYPE_##type xValue = LOAD1_##type##_##m1(rec);          \
+                                                                   \
+        VM_NEXT(xValue sym yValue);                                \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_HANDLER_BINARY(variant, type, sym, m1, m2)              \
+    VM_CASE(variant): {                                            \
+        VM_TYPE_##type aValue = LOAD1_##type##_##m1(rec);          \
+        VM_TYPE_##type bValue = LOAD2_##type##_##m2(rec);          \
+        VM_TYPE_##type result = aValue sym bValue;                 \
+        STORE1_##type##_##m1(rec, result);                         \
+        VM_NEXT(0);                                                \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_HANDLER_DIVIDE(variant, type, sym, m1, m2)              \
+    VM_CASE(variant): {                                            \
+        VM_TYPE_##type bValue = LOAD2_##type##_##m2(rec);          \
+        if(bValue == 0) VM_ERROR("DivideByZeroError\n");              \
+                                                                   \
+        VM_TYPE_##type aValue = LOAD1_##type##_##m1(rec);          \
+        VM_TYPE_##type result = aValue sym bValue;                 \
+        STORE1_##type##_##m1(rec, result);                         \
+        VM_NEXT(0);                                                \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_HANDLER_FMOD(variant, type, sym, m1, m2)                \
+    VM_CASE(variant): {                                            \
+        float bValue = LOAD2_FLOAT_##m2(rec);                      \
+        if(bValue == 0) VM_ERROR("DivideByZeroError\n");              \
+                                                                   \
+        float aValue = LOAD1_FLOAT_##m1(rec);                      \
+        float result = (int)aValue sym (int)bValue;                \
+        STORE1_FLOAT_##m1(rec, result);                            \
+        VM_NEXT(0);                                                \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_HANDLER_UNARY(variant, type, sym, m1, m2)               \
+    VM_CASE(variant): {                                            \
+        VM_TYPE_##type value = sym LOAD2_##type##_##m2(rec);       \
+        STORE1_##type##_##m1(rec, value);                          \
+        VM_NEXT(0);                                                \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_SPECIALIZED_HANDLERS(kind, op, type, sym) VM_VARIANTS(VM_HANDLER, kind, op, type, sym)
+
+/*
+ * Jumps to a record.  A backward jump is an iteration of the loop at its target, which is
+ * counted and once hot, recorded or run as a native trace, see vmHotLoop.
+ */
+#define VM_JUMP(from, to)                                          \
+    do {                                                           \
+        DecodedInstr* target = (to);                               \
+        if(loops && target <= (from) &&                            \
+            ++loops->hotCounts[target->pc] >= VM_HOT_LOOP_THRESHOLD) { \
+            VM_SYNC_CPU();                                         \
+            VM_PUBLISH_REGS(NULL);                                 \
+            target = vmHotLoop(code, loops, target);               \
+            VM_PUBLISH_REGS(regs);                                 \
+            memcpy(regs, cpu->regs, sizeof(regs));                 \
+        }                                                          \
+        rec = target;                                              \
+    } while(0)
+
+/*
+ * Superinstruction handlers, see vmFuse.  'fusedCount' tracks the instructions that
+ * were executed without a dispatch of their own.
+ */
+#define VM_HANDLER_COMPARE_JMP(kind, op, type, sym, m1, m2)        \
+    VM_CASE(op##_##m1##m2##_JMP): {                                \
+        VM_TYPE_##type yValue = LOAD2_##type##_##m2(rec);          \
+        VM_TYPE_##type xValue = LOAD1_##type##_##m1(rec);          \
+                                                                   \
+        if(xValue sym yValue) {                                    \
+            VM_NEXT(1);                                            \
+        }                                                          \
+        else {                                                     \
+            VM_JUMP(rec, rec[1].arg2.target);                      \
+            fusedCount++;                                          \
+        }                                                          \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_COMPARE_JMP_HANDLERS(kind, op, type, sym) VM_VARIANTS(VM_HANDLER_COMPARE_JMP, kind, op, type, sym)
+
+#define VM_HANDLER_INT_JMP(variant, sym, m2)                       \
+    VM_CASE(variant##_JMP): {                                      \
+        LOAD1_INT_R(rec) sym LOAD2_INT_##m2(rec);                  \
+        VM_JUMP(rec, rec[1].arg2.target);                          \
+        fusedCount++;                                              \
+        VM_DISPATCH();                                             \
+    }
+
+#define VM_HANDLER_VECTOR(op, kernel, kernelOp)                    \
+    VM_CASE(op): {                                                 \
+        Address len = regs[rec->arg2.ext.reg3].as.address;         \
+        VM_SYNC_CPU();                                             \
+        kernel(kernelOp,                                           \
+            ramWritableArray(ram, regs[rec->arg1].as.address, len), \
+            ramArray(ram, regs[rec->arg2.ext.reg2].as.address, len), len); \
+        VM_NEXT(0);                                                \
+        VM_DISPATCH();                                             \
+    }
+
+#if LITA_THREADED_DISPATCH
+#define VM_CASE(op) case op: op_##op
+#define VM_DEFAULT  default
+#define VM_DISPATCH()                                              \
+    do {                                                           \
+        VM_FETCH();                                                \
+        goto *rec->handler;                                        \
+    } while(0)
+#else
+#define VM_CASE(op) case op
+#define VM_DEFAULT  default
+#define VM_DISPATCH() continue
+#endif
+
+#define VM_FETCH()                                                 \
+    do {                                                           \
+        dispatchCount++;                                           \
+    } while(0)
+
+/* moves to the next record, skipping 'n' records */
+#define VM_NEXT(n) (rec += 1 + (n))
+
+    uint64_t dispatchCount = 0;
+    uint64_t fusedCount = 0;
+    uint16_t opcode = 0;
+            
+    for(;;) {
+        VM_FETCH();
+        opcode = rec->opcode;
+        
+        //printf("Opcode: '%5s' Arg1: %5d PC: %5d  \n", 
+        //    OpcodeStr[rec->opcode], rec->arg1, rec->pc);
+
+vmSwitch:
+        switch(opcode) {
+            VM_CASE(NOOP): {
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(JMP): {
+                VM_JUMP(rec, rec->arg2.target);
+                VM_DISPATCH();
+            }
+            VM_CASE(CALL): {
+                regs[REG_R].as.address = rec->pc + 1;
+                rec = rec->arg2.target;
+                VM_DISPATCH();
+            }
+            VM_CASE(RET): {
+                // $r is a guest visible register, so the return index is only known at runtime
+                Address index = regs[REG_R].as.address;
+                rec = base + MIN(index, code->length);
+                VM_DISPATCH();
+            }
+            VM_CASE(OP_RET_UNCHECKED): {
+                rec = base + regs[REG_R].as.address;
+                VM_DISPATCH();
+            }
+            VM_CASE(POPI): {
+                Address sp = regs[REG_SP].as.address;
+                VM_STACK_CHECK(sp, ADDRESS_SIZE, 0);
+
+                int32_t value = STACK_READ_INT(sp);
+                regs[REG_SP].as.address = sp + ADDRESS_SIZE;
+                
+                SET_ARG1_INT(rec, value);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(POPF): {
+                Address sp = regs[REG_SP].as.address;
+                VM_STACK_CHECK(sp, ADDRESS_SIZE, 0);
+
+                float value = STACK_READ_FLOAT(sp);
+                regs[REG_SP].as.address = sp + ADDRESS_SIZE;
+
+                SET_ARG1_FLOAT(rec, value);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(POPB): {
+                Address sp = regs[REG_SP].as.address;
+                VM_STACK_CHECK(sp, 1, 0);
+
+                int8_t value = STACK_READ_INT8(sp);
+                regs[REG_SP].as.address = sp + 1;
+
+                SET_ARG1_INT8(rec, value);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(DUPI): {
+                Address sp = regs[REG_SP].as.address;
+                VM_STACK_CHECK(sp, ADDRESS_SIZE, 0);
+                VM_STACK_CHECK(sp - ADDRESS_SIZE, ADDRESS_SIZE, 1);
+
+                int32_t value = STACK_READ_INT(sp);
+                sp -= ADDRESS_SIZE;
+                regs[REG_SP].as.address = sp;
+                VM_STACK_PEAK(sp);
+                STACK_STORE_INT(sp, value);
+                
+                SET_ARG1_INT(rec, value);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(DUPF): {
+                Address sp = regs[REG_SP].as.address;
+                VM_STACK_CHECK(sp, ADDRESS_SIZE, 0);
+                VM_STACK_CHECK(sp - ADDRESS_SIZE, ADDRESS_SIZE, 1);
+
+                float value = STACK_READ_FLOAT(sp);
+                sp -= ADDRESS_SIZE;
+                regs[REG_SP].as.address = sp;
+                VM_STACK_PEAK(sp);
+                STACK_STORE_FLOAT(sp, value);
+                
+                SET_ARG1_FLOAT(rec, value);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(DUPB): {
+                Address sp = regs[REG_SP].as.address;
+                VM_STACK_CHECK(sp, 1, 0);
+                VM_STACK_CHECK(sp - 1, 1, 1);
+
+                int8_t value = STACK_READ_INT8(sp);
+                sp -= 1;
+                regs[REG_SP].as.address = sp;
+                VM_STACK_PEAK(sp);
+                STACK_STORE_INT8(sp, value);
+                
+                SET_ARG1_INT8(rec, value);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(PRINTI): {
+                outputInt(vm->output, GET_ARG2_INT(rec));
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(PRINTF): {
+                outputFloat(vm->output, GET_ARG2_FLOAT(rec));
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(PRINTB): {
+                outputInt(vm->output, GET_ARG2_INT8(rec));
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(PRINTC): {
+                outputChar(vm->output, (char)GET_ARG2_INT8(rec));
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(ALLOC): {
+                Heap* heap = vmHeap(vm, regs[REG_H].as.address);
+                SET_ARG1_INT(rec, (int32_t)heapAlloc(heap, (uint32_t)GET_ARG2_INT(rec)));
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(FREE): {
+                Address address = (Address)GET_ARG2_INT(rec);
+                if(!vmHeapFree(vm, address)) {
+                    VM_ERROR("Invalid heap address '0x%x' passed to FREE\n", address);
+                }
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(REALLOC): {
+                Address address = (Address)GET_ARG1_INT(rec);
+                if(!vmHeapRealloc(vm, regs[REG_H].as.address, &address, (uint32_t)GET_ARG2_INT(rec))) {
+                    VM_ERROR("Invalid heap address '0x%x' passed to REALLOC\n", address);
+                }
+                SET_ARG1_INT(rec, (int32_t)address);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(SYSCALL): {
+                // the host function works on the Cpu32, the local registers stay private
+                uint32_t number = (uint32_t)GET_ARG2_INT(rec);
+                VM_SYNC_CPU();
+                VM_PUBLISH_REGS(NULL);
+                vmSyscall(vm, cpu->regs, number);
+                VM_PUBLISH_REGS(regs);
+                // register by register, a block copy would stall on the host function's stores
+                for(int i = 0; i < MAX_REGISTERS; i++) {
+                    regs[i] = cpu->regs[i];
+                }
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+
+            VM_CASE(MEMCPY): {
+                // the RAM helpers fail through vmError, which reports the Cpu32
+                VM_SYNC_CPU();
+                ramCopy(ram, regs[rec->arg1].as.address, regs[rec->arg2.ext.reg2].as.address,
+                    regs[rec->arg2.ext.reg3].as.address);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(MEMSET): {
+                VM_SYNC_CPU();
+                ramFill(ram, regs[rec->arg1].as.address, regs[rec->arg2.ext.reg2].as.bVal,
+                    regs[rec->arg2.ext.reg3].as.address);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(MEMCMP): {
+                VM_SYNC_CPU();
+                regs[rec->arg1].as.iVal = ramCompare(ram, regs[rec->arg1].as.address, 
+                    regs[rec->arg2.ext.reg2].as.address, regs[rec->arg2.ext.reg3].as.address);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+
+            VM_CASE(STRLEN): {
+                VM_SYNC_CPU();
+                regs[rec->arg1].as.address = ramStringLength(ram, regs[rec->arg2.ext.reg2].as.address);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(STRCMP): {
+                VM_SYNC_CPU();
+                regs[rec->arg1].as.iVal = ramStringCompare(ram, regs[rec->arg1].as.address, 
+                    regs[rec->arg2.ext.reg2].as.address);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(STRCHR): {
+                VM_SYNC_CPU();
+                regs[rec->arg1].as.address = ramStringFind(ram, regs[rec->arg2.ext.reg2].as.address, 
+                    regs[rec->arg2.ext.reg3].as.bVal);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(PRINTS): {
+                Address address = regs[rec->arg1].as.address;
+                VM_SYNC_CPU();
+                outputWrite(vm->output, ram->mem + address, ramStringLength(ram, address));
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(FLUSH): {
+                outputFlush(vm->output);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+
+            VM_VECTOR_OPS(VM_HANDLER_VECTOR)
+
+            VM_CASE(VFMAI): {
+                VM_SYNC_CPU();
+                Address len = regs[rec->arg2.ext.reg4].as.address;
+                kernelMulAddInt32(ramWritableArray(ram, regs[rec->arg1].as.address, len),
+                    ramArray(ram, regs[rec->arg2.ext.reg2].as.address, len), regs[rec->arg2.ext.reg3].as.iVal, len);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(VFMAF): {
+                VM_SYNC_CPU();
+                Address len = regs[rec->arg2.ext.reg4].as.address;
+                kernelMulAddFloat(ramWritableArray(ram, regs[rec->arg1].as.address, len),
+                    ramArray(ram, regs[rec->arg2.ext.reg2].as.address, len), regs[rec->arg2.ext.reg3].as.fVal, len);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(VSUMI): {
+                VM_SYNC_CPU();
+                Address len = regs[rec->arg2.ext.reg3].as.address;
+                regs[rec->arg1].as.iVal = kernelSumInt32(ramArray(ram, regs[rec->arg2.ext.reg2].as.address, len), len);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+            VM_CASE(VSUMF): {
+                VM_SYNC_CPU();
+                Address len = regs[rec->arg2.ext.reg3].as.address;
+                regs[rec->arg1].as.fVal = kernelSumFloat(ramArray(ram, regs[rec->arg2.ext.reg2].as.address, len), len);
+                VM_NEXT(0);
+                VM_DISPATCH();
+            }
+
+            /* ===================================================
+            * Operand mode specialized handlers
+            * ===================================================
+            */
+            VM_SPECIALIZED_OPS(VM_SPECIALIZED_HANDLERS)
+
+            /* ===================================================
+            * Superinstructions
+            * ===================================================
+            */
+            VM_COMPARE_OPS(VM_COMPARE_JMP_HANDLERS)
+
+            VM_HANDLER_INT_JMP(ADDI_RI, +=, I)
+            VM_HANDLER_INT_JMP(ADDI_RR, +=, R)
+            VM_HANDLER_INT_JMP(SUBI_RI, -=, I)
+            VM_HANDLER_INT_JMP(SUBI_RR, -=, R)
+
+            VM_CASE(MOVI_RI_ADDI_RR): {
+                LOAD1_INT_R(rec) = LOAD2_INT_I(rec);
+                LOAD1_INT_R(rec) += LOAD2_INT_R(&rec[1]);
+                fusedCount++;
+                VM_NEXT(1);
+                VM_DISPATCH();
+            }
+            VM_CASE(MOVI_RI_ADDI_RR_ADDI_RR): {
+                LOAD1_INT_R(rec) = LOAD2_INT_I(rec);
+                LOAD1_INT_R(rec) += LOAD2_INT_R(&rec[1]);
+                LOAD1_INT_R(rec) += LOAD2_INT_R(&rec[2]);
+                fusedCount += 2;
+                VM_NEXT(2);
+                VM_DISPATCH();
+            }
+
+            VM_CASE(OP_HALT): {
+                dispatchCount--; // not a guest instruction
+                goto vmExit;
+            }
+            VM_CASE(OP_SYNC_PC): {
+                regs[REG_PC].as.address = rec->pc;
+                opcode = decodeHandler(OPCODE(code->instrs[rec->pc]), rec);
+                goto vmSwitch;
+            }
+            VM_CASE(OP_TRACE): {
+                opcode = vmTraceRecord(vm, code, loops, rec);
+                goto vmSwitch;
+            }
+            VM_DEFAULT: {
+                // verify rejects unknown opcodes, so the switch needs no range check
+                VM_UNREACHABLE();
+            }
+        }
+    }
+
+vmExit:
+    if(loops && loops->recording) {
+        vmStopRecording(code, loops);
+    }
+    VM_SYNC_CPU();
+#if !VM_CHECKED_RAM
+    vmRunningInterpreter = runningInterpreter;
+#endif
+    vm->dispatchCount += dispatchCount;
+    vm->instructionCount += dispatchCount + fusedCount;
+
+#undef SET_ARG1_INT
+#undef SET_ARG1_FLOAT
+#undef SET_ARG1_INT8
+#undef GET_ARG1_INT
+#undef GET_ARG2_INT
+#undef GET_ARG2_FLOAT
+#undef GET_ARG2_INT8
+#undef GET_ARG2
+#undef VM_TYPE_INT
+#undef VM_TYPE_INT8
+#undef VM_TYPE_FLOAT
+#undef VM_SIZE_INT
+#undef VM_SIZE_INT8
+#undef VM_SIZE_FLOAT
+#undef LOAD1_INT_R
+#undef LOAD1_INT_M
+#undef STORE1_INT_R
+#undef STORE1_INT_M
+#undef LOAD2_INT_R
+#undef LOAD2_INT_M
+#undef LOAD2_INT_I
+#undef LOAD2_INT_K
+#undef LOAD1_INT8_R
+#undef LOAD1_INT8_M
+#undef STORE1_INT8_R
+#undef STORE1_INT8_M
+#undef LOAD2_INT8_R
+#undef LOAD2_INT8_M
+#undef LOAD2_INT8_I
+#undef LOAD2_INT8_K
+#undef LOAD1_FLOAT_R
+#undef LOAD1_FLOAT_M
+#undef STORE1_FLOAT_R
+#undef STORE1_FLOAT_M
+#undef LOAD2_FLOAT_R
+#undef LOAD2_FLOAT_M
+#undef LOAD2_FLOAT_I
+#undef LOAD2_FLOAT_K
+#undef VM_HANDLER
+#undef VM_HANDLER_MOVE
+#undef VM_HANDLER_PUSH
+#undef VM_HANDLER_COMPARE
+#undef VM_HANDLER_BINARY
+#undef VM_HANDLER_DIVIDE
+#undef VM_HANDLER_FMOD
+#undef VM_HANDLER_UNARY
+#undef VM_SPECIALIZED_HANDLERS
+#undef VM_HANDLER_COMPARE_JMP
+#undef VM_COMPARE_JMP_HANDLERS
+#undef VM_HANDLER_INT_JMP
+#undef VM_HANDLER_VECTOR
+#undef VM_JUMP
+#undef VM_SYNC_CPU
+#undef VM_PUBLISH_REGS
+#undef VM_RAM_CHECK
+#undef VM_RAM_CHECK_STORE
+#undef VM_RAM_CHECK_WRITABLE
+#undef VM_STACK_CHECK
+#undef VM_STACK_PEAK
+#undef VM_ERROR
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_DISPATCH
+#undef VM_FETCH
+#undef VM_NEXT
+}
+
+#if LITA_THREADED_DISPATCH
+    #pragma GCC diagnostic pop
+#endif
+
+#undef RAM_READ_INT32
+#undef RAM_READ_INT8
+#undef RAM_READ_FLOAT
+#undef RAM_STORE_INT32
+#undef RAM_STORE_INT8
+#undef RAM_STORE_FLOAT
+#undef RAM_STORE
+#undef RAM_STORE_CHECK
+#undef STACK_READ_INT
+#undef STACK_READ_INT8
+#undef STACK_READ_FLOAT
+#undef STACK_STORE_INT
+#undef STACK_STORE_INT8
+#undef STACK_STORE_FLOAT
+#undef VM_INTERPRET
+#undef VM_INTERPRET_HANDLERS
+#undef VM_CHECKED_RAM
@@ -0,0 +1,1170 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "jit.h"
+#include "buf.h"
+#include "common.h"
+
+#if LITA_JIT
+
+#include <sys/mman.h>
+
+/*
+ * Register assignment of the generated code.  The guest registers stay in host registers
+ * for the whole run and are only written back to the Cpu32 around calls into C and on
+ * exit.  $pc is never materialized, vmDecode resolves reads of it into immediates and
+ * constants, and instructions that still need it are rejected by jitCompile.
+ *
+ *   rax, rcx, rdx   scratch (address, arg2 value, arg1 value)
+ *   r15             ram->mem
+ *   xmm0, xmm1      float operands
+ */
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8,  R9,  R10, R11, R12, R13, R14, R15
+};
+
+#define JIT_NO_REG  -1
+#define JIT_RAM_REG R15
+
+static const int jitRegisters[MAX_REGISTERS] = {
+    RBX,         // $sp
+    JIT_NO_REG,  // $pc
+    RBP,         // $r
+    R12,         // $h
+    R13,         // $a
+    R14,         // $b
+    RSI,         // $c
+    RDI,         // $d
+    R8,          // $i
+    R9,          // $j
+    R10,         // $k
+    R11,         // $u
+};
+
+/* condition codes of Jcc */
+#define JIT_CC_E  0x4
+#define JIT_CC_BE 0x6
+#define JIT_CC_AE 0x3
+#define JIT_CC_A  0x7
+#define JIT_CC_GE 0xd
+#define JIT_CC_G  0xf
+
+/* the /digit opcode extensions of the group 1 ALU (81 /n), shift (D3 /n) and F7 /n instructions */
+#define JIT_ALU_ADD 0
+#define JIT_ALU_OR  1
+#define JIT_ALU_AND 4
+#define JIT_ALU_SUB 5
+#define JIT_ALU_XOR 6
+#define JIT_ALU_CMP 7
+#define JIT_SHIFT_SHL 4
+#define JIT_SHIFT_SAR 7
+#define JIT_F7_NOT  2
+#define JIT_F7_IDIV 7
+
+/* value types of the operands, they decide the access size and the sign extension */
+typedef enum JitType {
+    JIT_INT,
+    JIT_INT8,
+    JIT_FLOAT,
+} JitType;
+
+typedef struct JitFixup {
+    size_t  offset;  /* of the rel32 to patch */
+    Address label;
+} JitFixup;
+
+/* compilation state */
+typedef struct Jit {
+    Vm*       vm;
+    Bytecode* code;
+
+    uint8_t*  bytes;   /* buf of the generated code */
+    JitFixup* fixups;  /* buf of the jumps to patch once every label is placed */
+    size_t*   labels;  /* buf of the code offset of every label */
+
+    Address   access1Label;  /* access violation of a 1 byte access at rax */
+    Address   access4Label;  /* access violation of a 4 byte access at rax */
+    Address   store1Label;   /* access violation of a 1 byte store at rax, see emitStoreCheck */
+    Address   store4Label;   /* access violation of a 4 byte store at rax */
+    Address   divideLabel;
+    Address   overflowLabel;   /* stack overflow of a PUSH or DUP */
+    Address   underflowLabel;  /* stack underflow of a POP or DUP */
+} Jit;
+
+/* ===================================================
+ * Runtime helpers called from the generated code
+ * ===================================================
+ */
+static void jitAccessViolation(Address startAddress, Address endAddress) {
+    vmError("Access violation error at address '0x%x' to '0x%x' \n", startAddress, endAddress);
+}
+
+static void jitStoreViolation(Ram* ram, Address address, Address size) {
+    ramStoreError(ram, address, size);
+}
+
+static void jitDivideByZero(void) {
+    vmError("DivideByZeroError\n");
+}
+
+static void jitStackOverflow(Vm* vm) {
+    vmStackError(vm, 1);
+}
+
+static void jitStackUnderflow(Vm* vm) {
+    vmStackError(vm, 0);
+}
+
+static void jitPrintInt(Output* output, int32_t value) {
+    outputInt(output, value);
+}
+
+static void jitPrintFloat(Output* output, int32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    outputFloat(output, value);
+}
+
+static void jitPrintChar(Output* output, int32_t value) {
+    outputChar(output, (char)value);
+}
+
+static void jitFlush(Output* output) {
+    outputFlush(output);
+}
+
+static void jitSyscall(Vm* vm, int32_t number, Address pc) {
+    vm->cpu->pc.as.address = pc;
+    vmSyscall(vm, vm->cpu->regs, (uint32_t)number);
+}
+
+/* ===================================================
+ * x86-64 encoding
+ * ===================================================
+ */
+static void emitByte(Jit* jit, uint8_t value) {
+    buf_push(jit->bytes, value);
+}
+
+static void emitInt32(Jit* jit, uint32_t value) {
+    for(int i = 0; i < 4; i++) {
+        emitByte(jit, (uint8_t)(value >> (i * 8)));
+    }
+}
+
+static void emitInt64(Jit* jit, uint64_t value) {
+    emitInt32(jit, (uint32_t)value);
+    emitInt32(jit, (uint32_t)(value >> 32));
+}
+
+/*
+ * REX prefix for the ModRM reg, SIB index and ModRM rm/SIB base registers.  Byte accesses of
+ * spl, bpl, sil and dil need a REX prefix even when none of its bits are set, otherwise the
+ * encoding means ah, ch, dh and bh.
+ */
+static void emitRex(Jit* jit, int w, int reg, int index, int base, int byteRegs) {
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+    if(rex != 0x40 || byteRegs) {
+        emitByte(jit, rex);
+    }
+}
+
+static void emitModRm(Jit* jit, int mod, int reg, int rm) {
+    emitByte(jit, (uint8_t)((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+}
+
+#define IS_REX_BYTE_REG(r) ((r) >= RSP && (r) <= RDI)
+
+/* op r/m32, r32 */
+static void emitRR(Jit* jit, uint8_t op, int dst, int src) {
+    emitRex(jit, 0, src, 0, dst, 0);
+    emitByte(jit, op);
+    emitModRm(jit, 3, src, dst);
+}
+
+static void emitMov(Jit* jit, int dst, int src) {
+    if(dst != src) {
+        emitRR(jit, 0x89, dst, src);
+    }
+}
+
+/* mov r/m8, r8 */
+static void emitMov8(Jit* jit, int dst, int src) {
+    emitRex(jit, 0, src, 0, dst, IS_REX_BYTE_REG(src) || IS_REX_BYTE_REG(dst));
+    emitByte(jit, 0x88);
+    emitModRm(jit, 3, src, dst);
+}
+
+/* movsx r32, r/m8 */
+static void emitMovsx8(Jit* jit, int dst, int src) {
+    emitRex(jit, 0, dst, 0, src, IS_REX_BYTE_REG(src));
+    emitByte(jit, 0x0f);
+    emitByte(jit, 0xbe);
+    emitModRm(jit, 3, dst, src);
+}
+
+static void emitMovImm(Jit* jit, int dst, int32_t value) {
+    emitRex(jit, 0, 0, 0, dst, 0);
+    emitByte(jit, 0xb8 + (dst & 7));
+    emitInt32(jit, (uint32_t)value);
+}
+
+static void emitMovImm64(Jit* jit, int dst, uint64_t value) {
+    emitRex(jit, 1, 0, 0, dst, 0);
+    emitByte(jit, 0xb8 + (dst & 7));
+    emitInt64(jit, value);
+}
+
+static void emitAluImm(Jit* jit, int ext, int dst, int32_t value) {
+    emitRex(jit, 0, 0, 0, dst, 0);
+    emitByte(jit, 0x81);
+    emitModRm(jit, 3, ext, dst);
+    emitInt32(jit, (uint32_t)value);
+}
+
+/* lea r32, [base + disp32] */
+static void emitLea(Jit* jit, int dst, int base, int32_t disp) {
+    emitRex(jit, 0, dst, 0, base, 0);
+    emitByte(jit, 0x8d);
+    if((base & 7) == RSP) {
+        emitModRm(jit, 2, dst, RSP);
+        emitByte(jit, 0x24);  // SIB, no index
+    }
+    else {
+        emitModRm(jit, 2, dst, base);
+    }
+    emitInt32(jit, (uint32_t)disp);
+}
+
+static void emitImul(Jit* jit, int dst, int src) {
+    emitRex(jit, 0, dst, 0, src, 0);
+    emitByte(jit, 0x0f);
+    emitByte(jit, 0xaf);
+    emitModRm(jit, 3, dst, src);
+}
+
+/* F7 /ext r32, i.e. not and idiv */
+static void emitF7(Jit* jit, int ext, int reg) {
+    emitRex(jit, 0, 0, 0, reg, 0);
+    emitByte(jit, 0xf7);
+    emitModRm(jit, 3, ext, reg);
+}
+
+/* shl/sar r32, cl */
+static void emitShift(Jit* jit, int ext, int dst) {
+    emitRex(jit, 0, 0, 0, dst, 0);
+    emitByte(jit, 0xd3);
+    emitModRm(jit, 3, ext, dst);
+}
+
+/* mov/movsx between reg and [r15 + rax] */
+static void emitRamAccess(Jit* jit, const uint8_t* op, int opLength, int reg, int byteRegs) {
+    emitRex(jit, 0, reg, RAX, JIT_RAM_REG, byteRegs);
+    for(int i = 0; i < opLength; i++) {
+        emitByte(jit, op[i]);
+    }
+    emitModRm(jit, 0, reg, 4);                      // SIB follows
+    emitModRm(jit, 0, RAX, JIT_RAM_REG);            // scale 1, index rax, base r15
+}
+
+static void emitRamLoad(Jit* jit, JitType type, int dst) {
+    static const uint8_t load32[] = { 0x8b };
+    static const uint8_t load8[]  = { 0x0f, 0xbe };
+    if(type == JIT_INT8) emitRamAccess(jit, load8, 2, dst, 0);
+    else                 emitRamAccess(jit, load32, 1, dst, 0);
+}
+
+static void emitRamStore(Jit* jit, JitType type, int src) {
+    static const uint8_t store32[] = { 0x89 };
+    static const uint8_t store8[]  = { 0x88 };
+    if(type == JIT_INT8) emitRamAccess(jit, store8, 1, src, IS_REX_BYTE_REG(src));
+    else                 emitRamAccess(jit, store32, 1, src, 0);
+}
+
+/* F3/66 prefixed SSE op between xmm registers and/or general purpose registers */
+static void emitSse(Jit* jit, uint8_t prefix, uint8_t op, int reg, int rm) {
+    if(prefix) {
+        emitByte(jit, prefix);
+    }
+    emitRex(jit, 0, reg, 0, rm, 0);
+    emitByte(jit, 0x0f);
+    emitByte(jit, op);
+    emitModRm(jit, 3, reg, rm);
+}
+
+#define JIT_XMM0 0
+#define JIT_XMM1 1
+
+static void emitMovdToXmm(Jit* jit, int xmm, int reg)   { emitSse(jit, 0x66, 0x6e, xmm, reg); }
+static void emitMovdFromXmm(Jit* jit, int reg, int xmm) { emitSse(jit, 0x66, 0x7e, xmm, reg); }
+
+static Address jitNewLabel(Jit* jit) {
+    buf_push(jit->labels, 0);
+    return (Address)(buf_len(jit->labels) - 1);
+}
+
+static void jitPlaceLabel(Jit* jit, Address label) {
+    jit->labels[label] = buf_len(jit->bytes);
+}
+
+/* jumps to a label, patched by jitMap */
+static void emitJumpRel(Jit* jit, Address label) {
+    JitFixup fixup = { buf_len(jit->bytes), label };
+    buf_push(jit->fixups, fixup);
+    emitInt32(jit, 0);
+}
+
+static void emitJmp(Jit* jit, Address label) {
+    emitByte(jit, 0xe9);
+    emitJumpRel(jit, label);
+}
+
+static void emitJcc(Jit* jit, int cc, Address label) {
+    emitByte(jit, 0x0f);
+    emitByte(jit, 0x80 + cc);
+    emitJumpRel(jit, label);
+}
+
+/* the helpers are called through this type, function pointers can't go through void* in ISO C */
+typedef void (*JitHelper)(void);
+
+static void emitCall(Jit* jit, JitHelper function) {
+    emitMovImm64(jit, RAX, (uint64_t)(uintptr_t)function);
+    emitByte(jit, 0xff);  // call rax
+    emitModRm(jit, 3, 2, RAX);
+}
+
+/* stores (or loads) the guest registers held in host registers to (or from) the Cpu32, using rdx as the base */
+static void emitSyncRegisters(Jit* jit, int store) {
+    emitMovImm64(jit, RDX, (uint64_t)(uintptr_t)jit->vm->cpu->regs);
+    for(int i = 0; i < MAX_REGISTERS; i++) {
+        int reg = jitRegisters[i];
+        if(reg == JIT_NO_REG) {
+            continue;
+        }
+
+        emitRex(jit, 0, reg, 0, RDX, 0);
+        emitByte(jit, store ? 0x89 : 0x8b);
+        emitModRm(jit, 1, reg, RDX);
+        emitByte(jit, (uint8_t)(i * sizeof(Register)));
+    }
+}
+
+/* ===================================================
+ * Operand access, mirrors the LOAD/STORE accessors of vmInterpret
+ * ===================================================
+ */
+
+/* jumps to the access violation stub if [eax, eax + size] is not inside RAM, see CHECK_RANGE */
+static void emitRangeCheck(Jit* jit, JitType type) {
+    size_t size = (type == JIT_INT8) ? 1 : ADDRESS_SIZE;
+    Address label = (type == JIT_INT8) ? jit->access1Label : jit->access4Label;
+
+    size_t ramSize = jit->vm->ram->size;
+    if(ramSize <= size) {
+        emitJmp(jit, label);
+        return;
+    }
+
+    // eax + size >= ramSize  <=>  eax >= ramSize - size
+    uint64_t limit = ramSize - size;
+    if(limit > 0xffffffffull) {
+        return; // any 32 bit address is in range
+    }
+
+    emitByte(jit, 0x3d);  // cmp eax, imm32 (unsigned compare of the zero extended address)
+    emitInt32(jit, (uint32_t)limit);
+    emitJcc(jit, JIT_CC_AE, label);
+}
+
+/* emitRangeCheck of a store, which also fails below the read only constants, clobbers rcx, see CHECK_STORE_RANGE */
+static void emitStoreCheck(Jit* jit, JitType type) {
+    Ram* ram = jit->vm->ram;
+    if(!ram->readOnly) {
+        emitRangeCheck(jit, type);
+        return;
+    }
+
+    size_t size = (type == JIT_INT8) ? 1 : ADDRESS_SIZE;
+    Address label = (type == JIT_INT8) ? jit->store1Label : jit->store4Label;
+    if(ram->size - ram->readOnly <= size) {
+        emitJmp(jit, label);
+        return;
+    }
+
+    // eax - readOnly >= ramSize - readOnly - size, unsigned, where past 4 GiB of RAM only 
+    // the addresses below readOnly, which wrap around, are out of range
+    uint64_t limit = MIN((uint64_t)ram->size - size, 1ull << 32) - ram->readOnly;
+    emitLea(jit, RCX, RAX, -(int32_t)ram->readOnly);
+    emitAluImm(jit, JIT_ALU_CMP, RCX, (int32_t)(uint32_t)limit);
+    emitJcc(jit, JIT_CC_AE, label);
+}
+
+/* 
+ * jumps to the label unless the 'size' bytes at eax are on the stack, clobbers rcx, see 
+ * VM_STACK_CHECK.  The stack is inside RAM, so the access needs no range check after it.
+ */
+static void emitStackCheck(Jit* jit, Address size, Address label) {
+    Vm* vm = jit->vm;
+    Address span = vm->stackSpan;
+    if(span < size) {
+        emitJmp(jit, label);
+        return;
+    }
+
+    // eax - stackLimit > span - size, unsigned
+    emitLea(jit, RCX, RAX, -(int32_t)vm->stackLimit);
+    emitAluImm(jit, JIT_ALU_CMP, RCX, (int32_t)(span - size));
+    emitJcc(jit, JIT_CC_A, label);
+}
+
+/* lowers the high-water mark of the stack to $sp, clobbers rcx */
+static void emitStackPeak(Jit* jit) {
+    int sp = jitRegisters[REG_SP];
+    Address done = jitNewLabel(jit);
+
+    emitMovImm64(jit, RCX, (uint64_t)(uintptr_t)&jit->vm->stackPeak);
+    emitRex(jit, 0, sp, 0, RCX, 0);
+    emitByte(jit, 0x39);  // cmp [rcx], sp
+    emitModRm(jit, 0, sp, RCX);
+    emitJcc(jit, JIT_CC_BE, done);
+    emitRex(jit, 0, sp, 0, RCX, 0);
+    emitByte(jit, 0x89);  // mov [rcx], sp
+    emitModRm(jit, 0, sp, RCX);
+    jitPlaceLabel(jit, done);
+}
+
+static void emitLoadRegister(Jit* jit, JitType type, int dst, int guestReg) {
+    if(type == JIT_INT8) emitMovsx8(jit, dst, jitRegisters[guestReg]);
+    else                 emitMov(jit, dst, jitRegisters[guestReg]);
+}
+
+static void emitLoadAddress(Jit* jit, JitType type, int dst) {
+    emitRangeCheck(jit, type);
+    emitRamLoad(jit, type, dst);
+}
+
+/* loads the second operand of the record into dst, clobbers rax */
+static void emitLoadArg2(Jit* jit, JitType type, int dst, DecodedInstr* rec) {
+    switch(DECODED_ARG2_MODE(rec)) {
+        case DECODED_ARG2_REG: {
+            emitLoadRegister(jit, type, dst, rec->arg2.reg);
+            break;
+        }
+        case DECODED_ARG2_ADDR: {
+            emitMov(jit, RAX, jitRegisters[rec->arg2.reg]);
+            emitLoadAddress(jit, type, dst);
+            break;
+        }
+        case DECODED_ARG2_IMM: {
+            emitMovImm(jit, dst, (type == JIT_INT8) ? (int8_t)rec->arg2.iVal : rec->arg2.iVal);
+            break;
+        }
+        default: {
+            emitMovImm(jit, RAX, (int32_t)rec->arg2.address);
+            emitLoadAddress(jit, type, dst);
+            break;
+        }
+    }
+}
+
+/* loads the first operand of the record into dst, clobbers rax */
+static void emitLoadArg1(Jit* jit, JitType type, int dst, DecodedInstr* rec) {
+    if(IS_DECODED_ARG1_ADDR(rec)) {
+        emitMov(jit, RAX, jitRegisters[rec->arg1]);
+        emitLoadAddress(jit, type, dst);
+    }
+    else {
+        emitLoadRegister(jit, type, dst, rec->arg1);
+    }
+}
+
+/* stores src into the first operand of the record, clobbers rax and rcx */
+static void emitStoreArg1(Jit* jit, JitType type, int src, DecodedInstr* rec) {
+    int reg = jitRegisters[rec->arg1];
+    if(IS_DECODED_ARG1_ADDR(rec)) {
+        emitMov(jit, RAX, reg);
+        emitStoreCheck(jit, type);
+        emitRamStore(jit, type, src);
+    }
+    else if(type == JIT_INT8) {
+        emitMov8(jit, reg, src);
+    }
+    else {
+        emitMov(jit, reg, src);
+    }
+}
+
+/* ===================================================
+ * Instruction templates
+ * ===================================================
+ */
+static JitType jitOpcodeType(Opcode opcode) {
+    switch(opcode) {
+        case MOVF: case LDCF: case PUSHF: case POPF: case DUPF: case IFF: case IFEF:
+        case PRINTF: case ADDF: case SUBF: case MULF: case DIVF: case MODF:
+            return JIT_FLOAT;
+        case MOVB: case LDCB: case PUSHB: case POPB: case DUPB: case IFB: case IFEB:
+        case PRINTB: case PRINTC: case ADDB: case SUBB: case MULB: case DIVB: case MODB:
+        case ORB: case ANDB: case NOTB: case XORB: case SZRLB: case SRLB: case SLLB:
+            return JIT_INT8;
+        default:
+            return JIT_INT;
+    }
+}
+
+/* edx = edx op ecx */
+static void emitIntOp(Jit* jit, Opcode opcode) {
+    switch(opcode) {
+        case ADDI: case ADDB: emitRR(jit, 0x01, RDX, RCX); break;
+        case SUBI: case SUBB: emitRR(jit, 0x29, RDX, RCX); break;
+        case MULI: case MULB: emitImul(jit, RDX, RCX); break;
+        case ORI:  case ORB:  emitRR(jit, 0x09, RDX, RCX); break;
+        case ANDI: case ANDB: emitRR(jit, 0x21, RDX, RCX); break;
+        case XORI: case XORB: emitRR(jit, 0x31, RDX, RCX); break;
+        case SLLI: case SLLB: emitShift(jit, JIT_SHIFT_SHL, RDX); break;
+        // the interpreter shifts signed values, so both right shifts are arithmetic
+        case SZRLI: case SZRLB:
+        case SRLI: case SRLB: emitShift(jit, JIT_SHIFT_SAR, RDX); break;
+        default: break;
+    }
+}
+
+/* xmm0 = xmm0 op xmm1 */
+static void emitFloatOp(Jit* jit, Opcode opcode) {
+    uint8_t op = 0;
+    switch(opcode) {
+        case ADDF: op = 0x58; break;
+        case SUBF: op = 0x5c; break;
+        case MULF: op = 0x59; break;
+        case DIVF: op = 0x5e; break;
+        default: break;
+    }
+    emitSse(jit, 0xf3, op, JIT_XMM0, JIT_XMM1);
+}
+
+/* jumps to the divide by zero stub if the divisor in ecx is zero; for floats either sign of zero */
+static void emitDivisorCheck(Jit* jit, JitType type) {
+    if(type == JIT_FLOAT) {
+        emitAluImm(jit, JIT_ALU_AND, RCX, 0x7fffffff);
+    }
+    else {
+        emitRR(jit, 0x85, RCX, RCX);  // test ecx, ecx
+    }
+    emitJcc(jit, JIT_CC_E, jit->divideLabel);
+}
+
+/* calls the output helper with the Vm's console device and ecx */
+static void emitPrint(Jit* jit, JitHelper function) {
+    emitSyncRegisters(jit, 1);
+    emitMovImm64(jit, RDI, (uint64_t)(uintptr_t)jit->vm->output);
+    emitMov(jit, RSI, RCX);
+    emitCall(jit, function);
+    emitSyncRegisters(jit, 0);
+}
+
+/* sets the flags for an IF instruction, returns the condition code under which it skips */
+static int emitCompare(Jit* jit, Opcode opcode, DecodedInstr* rec) {
+    JitType type = jitOpcodeType(opcode);
+    int orEqual = (opcode == IFEI || opcode == IFEF || opcode == IFEB);
+
+    emitLoadArg2(jit, type, RCX, rec);
+    emitLoadArg1(jit, type, RDX, rec);
+    if(type == JIT_FLOAT) {
+        // comiss is unordered for NaN, which sets CF so neither condition holds
+        emitMovdToXmm(jit, JIT_XMM0, RDX);
+        emitMovdToXmm(jit, JIT_XMM1, RCX);
+        emitSse(jit, 0, 0x2f, JIT_XMM0, JIT_XMM1);
+        return orEqual ? JIT_CC_AE : JIT_CC_A;
+    }
+
+    emitRR(jit, 0x39, RDX, RCX);  // cmp edx, ecx
+    return orEqual ? JIT_CC_GE : JIT_CC_G;
+}
+
+static int isControlOpcode(Opcode opcode) {
+    switch(opcode) {
+        case IFI: case IFF: case IFB:
+        case IFEI: case IFEF: case IFEB:
+        case JMP: case CALL: case RET:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* 
+ * emits the code of an instruction that isn't a control transfer, the callers handle
+ * those (see isControlOpcode).  Returns false if the JIT doesn't support it.
+ */
+static int jitInstruction(Jit* jit, Address i) {
+    Bytecode* code = jit->code;
+    DecodedInstr* rec = &code->decoded[i];
+
+    // the decoded record has the resolved operands, superinstructions only change its handler
+    if(rec->opcode == OP_SYNC_PC) {
+        return 0;
+    }
+
+    Opcode opcode = OPCODE(code->instrs[i]);
+    JitType type = jitOpcodeType(opcode);
+    int size = (type == JIT_INT8) ? 1 : ADDRESS_SIZE;
+    int sp = jitRegisters[REG_SP];
+
+    switch(opcode) {
+        case NOOP: {
+            break;
+        }
+        case MOVI: case MOVF: case MOVB:
+        case LDCI: case LDCF: case LDCB: case LDCA: {
+            emitLoadArg2(jit, type, RDX, rec);
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        case PUSHI: case PUSHF: case PUSHB: {
+            emitLoadArg2(jit, type, RDX, rec);
+            emitLea(jit, RAX, sp, -size);
+            emitStackCheck(jit, size, jit->overflowLabel);
+            emitMov(jit, sp, RAX);
+            emitRamStore(jit, type, RDX);
+            emitStackPeak(jit);
+            break;
+        }
+        case POPI: case POPF: case POPB: {
+            emitMov(jit, RAX, sp);
+            emitStackCheck(jit, size, jit->underflowLabel);
+            emitRamLoad(jit, type, RDX);
+            emitAluImm(jit, JIT_ALU_ADD, sp, size);
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        case DUPI: case DUPF: case DUPB: {
+            emitMov(jit, RAX, sp);
+            emitStackCheck(jit, size, jit->underflowLabel);
+            emitRamLoad(jit, type, RDX);
+            emitLea(jit, RAX, sp, -size);
+            emitStackCheck(jit, size, jit->overflowLabel);
+            emitMov(jit, sp, RAX);
+            emitRamStore(jit, type, RDX);
+            emitStackPeak(jit);
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        case PRINTI: case PRINTF: case PRINTB: case PRINTC: {
+            emitLoadArg2(jit, type, RCX, rec);
+            emitPrint(jit, opcode == PRINTF ? (JitHelper)jitPrintFloat :
+                           opcode == PRINTC ? (JitHelper)jitPrintChar : (JitHelper)jitPrintInt);
+            break;
+        }
+        case FLUSH: {
+            emitPrint(jit, (JitHelper)jitFlush);
+            break;
+        }
+        case SYSCALL: {
+            // the host function works on the Cpu32, so every guest register goes through it
+            emitLoadArg2(jit, type, RCX, rec);
+            emitSyncRegisters(jit, 1);
+            emitMovImm64(jit, RDI, (uint64_t)(uintptr_t)jit->vm);
+            emitMov(jit, RSI, RCX);
+            emitMovImm(jit, RDX, (int32_t)rec->pc);
+            emitCall(jit, (JitHelper)jitSyscall);
+            emitSyncRegisters(jit, 0);
+            break;
+        }
+        case NOTI: case NOTB: {
+            emitLoadArg2(jit, type, RDX, rec);
+            emitF7(jit, JIT_F7_NOT, RDX);
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        case DIVI: case DIVB: case MODI: case MODB: {
+            emitLoadArg2(jit, type, RCX, rec);
+            emitDivisorCheck(jit, type);
+            emitLoadArg1(jit, type, RDX, rec);
+            emitMov(jit, RAX, RDX);
+            emitByte(jit, 0x99);  // cdq
+            emitF7(jit, JIT_F7_IDIV, RCX);
+            if(opcode == DIVI || opcode == DIVB) {
+                emitMov(jit, RDX, RAX);
+            }
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        case DIVF: case MODF: {
+            emitLoadArg2(jit, type, RCX, rec);
+            emitMovdToXmm(jit, JIT_XMM1, RCX);
+            emitDivisorCheck(jit, type);
+            emitLoadArg1(jit, type, RDX, rec);
+            emitMovdToXmm(jit, JIT_XMM0, RDX);
+            if(opcode == DIVF) {
+                emitFloatOp(jit, opcode);
+            }
+            else {
+                // (int)a % (int)b, converted back to a float
+                emitSse(jit, 0xf3, 0x2c, RAX, JIT_XMM0);  // cvttss2si eax, xmm0
+                emitSse(jit, 0xf3, 0x2c, RCX, JIT_XMM1);  // cvttss2si ecx, xmm1
+                emitByte(jit, 0x99);
+                emitF7(jit, JIT_F7_IDIV, RCX);
+                emitSse(jit, 0xf3, 0x2a, JIT_XMM0, RDX);  // cvtsi2ss xmm0, edx
+            }
+            emitMovdFromXmm(jit, RDX, JIT_XMM0);
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        case ADDF: case SUBF: case MULF: {
+            emitLoadArg1(jit, type, RDX, rec);
+            emitLoadArg2(jit, type, RCX, rec);
+            emitMovdToXmm(jit, JIT_XMM0, RDX);
+            emitMovdToXmm(jit, JIT_XMM1, RCX);
+            emitFloatOp(jit, opcode);
+            emitMovdFromXmm(jit, RDX, JIT_XMM0);
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        case ADDI: case ADDB: case SUBI: case SUBB: case MULI: case MULB:
+        case ORI:  case ORB:  case ANDI: case ANDB: case XORI: case XORB:
+        case SZRLI: case SZRLB: case SRLI: case SRLB: case SLLI: case SLLB: {
+            emitLoadArg1(jit, type, RDX, rec);
+            emitLoadArg2(jit, type, RCX, rec);
+            emitIntOp(jit, opcode);
+            emitStoreArg1(jit, type, RDX, rec);
+            break;
+        }
+        default: {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void jitAccessStub(Jit* jit, Address label, int size) {
+    jitPlaceLabel(jit, label);
+    emitSyncRegisters(jit, 1);
+    emitMov(jit, RDI, RAX);
+    emitMov(jit, RSI, RAX);
+    emitAluImm(jit, JIT_ALU_ADD, RSI, size);
+    emitCall(jit, (JitHelper)jitAccessViolation);
+}
+
+static void jitStoreStub(Jit* jit, Address label, int size) {
+    jitPlaceLabel(jit, label);
+    emitSyncRegisters(jit, 1);
+    emitMovImm64(jit, RDI, (uint64_t)(uintptr_t)jit->vm->ram);
+    emitMov(jit, RSI, RAX);
+    emitMovImm(jit, RDX, size);
+    emitCall(jit, (JitHelper)jitStoreViolation);
+}
+
+/* the error paths shared by every instruction */
+static void jitErrorStubs(Jit* jit) {
+    jitAccessStub(jit, jit->access1Label, 1);
+    jitAccessStub(jit, jit->access4Label, ADDRESS_SIZE);
+    jitStoreStub(jit, jit->store1Label, 1);
+    jitStoreStub(jit, jit->store4Label, ADDRESS_SIZE);
+
+    jitPlaceLabel(jit, jit->divideLabel);
+    emitSyncRegisters(jit, 1);
+    emitCall(jit, (JitHelper)jitDivideByZero);
+
+    jitPlaceLabel(jit, jit->overflowLabel);
+    emitSyncRegisters(jit, 1);
+    emitMovImm64(jit, RDI, (uint64_t)(uintptr_t)jit->vm);
+    emitCall(jit, (JitHelper)jitStackOverflow);
+
+    jitPlaceLabel(jit, jit->underflowLabel);
+    emitSyncRegisters(jit, 1);
+    emitMovImm64(jit, RDI, (uint64_t)(uintptr_t)jit->vm);
+    emitCall(jit, (JitHelper)jitStackUnderflow);
+}
+
+static void jitInit(Jit* jit, Vm* vm, Bytecode* code) {
+    jit->vm = vm;
+    jit->code = code;
+    jit->bytes = NULL;
+    jit->fixups = NULL;
+    jit->labels = NULL;
+    jit->access1Label = jitNewLabel(jit);
+    jit->access4Label = jitNewLabel(jit);
+    jit->store1Label = jitNewLabel(jit);
+    jit->store4Label = jitNewLabel(jit);
+    jit->divideLabel = jitNewLabel(jit);
+    jit->overflowLabel = jitNewLabel(jit);
+    jit->underflowLabel = jitNewLabel(jit);
+}
+
+static void jitRelease(Jit* jit) {
+    buf_free(jit->bytes);
+    buf_free(jit->fixups);
+    buf_free(jit->labels);
+}
+
+static void jitPrologue(Jit* jit) {
+    static const int pushOrder[] = { RBX, RBP, R12, R13, R14, R15 };
+    for(size_t i = 0; i < sizeof(pushOrder) / sizeof(pushOrder[0]); i++) {
+        emitRex(jit, 0, 0, 0, pushOrder[i], 0);
+        emitByte(jit, 0x50 + (pushOrder[i] & 7));
+    }
+    // six pushes and the return address, this keeps rsp 16 byte aligned for the helper calls
+    emitByte(jit, 0x48);  // sub rsp, 8
+    emitByte(jit, 0x83);
+    emitModRm(jit, 3, 5, RSP);
+    emitByte(jit, 8);
+
+    emitMovImm64(jit, JIT_RAM_REG, (uint64_t)(uintptr_t)jit->vm->ram->mem);
+    emitSyncRegisters(jit, 0);
+}
+
+/* stores the guest registers and returns, eax is the return value */
+static void jitEpilogue(Jit* jit) {
+    emitSyncRegisters(jit, 1);
+    emitByte(jit, 0x48);  // add rsp, 8
+    emitByte(jit, 0x83);
+    emitModRm(jit, 3, 0, RSP);
+    emitByte(jit, 8);
+    static const int popOrder[] = { R15, R14, R13, R12, RBP, RBX };
+    for(size_t i = 0; i < sizeof(popOrder) / sizeof(popOrder[0]); i++) {
+        emitRex(jit, 0, 0, 0, popOrder[i], 0);
+        emitByte(jit, 0x58 + (popOrder[i] & 7));
+    }
+    emitByte(jit, 0xc3);
+}
+
+/* patches the jumps and copies the code into an executable mapping, NULL if that fails */
+static void* jitMap(Jit* jit) {
+    for(size_t i = 0; i < buf_len(jit->fixups); i++) {
+        JitFixup* fixup = &jit->fixups[i];
+        int32_t rel = (int32_t)(jit->labels[fixup->label] - (fixup->offset + 4));
+        memcpy(jit->bytes + fixup->offset, &rel, sizeof(rel));
+    }
+
+    size_t size = buf_len(jit->bytes);
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+        return NULL;
+    }
+
+    // the code is never writable and executable at the same time
+    memcpy(mem, jit->bytes, size);
+    if(mprotect(mem, size, PROT_READ | PROT_EXEC)) {
+        munmap(mem, size);
+        return NULL;
+    }
+
+    return mem;
+}
+
+JitCode* jitCompile(Vm* vm, Bytecode* code) {
+    if(!code->length || !code->instrs) {
+        return NULL;
+    }
+
+    if(!code->decoded) {
+        vmDecode(vm, code);
+    }
+
+    Jit jit;
+    jitInit(&jit, vm, code);
+
+    // instruction labels, the two past the end exit like the trailing HALT records
+    size_t firstLabel = buf_len(jit.labels);
+    for(Address i = 0; i < code->length + 2; i++) {
+        jitNewLabel(&jit);
+    }
+    #define INSTR_LABEL(i) ((Address)(firstLabel + (i)))
+
+    JitCode* result = NULL;
+    uint64_t* targets = (uint64_t*) litaMalloc(sizeof(uint64_t) * code->length);
+
+    jitPrologue(&jit);
+    for(Address i = 0; i < code->length; i++) {
+        jitPlaceLabel(&jit, INSTR_LABEL(i));
+
+        DecodedInstr* rec = &code->decoded[i];
+        Opcode opcode = OPCODE(code->instrs[i]);
+        if(rec->opcode == OP_SYNC_PC) {
+            goto done;
+        }
+
+        if(!isControlOpcode(opcode)) {
+            if(!jitInstruction(&jit, i)) {
+                goto done;
+            }
+            continue;
+        }
+
+        Address target = (Address)(rec->arg2.target - code->decoded);
+        switch(opcode) {
+            case JMP: {
+                emitJmp(&jit, INSTR_LABEL(target));
+                break;
+            }
+            case CALL: {
+                emitMovImm(&jit, jitRegisters[REG_R], (int32_t)(i + 1));
+                emitJmp(&jit, INSTR_LABEL(target));
+                break;
+            }
+            case RET: {
+                // $r is a guest visible register, so the native address comes from the targets table
+                emitMov(&jit, RAX, jitRegisters[REG_R]);
+                emitByte(&jit, 0x3d);  // cmp eax, length
+                emitInt32(&jit, code->length);
+                emitJcc(&jit, JIT_CC_AE, INSTR_LABEL(code->length));
+                emitMovImm64(&jit, RCX, (uint64_t)(uintptr_t)targets);
+                emitByte(&jit, 0xff);  // jmp [rcx + rax * 8]
+                emitModRm(&jit, 0, 4, 4);
+                emitModRm(&jit, 3, RAX, RCX);
+                break;
+            }
+            default: {
+                emitJcc(&jit, emitCompare(&jit, opcode, rec), INSTR_LABEL(i + 2));
+                break;
+            }
+        }
+    }
+
+    jitPlaceLabel(&jit, INSTR_LABEL(code->length));
+    jitPlaceLabel(&jit, INSTR_LABEL(code->length + 1));
+    emitMovImm64(&jit, RDX, (uint64_t)(uintptr_t)&vm->cpu->pc);
+    emitByte(&jit, 0xc7);  // mov dword [rdx], length
+    emitModRm(&jit, 0, 0, RDX);
+    emitInt32(&jit, code->length);
+    jitEpilogue(&jit);
+    jitErrorStubs(&jit);
+
+    void* mem = jitMap(&jit);
+    if(!mem) {
+        goto done;
+    }
+
+    for(Address i = 0; i < code->length; i++) {
+        targets[i] = (uint64_t)(uintptr_t)((uint8_t*)mem + jit.labels[INSTR_LABEL(i)]);
+    }
+    #undef INSTR_LABEL
+
+    result = (JitCode*) litaMalloc(sizeof(JitCode));
+    result->vm = vm;
+    result->code = code;
+    result->mem = mem;
+    result->size = buf_len(jit.bytes);
+    result->targets = targets;
+    targets = NULL;
+
+done:
+    litaFree(targets);
+    jitRelease(&jit);
+
+    return result;
+}
+
+void jitExecute(JitCode* jit) {
+    void (*entry)(void);
+    // object to function pointer conversions are not ISO C, but POSIX guarantees them (see dlsym)
+    memcpy(&entry, &jit->mem, sizeof(entry));
+
+    Output* runningOutput = vmRunningOutput;
+    vmRunningOutput = jit->vm->output;
+    entry();
+    outputFlush(jit->vm->output);
+    vmRunningOutput = runningOutput;
+}
+
+/* a guard of a trace, leaves the trace to resume the interpreter at an instruction */
+typedef struct JitExit {
+    Address label;
+    Address resume;    /* instruction to resume at, or JIT_RESUME_AT_R to resume where $r points */
+    Address executed;  /* number of trace instructions run in the iteration that exits here */
+} JitExit;
+
+#define JIT_RESUME_AT_R ((Address)-1)
+
+static void jitAddExit(Jit* jit, JitExit** exits, int cc, Address resume, Address executed) {
+    JitExit exit = { jitNewLabel(jit), resume, executed };
+    buf_push(*exits, exit);
+    emitJcc(jit, cc, exit.label);
+}
+
+JitTrace* jitCompileTrace(Vm* vm, Bytecode* code, const Address* path, size_t length) {
+    if(!length || !code->decoded) {
+        return NULL;
+    }
+
+    Jit jit;
+    jitInit(&jit, vm, code);
+
+    Address loopLabel = jitNewLabel(&jit);
+    Address exitLabel = jitNewLabel(&jit);
+    JitExit* exits = NULL;
+    JitTrace* result = NULL;
+
+    jitPrologue(&jit);
+    jitPlaceLabel(&jit, loopLabel);
+
+    for(size_t k = 0; k < length; k++) {
+        Address i = path[k];
+        Address next = (k + 1 < length) ? path[k + 1] : path[0];
+        Address executed = (Address)(k + 1);
+
+        if(i >= code->length) {
+            goto done;
+        }
+
+        DecodedInstr* rec = &code->decoded[i];
+        Opcode opcode = OPCODE(code->instrs[i]);
+        if(rec->opcode == OP_SYNC_PC) {
+            goto done;
+        }
+
+        if(!isControlOpcode(opcode)) {
+            if(!jitInstruction(&jit, i)) {
+                goto done;
+            }
+            continue;
+        }
+
+        // the recorded path decides which way the control transfers go, any other outcome
+        // leaves the trace
+        Address target = (Address)(rec->arg2.target - code->decoded);
+        switch(opcode) {
+            case JMP: {
+                if(target != next) goto done;
+                break;
+            }
+            case CALL: {
+                if(target != next) goto done;
+                emitMovImm(&jit, jitRegisters[REG_R], (int32_t)(i + 1));
+                break;
+            }
+            case RET: {
+                emitMov(&jit, RAX, jitRegisters[REG_R]);
+                emitByte(&jit, 0x3d);  // cmp eax, next
+                emitInt32(&jit, next);
+                jitAddExit(&jit, &exits, JIT_CC_E ^ 1, JIT_RESUME_AT_R, executed);
+                break;
+            }
+            default: {
+                int skipCC = emitCompare(&jit, opcode, rec);
+                if(next == i + 2) {
+                    jitAddExit(&jit, &exits, skipCC ^ 1, i + 1, executed);
+                }
+                else if(next == i + 1) {
+                    jitAddExit(&jit, &exits, skipCC, i + 2, executed);
+                }
+                else {
+                    goto done;
+                }
+                break;
+            }
+        }
+    }
+
+    // a complete iteration, count it and go around again
+    emitMovImm64(&jit, RDX, (uint64_t)(uintptr_t)&vm->tracedCount);
+    emitByte(&jit, 0x48);  // add qword [rdx], length
+    emitByte(&jit, 0x81);
+    emitModRm(&jit, 0, JIT_ALU_ADD, RDX);
+    emitInt32(&jit, (uint32_t)length);
+    emitJmp(&jit, loopLabel);
+
+    for(size_t i = 0; i < buf_len(exits); i++) {
+        JitExit* exit = &exits[i];
+        jitPlaceLabel(&jit, exit->label);
+        if(exit->resume == JIT_RESUME_AT_R) {
+            // eax is $r, past the end of the program halts like the interpreter's RET
+            emitMovImm(&jit, RCX, (int32_t)code->length);
+            emitRR(&jit, 0x39, RAX, RCX);  // cmp eax, ecx
+            emitByte(&jit, 0x0f);          // cmova eax, ecx
+            emitByte(&jit, 0x47);
+            emitModRm(&jit, 3, RAX, RCX);
+        }
+        else {
+            emitMovImm(&jit, RAX, (int32_t)exit->resume);
+        }
+        emitMovImm(&jit, RCX, (int32_t)exit->executed);
+        emitJmp(&jit, exitLabel);
+    }
+
+    jitPlaceLabel(&jit, exitLabel);
+    emitMovImm64(&jit, RDX, (uint64_t)(uintptr_t)&vm->tracedCount);
+    emitByte(&jit, 0x48);  // add qword [rdx], rcx
+    emitByte(&jit, 0x01);
+    emitModRm(&jit, 0, RCX, RDX);
+    jitEpilogue(&jit);
+    jitErrorStubs(&jit);
+
+    void* mem = jitMap(&jit);
+    if(!mem) {
+        goto done;
+    }
+
+    result = (JitTrace*) litaMalloc(sizeof(JitTrace));
+    result->mem = mem;
+    result->size = buf_len(jit.bytes);
+    result->head = path[0];
+    result->length = (Address)length;
+
+done:
+    buf_free(exits);
+    jitRelease(&jit);
+
+    return result;
+}
+
+Address jitExecuteTrace(JitTrace* trace) {
+    Address (*entry)(void);
+    memcpy(&entry, &trace->mem, sizeof(entry));
+    return entry();
+}
+
+void jitFreeTrace(JitTrace* trace) {
+    if(trace) {
+        munmap(trace->mem, trace->size);
+        litaFree(trace);
+    }
+}
+
+void jitFree(JitCode* jit) {
+    if(jit) {
+        munmap(jit->mem, jit->size);
+        litaFree(jit->targets);
+        litaFree(jit);
+    }
+}
+
+#else
+
+JitCode* jitCompile(Vm* vm, Bytecode* code) {
+    (void)vm;
+    (void)code;
+    return NULL;
+}
+
+void jitExecute(JitCode* jit) {
+    (void)jit;
+}
+
+void jitFree(JitCode* jit) {
+    (void)jit;
+}
+
+JitTrace* jitCompileTrace(Vm* vm, Bytecode* code, const Address* path, size_t length) {
+    (void)vm;
+    (void)code;
+    (void)path;
+    (void)length;
+    return NULL;
+}
+
+Address jitExecuteTrace(JitTrace* trace) {
+    (void)trace;
+    return 0;
+}
+
+void jitFreeTrace(JitTrace* trace) {
+    (void)trace;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef LITA_JIT_H
+#define LITA_JIT_H
+
+#include <stdint.h>
+#include "bytecode.h"
+#include "vm.h"
+
+/*
+ * The baseline JIT translates every instruction of a Bytecode into a fixed snippet
+ * of native x86-64 code.  Guest registers live in host registers for the whole run
+ * and RAM is addressed relative to the Ram base pointer, with the same range and
+ * divide by zero checks the interpreter does.
+ */
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+    #define LITA_JIT 1
+#else
+    #define LITA_JIT 0
+#endif
+
+typedef struct JitCode {
+    Vm*       vm;       /* compiled code is bound to the Vm's RAM and CPU */
+    Bytecode* code;
+
+    void*     mem;      /* the executable mapping */
+    size_t    size;
+    uint64_t* targets;  /* native address of each instruction, used by RET */
+} JitCode;
+
+/* translates the code, returns NULL if the platform or any of the instructions isn't supported */
+JitCode* jitCompile(Vm* vm, Bytecode* code);
+void     jitExecute(JitCode* jit);
+void     jitFree(JitCode* jit);
+
+/*
+ * A hot loop compiled along the path one of its iterations took, see the loop tracing
+ * of vmExecute.  The native code loops for as long as every IF goes the recorded way,
+ * then stores the registers and returns the index of the instruction the interpreter 
+ * resumes at.
+ */
+typedef struct JitTrace {
+    void*   mem;
+    size_t  size;
+    Address head;    /* the loop head, the first instruction of the path */
+    Address length;  /* instructions in the path */
+} JitTrace;
+
+/* compiles the instruction indexes of one loop iteration, NULL if any of the instructions isn't supported */
+JitTrace* jitCompileTrace(Vm* vm, Bytecode* code, const Address* path, size_t length);
+Address   jitExecuteTrace(JitTrace* trace);
+void      jitFreeTrace(JitTrace* trace);
+
+#endif
@@ -0,0 +1,348 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#if LITA_KERNEL_WIDTH == 32
+    #include <immintrin.h>
+
+    typedef __m256i KernelBytes;
+    #define KERNEL_LOAD(p)     _mm256_loadu_si256((const __m256i*)(p))
+    #define KERNEL_SPLAT(c)    _mm256_set1_epi8(c)
+    #define KERNEL_EQ(a, b)    _mm256_cmpeq_epi8((a), (b))
+    #define KERNEL_MASK(v)     ((uint32_t)_mm256_movemask_epi8(v))
+    #define KERNEL_FULL_MASK   0xffffffffu
+
+    typedef __m256i KernelInts;
+    typedef __m256  KernelFloats;
+    #define KERNEL_LOAD_INTS(p)        _mm256_loadu_si256((const __m256i*)(p))
+    #define KERNEL_STORE_INTS(p, v)    _mm256_storeu_si256((__m256i*)(p), (v))
+    #define KERNEL_SPLAT_INT(x)        _mm256_set1_epi32(x)
+    #define KERNEL_ADD_INTS(a, b)      _mm256_add_epi32((a), (b))
+    #define KERNEL_SUB_INTS(a, b)      _mm256_sub_epi32((a), (b))
+    #define KERNEL_MUL_INTS(a, b)      _mm256_mullo_epi32((a), (b))
+    #define KERNEL_MIN_INTS(a, b)      _mm256_min_epi32((a), (b))
+    #define KERNEL_MAX_INTS(a, b)      _mm256_max_epi32((a), (b))
+
+    #define KERNEL_LOAD_FLOATS(p)      _mm256_loadu_ps((const float*)(p))
+    #define KERNEL_STORE_FLOATS(p, v)  _mm256_storeu_ps((float*)(p), (v))
+    #define KERNEL_SPLAT_FLOAT(x)      _mm256_set1_ps(x)
+    #define KERNEL_ADD_FLOATS(a, b)    _mm256_add_ps((a), (b))
+    #define KERNEL_SUB_FLOATS(a, b)    _mm256_sub_ps((a), (b))
+    #define KERNEL_MUL_FLOATS(a, b)    _mm256_mul_ps((a), (b))
+    #define KERNEL_MIN_FLOATS(a, b)    _mm256_min_ps((a), (b))
+    #define KERNEL_MAX_FLOATS(a, b)    _mm256_max_ps((a), (b))
+#elif LITA_KERNEL_WIDTH == 16
+    #include <emmintrin.h>
+
+    typedef __m128i KernelBytes;
+    #define KERNEL_LOAD(p)     _mm_loadu_si128((const __m128i*)(p))
+    #define KERNEL_SPLAT(c)    _mm_set1_epi8(c)
+    #define KERNEL_EQ(a, b)    _mm_cmpeq_epi8((a), (b))
+    #define KERNEL_MASK(v)     ((uint32_t)_mm_movemask_epi8(v))
+    #define KERNEL_FULL_MASK   0xffffu
+
+    typedef __m128i KernelInts;
+    typedef __m128  KernelFloats;
+    #define KERNEL_LOAD_INTS(p)        _mm_loadu_si128((const __m128i*)(p))
+    #define KERNEL_STORE_INTS(p, v)    _mm_storeu_si128((__m128i*)(p), (v))
+    #define KERNEL_SPLAT_INT(x)        _mm_set1_epi32(x)
+    #define KERNEL_ADD_INTS(a, b)      _mm_add_epi32((a), (b))
+    #define KERNEL_SUB_INTS(a, b)      _mm_sub_epi32((a), (b))
+    #define KERNEL_MUL_INTS(a, b)      kernelMulInts((a), (b))
+    #define KERNEL_MIN_INTS(a, b)      kernelSelectInts(_mm_cmpgt_epi32((a), (b)), (b), (a))
+    #define KERNEL_MAX_INTS(a, b)      kernelSelectInts(_mm_cmpgt_epi32((a), (b)), (a), (b))
+
+    #define KERNEL_LOAD_FLOATS(p)      _mm_loadu_ps((const float*)(p))
+    #define KERNEL_STORE_FLOATS(p, v)  _mm_storeu_ps((float*)(p), (v))
+    #define KERNEL_SPLAT_FLOAT(x)      _mm_set1_ps(x)
+    #define KERNEL_ADD_FLOATS(a, b)    _mm_add_ps((a), (b))
+    #define KERNEL_SUB_FLOATS(a, b)    _mm_sub_ps((a), (b))
+    #define KERNEL_MUL_FLOATS(a, b)    _mm_mul_ps((a), (b))
+    #define KERNEL_MIN_FLOATS(a, b)    _mm_min_ps((a), (b))
+    #define KERNEL_MAX_FLOATS(a, b)    _mm_max_ps((a), (b))
+
+    /* SSE2 has no 32 bit multiply or min/max, those came with SSE4.1 */
+    static KernelInts kernelMulInts(KernelInts a, KernelInts b) {
+        KernelInts even = _mm_mul_epu32(a, b);
+        KernelInts odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), 
+                                  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    static KernelInts kernelSelectInts(KernelInts mask, KernelInts a, KernelInts b) {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+#endif
+
+#define KERNEL_LANES (LITA_KERNEL_WIDTH / 4)
+
+#if LITA_KERNEL_WIDTH > 1
+/* the mask has a bit per byte of the step, in address order */
+static size_t kernelLowestBit(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctz(mask);
+#else
+    size_t bit = 0;
+    while(!((mask >> bit) & 1)) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+#endif
+
+size_t kernelStrLen(const char* str, size_t len) {
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    KernelBytes zero = KERNEL_SPLAT(0);
+    for(; i + LITA_KERNEL_WIDTH <= len; i += LITA_KERNEL_WIDTH) {
+        uint32_t mask = KERNEL_MASK(KERNEL_EQ(KERNEL_LOAD(str + i), zero));
+        if(mask) {
+            return i + kernelLowestBit(mask);
+        }
+    }
+#endif
+    for(; i < len; i++) {
+        if(!str[i]) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+size_t kernelStrChr(const char* str, char c, size_t len) {
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    KernelBytes zero = KERNEL_SPLAT(0);
+    KernelBytes wanted = KERNEL_SPLAT(c);
+    for(; i + LITA_KERNEL_WIDTH <= len; i += LITA_KERNEL_WIDTH) {
+        KernelBytes bytes = KERNEL_LOAD(str + i);
+        uint32_t mask = KERNEL_MASK(KERNEL_EQ(bytes, zero)) | KERNEL_MASK(KERNEL_EQ(bytes, wanted));
+        if(mask) {
+            return i + kernelLowestBit(mask);
+        }
+    }
+#endif
+    for(; i < len; i++) {
+        if(!str[i] || str[i] == c) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+size_t kernelStrDiff(const char* a, const char* b, size_t len) {
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    KernelBytes zero = KERNEL_SPLAT(0);
+    for(; i + LITA_KERNEL_WIDTH <= len; i += LITA_KERNEL_WIDTH) {
+        KernelBytes bytesA = KERNEL_LOAD(a + i);
+        KernelBytes bytesB = KERNEL_LOAD(b + i);
+        uint32_t mask = (~KERNEL_MASK(KERNEL_EQ(bytesA, bytesB)) & KERNEL_FULL_MASK) |
+                        KERNEL_MASK(KERNEL_EQ(bytesA, zero));
+        if(mask) {
+            return i + kernelLowestBit(mask);
+        }
+    }
+#endif
+    for(; i < len; i++) {
+        if(a[i] != b[i] || !a[i]) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+/* 
+ * The elements are read and written as bytes, guest arrays don't have to be aligned.  The
+ * integer math wraps around like the interpreter's does on the usual hosts.
+ */
+static int32_t kernelLoadInt32(const char* p) {
+    int32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static float kernelLoadFloat(const char* p) {
+    float value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static int32_t kernelOpInt32(KernelOp op, int32_t x, int32_t y) {
+    switch(op) {
+        case KERNEL_ADD: return (int32_t)((uint32_t)x + (uint32_t)y);
+        case KERNEL_SUB: return (int32_t)((uint32_t)x - (uint32_t)y);
+        case KERNEL_MUL: return (int32_t)((uint32_t)x * (uint32_t)y);
+        case KERNEL_MIN: return x > y ? y : x;
+        case KERNEL_MAX: return x > y ? x : y;
+    }
+    return x;
+}
+
+/* min and max pick the second value when either is NaN, like the SSE/AVX instructions */
+static float kernelOpFloat(KernelOp op, float x, float y) {
+    switch(op) {
+        case KERNEL_ADD: return x + y;
+        case KERNEL_SUB: return x - y;
+        case KERNEL_MUL: return x * y;
+        case KERNEL_MIN: return x < y ? x : y;
+        case KERNEL_MAX: return x > y ? x : y;
+    }
+    return x;
+}
+
+/* 
+ * Whether a store to a[i] can change a b[j] a later step reads, the vector loops read 
+ * several elements ahead so they only run on arrays that are the same or apart.
+ */
+static int kernelPartialOverlap(const char* a, const char* b, size_t len) {
+    size_t size = len * 4;
+    return a != b && a < b + size && b < a + size;
+}
+
+#define KERNEL_ELEMENTWISE(i, a, b, len, TYPE, OP)                                        \
+    for(; (i) + KERNEL_LANES <= (len); (i) += KERNEL_LANES) {                             \
+        KERNEL_STORE_##TYPE((a) + (i) * 4, OP(KERNEL_LOAD_##TYPE((a) + (i) * 4),          \
+                                              KERNEL_LOAD_##TYPE((b) + (i) * 4)));        \
+    }
+
+void kernelVectorInt32(KernelOp op, char* a, const char* b, size_t len) {
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    if(!kernelPartialOverlap(a, b, len)) {
+        switch(op) {
+            case KERNEL_ADD: KERNEL_ELEMENTWISE(i, a, b, len, INTS, KERNEL_ADD_INTS); break;
+            case KERNEL_SUB: KERNEL_ELEMENTWISE(i, a, b, len, INTS, KERNEL_SUB_INTS); break;
+            case KERNEL_MUL: KERNEL_ELEMENTWISE(i, a, b, len, INTS, KERNEL_MUL_INTS); break;
+            case KERNEL_MIN: KERNEL_ELEMENTWISE(i, a, b, len, INTS, KERNEL_MIN_INTS); break;
+            case KERNEL_MAX: KERNEL_ELEMENTWISE(i, a, b, len, INTS, KERNEL_MAX_INTS); break;
+        }
+    }
+#endif
+    for(; i < len; i++) {
+        int32_t value = kernelOpInt32(op, kernelLoadInt32(a + i * 4), kernelLoadInt32(b + i * 4));
+        memcpy(a + i * 4, &value, sizeof(value));
+    }
+}
+
+void kernelVectorFloat(KernelOp op, char* a, const char* b, size_t len) {
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    if(!kernelPartialOverlap(a, b, len)) {
+        switch(op) {
+            case KERNEL_ADD: KERNEL_ELEMENTWISE(i, a, b, len, FLOATS, KERNEL_ADD_FLOATS); break;
+            case KERNEL_SUB: KERNEL_ELEMENTWISE(i, a, b, len, FLOATS, KERNEL_SUB_FLOATS); break;
+            case KERNEL_MUL: KERNEL_ELEMENTWISE(i, a, b, len, FLOATS, KERNEL_MUL_FLOATS); break;
+            case KERNEL_MIN: KERNEL_ELEMENTWISE(i, a, b, len, FLOATS, KERNEL_MIN_FLOATS); break;
+            case KERNEL_MAX: KERNEL_ELEMENTWISE(i, a, b, len, FLOATS, KERNEL_MAX_FLOATS); break;
+        }
+    }
+#endif
+    for(; i < len; i++) {
+        float value = kernelOpFloat(op, kernelLoadFloat(a + i * 4), kernelLoadFloat(b + i * 4));
+        memcpy(a + i * 4, &value, sizeof(value));
+    }
+}
+
+void kernelMulAddInt32(char* a, const char* b, int32_t c, size_t len) {
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    if(!kernelPartialOverlap(a, b, len)) {
+        KernelInts factor = KERNEL_SPLAT_INT(c);
+        for(; i + KERNEL_LANES <= len; i += KERNEL_LANES) {
+            KernelInts product = KERNEL_MUL_INTS(KERNEL_LOAD_INTS(b + i * 4), factor);
+            KERNEL_STORE_INTS(a + i * 4, KERNEL_ADD_INTS(KERNEL_LOAD_INTS(a + i * 4), product));
+        }
+    }
+#endif
+    for(; i < len; i++) {
+        int32_t product = kernelOpInt32(KERNEL_MUL, kernelLoadInt32(b + i * 4), c);
+        int32_t value = kernelOpInt32(KERNEL_ADD, kernelLoadInt32(a + i * 4), product);
+        memcpy(a + i * 4, &value, sizeof(value));
+    }
+}
+
+void kernelMulAddFloat(char* a, const char* b, float c, size_t len) {
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    if(!kernelPartialOverlap(a, b, len)) {
+        KernelFloats factor = KERNEL_SPLAT_FLOAT(c);
+        for(; i + KERNEL_LANES <= len; i += KERNEL_LANES) {
+            KernelFloats product = KERNEL_MUL_FLOATS(KERNEL_LOAD_FLOATS(b + i * 4), factor);
+            KERNEL_STORE_FLOATS(a + i * 4, KERNEL_ADD_FLOATS(KERNEL_LOAD_FLOATS(a + i * 4), product));
+        }
+    }
+#endif
+    for(; i < len; i++) {
+        float product = kernelLoadFloat(b + i * 4) * c;
+        float value = kernelLoadFloat(a + i * 4) + product;
+        memcpy(a + i * 4, &value, sizeof(value));
+    }
+}
+
+int32_t kernelSumInt32(const char* a, size_t len) {
+    uint32_t sum = 0;
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH > 1
+    KernelInts sums = KERNEL_SPLAT_INT(0);
+    for(; i + KERNEL_LANES <= len; i += KERNEL_LANES) {
+        sums = KERNEL_ADD_INTS(sums, KERNEL_LOAD_INTS(a + i * 4));
+    }
+
+    int32_t lanes[KERNEL_LANES];
+    KERNEL_STORE_INTS(lanes, sums);
+    for(size_t lane = 0; lane < KERNEL_LANES; lane++) {
+        sum += (uint32_t)lanes[lane];
+    }
+#endif
+    for(; i < len; i++) {
+        sum += (uint32_t)kernelLoadInt32(a + i * 4);
+    }
+
+    return (int32_t)sum;
+}
+
+#define KERNEL_SUM_LANES 8
+
+float kernelSumFloat(const char* a, size_t len) {
+    // element i is added to the partial sum i % 8, whatever the kernel width
+    float sums[KERNEL_SUM_LANES] = { 0 };
+    size_t i = 0;
+#if LITA_KERNEL_WIDTH == 32
+    KernelFloats vectorSums = KERNEL_SPLAT_FLOAT(0);
+    for(; i + KERNEL_SUM_LANES <= len; i += KERNEL_SUM_LANES) {
+        vectorSums = KERNEL_ADD_FLOATS(vectorSums, KERNEL_LOAD_FLOATS(a + i * 4));
+    }
+    KERNEL_STORE_FLOATS(sums, vectorSums);
+#elif LITA_KERNEL_WIDTH == 16
+    KernelFloats lowSums = KERNEL_SPLAT_FLOAT(0);
+    KernelFloats highSums = KERNEL_SPLAT_FLOAT(0);
+    for(; i + KERNEL_SUM_LANES <= len; i += KERNEL_SUM_LANES) {
+        lowSums = KERNEL_ADD_FLOATS(lowSums, KERNEL_LOAD_FLOATS(a + i * 4));
+        highSums = KERNEL_ADD_FLOATS(highSums, KERNEL_LOAD_FLOATS(a + i * 4 + 16));
+    }
+    KERNEL_STORE_FLOATS(sums, lowSums);
+    KERNEL_STORE_FLOATS(sums + 4, highSums);
+#endif
+    for(; i < len; i++) {
+        sums[i % KERNEL_SUM_LANES] += kernelLoadFloat(a + i * 4);
+    }
+
+    return ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+}
+
+const char* kernelMode() {
+#if LITA_KERNEL_WIDTH == 32
+    return "avx2";
+#elif LITA_KERNEL_WIDTH == 16
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
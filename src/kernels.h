@@ -0,0 +1,61 @@
+#ifndef LITA_KERNELS_H
+#define LITA_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Host kernels of the opcodes that work on a whole range of guest RAM at once.  They take
+ * host pointers and never look past the length they are given, the callers check the
+ * guest range once and pass the bytes up to the end of the RAM.
+ *
+ * Where the compiler targets AVX2 or SSE2 they work on 32 or 16 bytes per step, elsewhere
+ * on a single byte or element.
+ */
+#if defined(__AVX2__)
+    #define LITA_KERNEL_WIDTH 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define LITA_KERNEL_WIDTH 16
+#else
+    #define LITA_KERNEL_WIDTH 1
+#endif
+
+/* index of the first 0 byte, len if there is none */
+size_t kernelStrLen(const char* str, size_t len);
+
+/* index of the first byte that is either c or 0, len if there is none */
+size_t kernelStrChr(const char* str, char c, size_t len);
+
+/* index of the first byte where the strings differ or both end, len if there is none */
+size_t kernelStrDiff(const char* a, const char* b, size_t len);
+
+/*
+ * The packed vector kernels, over arrays of 'len' int32 or float elements.  The results
+ * don't depend on the kernel width: the elements are combined in index order when the
+ * arrays partially overlap, the products of the multiply-adds are rounded like MULF does
+ * and the float sums always add up 8 interleaved partial sums in the same order.  Only the
+ * sign and payload of a NaN result are up to the host, as they are for ADDF and the like.
+ */
+typedef enum KernelOp {
+    KERNEL_ADD,
+    KERNEL_SUB,
+    KERNEL_MUL,
+    KERNEL_MIN,
+    KERNEL_MAX,
+} KernelOp;
+
+/* a[i] = a[i] op b[i] */
+void    kernelVectorInt32(KernelOp op, char* a, const char* b, size_t len);
+void    kernelVectorFloat(KernelOp op, char* a, const char* b, size_t len);
+
+/* a[i] = a[i] + b[i] * c */
+void    kernelMulAddInt32(char* a, const char* b, int32_t c, size_t len);
+void    kernelMulAddFloat(char* a, const char* b, float c, size_t len);
+
+int32_t kernelSumInt32(const char* a, size_t len);
+float   kernelSumFloat(const char* a, size_t len);
+
+/* the name of the kernel instruction set, "avx2", "sse2" or "scalar" */
+const char* kernelMode();
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lbc.h"
+#include "assembler.h"
+#include "buf.h"
+#include "common.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define LBC_MMAP 1
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#else
+    #define LBC_MMAP 0
+#endif
+
+#define LBC_ALIGNMENT 8
+
+/* reads or maps the whole file, NULL if it can't be opened or doesn't start with LBC_MAGIC */
+static LbcFile* lbcMap(const char* path) {
+    LbcFile* file = NULL;
+#if LBC_MMAP
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    char magic[4];
+    if(!fstat(fd, &info) && pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+        !memcmp(magic, LBC_MAGIC, sizeof(magic))) {
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            file = (LbcFile*) litaMalloc(sizeof(LbcFile));
+            file->data = (const char*) data;
+            file->size = (size_t)info.st_size;
+            file->mapped = 1;
+        }
+    }
+
+    close(fd);
+#else
+    FILE* stream = fopen(path, "rb");
+    if(!stream) {
+        return NULL;
+    }
+
+    char magic[4];
+    if(fread(magic, 1, sizeof(magic), stream) == sizeof(magic) && !memcmp(magic, LBC_MAGIC, sizeof(magic)) &&
+        !fseek(stream, 0L, SEEK_END)) {
+        long size = ftell(stream);
+        char* data = size > 0 ? (char*) litaMalloc((size_t)size) : NULL;
+        rewind(stream);
+        if(data && fread(data, 1, (size_t)size, stream) == (size_t)size) {
+            file = (LbcFile*) litaMalloc(sizeof(LbcFile));
+            file->data = data;
+            file->size = (size_t)size;
+            file->mapped = 0;
+        }
+        else {
+            litaFree(data);
+        }
+    }
+
+    fclose(stream);
+#endif
+    return file;
+}
+
+void lbcClose(LbcFile* file) {
+    if(file) {
+#if LBC_MMAP
+        if(file->mapped) {
+            munmap((void*)file->data, file->size);
+        }
+#endif
+        if(!file->mapped) {
+            litaFree((void*)file->data);
+        }
+        litaFree(file);
+    }
+}
+
+/* what is wrong with the file, NULL if nothing is */
+static const char* lbcCheck(LbcFile* file) {
+    const LbcHeader* header = (const LbcHeader*) file->data;
+    if(file->size < sizeof(LbcHeader)) {
+        return "it is truncated";
+    }
+    if(header->version != LBC_VERSION || header->byteOrder != LBC_BYTE_ORDER) {
+        return "it is of another version or byte order";
+    }
+
+    for(int i = 0; i < LBC_NUM_SECTIONS; i++) {
+        const LbcSection* section = &header->sections[i];
+        if(section->offset % LBC_ALIGNMENT || section->offset > file->size ||
+            section->size > file->size - section->offset) {
+            return "it is truncated";
+        }
+    }
+
+    const LbcSection* sections = header->sections;
+    if(sections[LBC_INSTRUCTIONS].size != (uint64_t)header->length * sizeof(Instruction) ||
+        sections[LBC_CONSTANTS].size != (uint64_t)header->numOfConstants * sizeof(Address) ||
+        sections[LBC_POOL].size != header->poolSize ||
+        (sections[LBC_DEBUG].size && sections[LBC_DEBUG].size != (uint64_t)header->length * sizeof(uint32_t))) {
+        return "the sections don't match the header";
+    }
+
+    // the constant operands are checked by verify, the addresses they refer to here
+    const Address* constants = (const Address*)(file->data + sections[LBC_CONSTANTS].offset);
+    for(uint32_t i = 0; i < header->numOfConstants; i++) {
+        if(constants[i] >= header->poolSize) {
+            return "a constant is outside of the constant pool";
+        }
+    }
+
+    return NULL;
+}
+
+LbcFile* lbcOpen(const char* path) {
+    LbcFile* file = lbcMap(path);
+    const char* error = file ? lbcCheck(file) : NULL;
+    if(error) {
+        lbcClose(file);
+        vmError("Invalid bytecode file '%s', %s", path, error);
+    }
+    return file;
+}
+
+LbcFile* lbcOpenValid(const char* path) {
+    LbcFile* file = lbcMap(path);
+    if(file && lbcCheck(file)) {
+        lbcClose(file);
+        return NULL;
+    }
+    return file;
+}
+
+Bytecode* lbcLoad(Vm* vm, LbcFile* file) {
+    const LbcHeader* header = (const LbcHeader*) file->data;
+    const LbcSection* sections = header->sections;
+
+    Ram* ram = vm->ram;
+    if(header->poolSize >= ram->size) {
+        lbcClose(file);
+        vmError("The constant pool of %u bytes does not fit in %zu bytes of RAM", header->poolSize, ram->size);
+    }
+    ramStoreBytes(ram, 0, file->data + sections[LBC_POOL].offset, header->poolSize);
+    vm->cpu->h.as.address = header->poolSize;
+    if(vm->protectConstants || (header->flags & LBC_PROTECTED_CONSTANTS)) {
+        vmProtectConstants(vm, header->poolSize);
+    }
+
+    Bytecode* code = (Bytecode*) litaMalloc(sizeof(Bytecode));
+    code->constants = (Address*)(file->data + sections[LBC_CONSTANTS].offset);
+    code->numOfConstants = header->numOfConstants;
+    code->instrs = (Instruction*)(file->data + sections[LBC_INSTRUCTIONS].offset);
+    code->length = header->length;
+    code->pc = 0;
+    code->decoded = NULL;
+    code->verified = 0;
+    code->file = file;
+    return code;
+}
+
+/* appends the bytes as the section, 8 byte aligned */
+static void lbcAddSection(char** out, LbcSectionKind kind, const void* bytes, size_t size) {
+    size_t offset = ALIGN_UP(buf_len(*out), (size_t)LBC_ALIGNMENT);
+    buf_fit(*out, offset + size);
+    memset(*out + buf_len(*out), 0, offset - buf_len(*out));
+    if(size) {
+        memcpy(*out + offset, bytes, size);
+    }
+    buf__hdr(*out)->len = offset + size;
+
+    LbcHeader* header = (LbcHeader*) *out;
+    header->sections[kind].offset = offset;
+    header->sections[kind].size = size;
+}
+
+int lbcWrite(const char* path, Vm* vm, Bytecode* code, const DebugInfo* debug) {
+    LbcHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LBC_MAGIC, sizeof(header.magic));
+    header.version = LBC_VERSION;
+    header.byteOrder = LBC_BYTE_ORDER;
+    header.length = code->length;
+    header.numOfConstants = (uint32_t)code->numOfConstants;
+    header.poolSize = vm->cpu->h.as.address;
+    header.flags = vm->protectConstants ? LBC_PROTECTED_CONSTANTS : 0;
+
+    char* out = NULL;
+    buf_fit(out, sizeof(header));
+    memcpy(out, &header, sizeof(header));
+    buf__hdr(out)->len = sizeof(header);
+
+    lbcAddSection(&out, LBC_INSTRUCTIONS, code->instrs, code->length * sizeof(Instruction));
+    lbcAddSection(&out, LBC_CONSTANTS, code->constants, code->numOfConstants * sizeof(Address));
+    lbcAddSection(&out, LBC_POOL, vm->ram->mem, header.poolSize);
+
+    if(debug && buf_len(debug->values)) {
+        uint32_t count = (uint32_t)buf_len(debug->values);
+        size_t entriesSize = sizeof(uint32_t) + count * sizeof(LbcSymbol);
+        char* symbols = (char*) litaMalloc(entriesSize + buf_len(debug->names));
+        memcpy(symbols, &count, sizeof(count));
+        for(uint32_t i = 0; i < count; i++) {
+            LbcSymbol symbol = { debug->values[i], debug->nameOffsets[i] };
+            memcpy(symbols + sizeof(uint32_t) + i * sizeof(LbcSymbol), &symbol, sizeof(symbol));
+        }
+        memcpy(symbols + entriesSize, debug->names, buf_len(debug->names));
+        lbcAddSection(&out, LBC_SYMBOLS, symbols, entriesSize + buf_len(debug->names));
+        litaFree(symbols);
+    }
+    if(debug && buf_len(debug->lines) == code->length) {
+        lbcAddSection(&out, LBC_DEBUG, debug->lines, code->length * sizeof(uint32_t));
+    }
+
+    FILE* file = fopen(path, "wb");
+    int written = file && fwrite(out, 1, buf_len(out), file) == buf_len(out);
+    if(file && fclose(file)) {
+        written = 0;
+    }
+
+    buf_free(out);
+    return written;
+}
+
+void lbcReadDebug(LbcFile* file, DebugInfo* debug) {
+    const LbcHeader* header = (const LbcHeader*) file->data;
+    const LbcSection* symbols = &header->sections[LBC_SYMBOLS];
+    const LbcSection* lines = &header->sections[LBC_DEBUG];
+
+    // a section that doesn't hold together is left out, the code runs without it
+    uint32_t count = 0;
+    if(symbols->size >= sizeof(uint32_t)) {
+        memcpy(&count, file->data + symbols->offset, sizeof(count));
+    }
+    size_t entriesSize = sizeof(uint32_t) + (size_t)count * sizeof(LbcSymbol);
+    if(count && entriesSize < symbols->size && file->data[symbols->offset + symbols->size - 1] == 0) {
+        const char* entries = file->data + symbols->offset + sizeof(uint32_t);
+        const char* names = file->data + symbols->offset + entriesSize;
+        size_t namesSize = symbols->size - entriesSize;
+        for(uint32_t i = 0; i < count; i++) {
+            LbcSymbol symbol;
+            memcpy(&symbol, entries + i * sizeof(LbcSymbol), sizeof(symbol));
+            if(symbol.name < namesSize) {
+                debugInfoAddName(debug, names + symbol.name, symbol.value);
+            }
+        }
+    }
+
+    if(lines->size) {
+        buf_fit(debug->lines, header->length);
+        memcpy(debug->lines, file->data + lines->offset, lines->size);
+        buf__hdr(debug->lines)->len = header->length;
+    }
+}
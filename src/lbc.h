@@ -0,0 +1,99 @@
+#ifndef LITA_LBC_H
+#define LITA_LBC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bytecode.h"
+#include "vm.h"
+
+/*
+ * The .lbc object format, assembled code that loads without the assembler.  The file is
+ * a header followed by its sections, each 8 byte aligned, in the byte order of the host
+ * that wrote it:
+ *
+ *   LBC_INSTRUCTIONS  the Instruction array
+ *   LBC_CONSTANTS     the Address of each constant slot, the constant operands index it
+ *   LBC_POOL          the image of the constant pool, the RAM from address 0 to $h
+ *   LBC_SYMBOLS       optional, the names of the labels and constants, see LbcSymbol
+ *   LBC_DEBUG         optional, the source line of each instruction as a uint32_t
+ *
+ * lbcOpen maps the file read only and the Bytecode lbcLoad returns runs on the instruction
+ * and constant sections in place, so loading costs a copy of the constant pool into the
+ * RAM and vmDecode, which verifies the code as it does for assembled code.
+ */
+#define LBC_MAGIC      "LBC\x1a"
+#define LBC_VERSION    2
+#define LBC_BYTE_ORDER 0x01020304u
+
+/* the flags of LbcHeader */
+#define LBC_PROTECTED_CONSTANTS 0x1  /* assembled for a read only pool, the identical constants share a copy */
+
+typedef enum LbcSectionKind {
+    LBC_INSTRUCTIONS,
+    LBC_CONSTANTS,
+    LBC_POOL,
+    LBC_SYMBOLS,
+    LBC_DEBUG,
+    LBC_NUM_SECTIONS
+} LbcSectionKind;
+
+typedef struct LbcSection {
+    uint64_t offset;
+    uint64_t size;           /* in bytes, 0 for a missing optional section */
+} LbcSection;
+
+typedef struct LbcHeader {
+    char     magic[4];       /* LBC_MAGIC */
+    uint32_t version;        /* LBC_VERSION */
+    uint32_t byteOrder;      /* LBC_BYTE_ORDER as the writer stored it */
+    uint32_t length;         /* number of instructions */
+    uint32_t numOfConstants;
+    uint32_t poolSize;       /* bytes of the constant pool, where $h starts out */
+    uint32_t flags;          /* LBC_PROTECTED_CONSTANTS */
+    uint32_t unused;         /* 0, keeps the sections 8 byte aligned */
+    LbcSection sections[LBC_NUM_SECTIONS];
+} LbcHeader;
+
+/* an entry of LBC_SYMBOLS, which is a uint32_t count, the entries and then the names */
+typedef struct LbcSymbol {
+    Address  value;          /* the instruction of a label, the address of a constant */
+    uint32_t name;           /* offset of the 0 terminated name from the end of the entries */
+} LbcSymbol;
+
+typedef struct LbcFile {
+    const char* data;
+    size_t      size;
+    int         mapped;      /* data is mmap'ed rather than read into the heap */
+} LbcFile;
+
+/*
+ * Opens the .lbc at 'path', NULL if the file doesn't start with LBC_MAGIC.  A file that
+ * does but is truncated, of another version or byte order or has sections out of bounds
+ * is an error.
+ */
+LbcFile*  lbcOpen(const char* path);
+
+/* lbcOpen that returns NULL for an invalid file as well */
+LbcFile*  lbcOpenValid(const char* path);
+void      lbcClose(LbcFile* file);
+
+/*
+ * The code of the file, which keeps it open until bytecodeFree, or closes it if the constant
+ * pool doesn't fit in the RAM.  The constant pool is stored in the RAM and $h set past it,
+ * and it is made read only if the Vm was configured to protect the constants, as compile
+ * does, or the file was assembled for a read only pool, whose constants may share a copy.
+ */
+Bytecode* lbcLoad(Vm* vm, LbcFile* file);
+
+struct DebugInfo;
+
+/*
+ * Writes the code assembled on the Vm, with the optional symbols and source lines, to
+ * 'path'.  Returns false if the file can't be written.
+ */
+int       lbcWrite(const char* path, Vm* vm, Bytecode* code, const struct DebugInfo* debug);
+
+/* the symbols and lines of the file, the DebugInfo is empty where the sections are missing */
+void      lbcReadDebug(LbcFile* file, struct DebugInfo* debug);
+
+#endif
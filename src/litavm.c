@@ -0,0 +1,207 @@
+#define _CRT_SECURE_NO_WARNINGS
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // mmap, memfd and signal extensions on POSIX systems
+#endif
+
+/*
+ * liblitavm, the whole VM as a single translation unit.  The litavm command builds it in,
+ * embedders compile it into a library, see the README.
+ */
+
+// standard includes
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <setjmp.h>
+
+// program includes
+#include "common.c"
+#include "buf.c"
+#include "bytecode.c"
+#include "assembler.c"
+#include "verifier.c"
+#include "heap.c"
+#include "output.c"
+#include "kernels.c"
+#include "vm.c"
+#include "jit.c"
+#include "syscalls.c"
+#include "lbc.c"
+#include "cache.c"
+
+#include "litavm.h"
+
+struct LitaVm {
+    Vm*           vm;
+    Bytecode*     code;   /* NULL until litavmLoad */
+    JitCode*      jit;    /* NULL if the code runs on the interpreter */
+    SyscallFiles* files;  /* NULL without LITAVM_STANDARD_SYSCALLS */
+    char*         source; /* the assembly litavmLoadFile is assembling */
+    int           useJit;
+    int           failed; /* a load failed, the LitaVm can only be destroyed */
+};
+
+/*
+ * Runs 'body' and returns LITAVM_OK, or the status of the error that ended it.  The errors
+ * of the VM and the assembler jump back here instead of exiting the process, see litaExit.
+ */
+static int litavmCall(LitaVm* lita, void (*body)(LitaVm* lita, const void* arg), const void* arg) {
+    jmp_buf* callerJump = litaErrorJump;
+    Output* runningOutput = vmRunningOutput;
+    VmInterpreterState* runningInterpreter = vmRunningInterpreter;
+    jmp_buf errorJump;
+    if(setjmp(errorJump)) {
+        // the error may have ended a vmExecute or jitExecute, which leave these set, the
+        // error has written the registers of the interpreter back to the Cpu32
+        litaErrorJump = callerJump;
+        vmRunningOutput = runningOutput;
+        vmRunningInterpreter = runningInterpreter;
+#if LITA_GUARDED_RAM
+        ramFaultRam = NULL;
+#endif
+        return litaErrorStatus;
+    }
+
+    litaErrorJump = &errorJump;
+    body(lita, arg);
+    litaErrorJump = callerJump;
+    return LITAVM_OK;
+}
+
+static void litavmInit(LitaVm* lita, const void* arg) {
+    const LitaVmConfig* config = (const LitaVmConfig*) arg;
+    uint32_t options = config->options;
+    VmConfig vmConfig;
+    vmConfig.ramSize = config->ramSize ? config->ramSize : 1024 * 1024;
+    vmConfig.stackSize = config->stackSize ? config->stackSize : 1024;
+    vmConfig.fuseInstructions = !(options & LITAVM_NO_FUSE);
+    vmConfig.traceLoops = (options & LITAVM_TRACE_LOOPS) != 0;
+    vmConfig.guardedRam = (options & LITAVM_GUARDED_RAM) != 0;
+    vmConfig.lazyRam = (options & LITAVM_LAZY_RAM) != 0;
+    vmConfig.hugePages = (options & LITAVM_HUGE_PAGES) != 0;
+    vmConfig.protectConstants = (options & LITAVM_PROTECT_CONSTANTS) != 0;
+    vmConfig.outputBufferSize = 0;
+
+    lita->vm = vmInit(&vmConfig);
+    lita->files = (options & LITAVM_STANDARD_SYSCALLS) ? syscallRegisterStandard(lita->vm) : NULL;
+    lita->useJit = (options & LITAVM_JIT) != 0;
+}
+
+LitaVm* litavmCreate(const LitaVmConfig* config) {
+    LitaVmConfig defaults = { 0, 0, 0 };
+    if(!config) {
+        config = &defaults;
+    }
+
+    LitaVm* lita = (LitaVm*) litaMalloc(sizeof(LitaVm));
+    memset(lita, 0, sizeof(LitaVm));
+    if(litavmCall(lita, litavmInit, config) != LITAVM_OK) {
+        litaFree(lita);
+        return NULL;
+    }
+    return lita;
+}
+
+/* the rest of the load once the code is in place */
+static void litavmPrepare(LitaVm* lita) {
+    vmDecode(lita->vm, lita->code);
+
+    // the RAM may move, the native code is compiled for where it ends up
+    vmSetResetPoint(lita->vm);
+    lita->jit = lita->useJit ? jitCompile(lita->vm, lita->code) : NULL;
+}
+
+static void litavmAssemble(LitaVm* lita, const void* assembly) {
+    lita->code = compile(lita->vm, (const char*) assembly);
+    litavmPrepare(lita);
+}
+
+static void litavmOpen(LitaVm* lita, const void* path) {
+    LbcFile* lbc = lbcOpen((const char*) path);
+    if(lbc) {
+        lita->code = lbcLoad(lita->vm, lbc);
+    }
+    else {
+        lita->source = readFile((const char*) path);
+        lita->code = compile(lita->vm, lita->source);
+        litaFree(lita->source);
+        lita->source = NULL;
+    }
+    litavmPrepare(lita);
+}
+
+/* a load into a LitaVm that can't take one */
+static int litavmLoadStatus(LitaVm* lita, void (*body)(LitaVm* lita, const void* arg), const void* arg) {
+    if(lita->code || lita->failed) {
+        return LITAVM_NOT_READY;
+    }
+
+    int status = litavmCall(lita, body, arg);
+    lita->failed = status != LITAVM_OK;
+    return status;
+}
+
+int litavmLoad(LitaVm* lita, const char* assembly) {
+    return litavmLoadStatus(lita, litavmAssemble, assembly);
+}
+
+int litavmLoadFile(LitaVm* lita, const char* path) {
+    return litavmLoadStatus(lita, litavmOpen, path);
+}
+
+static void litavmRun(LitaVm* lita, const void* arg) {
+    (void)arg;
+    if(lita->jit) {
+        jitExecute(lita->jit);
+    }
+    else {
+        vmExecute(lita->vm, lita->code);
+    }
+}
+
+int litavmExecute(LitaVm* lita) {
+    if(!lita->code || lita->failed) {
+        return LITAVM_NOT_READY;
+    }
+
+    int status = litavmCall(lita, litavmRun, NULL);
+    if(status != LITAVM_OK) {
+        // the run ended in the middle of vmExecute, which frees its loops when it returns
+        vmLoopsFree(lita->code, lita->vm->loops);
+        lita->vm->loops = NULL;
+    }
+    return status;
+}
+
+static void litavmRestore(LitaVm* lita, const void* arg) {
+    (void)arg;
+    vmReset(lita->vm);
+}
+
+int litavmReset(LitaVm* lita) {
+    if(lita->files) {
+        syscallFilesClose(lita->files);
+    }
+    if(!lita->code || lita->failed) {
+        return LITAVM_NOT_READY;
+    }
+    return litavmCall(lita, litavmRestore, NULL);
+}
+
+void litavmDestroy(LitaVm* lita) {
+    if(lita) {
+        jitFree(lita->jit);
+        bytecodeFree(lita->code);
+        syscallFilesFree(lita->files);
+        vmFree(lita->vm);
+        litaFree(lita->source);
+        litaFree(lita);
+    }
+}
+
+struct Vm* litavmVm(LitaVm* lita) {
+    return lita->vm;
+}
@@ -0,0 +1,81 @@
+#ifndef LITA_LITAVM_H
+#define LITA_LITAVM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The embedding API of liblitavm, for hosts that run programs in-process.  A LitaVm is a
+ * VM together with the program it runs.  It is loaded once, then executed and reset any
+ * number of times, and a reset only costs the pages the last run wrote, see vmReset.
+ *
+ * The header depends on nothing but the standard headers and LitaVm is opaque, so hosts
+ * built against it keep working as the VM changes.  Hosts that build the sources in can
+ * reach the full API of vm.h through litavmVm.
+ *
+ * Errors in the program and at run time print a message, as they do for the litavm
+ * command, and end the call with the status the command exits with instead of exiting.  A
+ * LitaVm whose run failed can be reset and executed again, one whose load failed can only
+ * be destroyed.  Each LitaVm is used by one thread at a time, any number of them can run
+ * on different threads.
+ */
+#define LITAVM_VERSION 1
+
+/* the statuses of the calls */
+#define LITAVM_OK              0
+#define LITAVM_FILE_ERROR      1   /* the file can't be read */
+#define LITAVM_RUNTIME_ERROR   2   /* an error at run time, or in verifying or loading the code */
+#define LITAVM_NOT_READY       3   /* a load with a program loaded, a run without one or a call after a failed load */
+#define LITAVM_ASSEMBLY_ERROR  32  /* the assembly doesn't assemble */
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define LITAVM_API __attribute__((visibility("default")))
+#else
+    #define LITAVM_API
+#endif
+
+/* the options of LitaVmConfig, the same as the litavm command's */
+#define LITAVM_JIT               0x01  /* --jit */
+#define LITAVM_TRACE_LOOPS       0x02  /* --trace-loops */
+#define LITAVM_GUARDED_RAM       0x04  /* --guarded-ram */
+#define LITAVM_LAZY_RAM          0x08  /* --lazy-ram */
+#define LITAVM_HUGE_PAGES        0x10  /* --huge-pages */
+#define LITAVM_PROTECT_CONSTANTS 0x20  /* --protect-constants */
+#define LITAVM_NO_FUSE           0x40  /* --no-fuse */
+#define LITAVM_STANDARD_SYSCALLS 0x80  /* registers the host functions of syscalls.h */
+
+typedef struct LitaVmConfig {
+    size_t   ramSize;     /* 0 for 1 MiB */
+    size_t   stackSize;   /* 0 for 1024 bytes */
+    uint32_t options;     /* LITAVM_* */
+} LitaVmConfig;
+
+typedef struct LitaVm LitaVm;
+
+/* a NULL config picks the defaults, returns NULL for a stack larger than the RAM */
+LITAVM_API LitaVm* litavmCreate(const LitaVmConfig* config);
+
+/*
+ * Assembles the program, stores its constants in the RAM and prepares it to run.  The
+ * state it leaves the VM in is what litavmReset goes back to.  Returns a LITAVM_* status.
+ */
+LITAVM_API int     litavmLoad(LitaVm* vm, const char* assembly);
+
+/* litavmLoad of the file at 'path', either assembly or an .lbc bytecode file, which is mapped instead of assembled */
+LITAVM_API int     litavmLoadFile(LitaVm* vm, const char* path);
+
+/* runs the loaded program from the start, the output is flushed when it returns.  Returns a LITAVM_* status */
+LITAVM_API int     litavmExecute(LitaVm* vm);
+
+/*
+ * Restores the RAM, the registers and the guest heap to the state litavmLoad left them in,
+ * and closes the files the program opened.  Returns a LITAVM_* status.
+ */
+LITAVM_API int     litavmReset(LitaVm* vm);
+
+LITAVM_API void    litavmDestroy(LitaVm* vm);
+
+/* the Vm of vm.h, to redirect the output or register host functions */
+LITAVM_API struct Vm* litavmVm(LitaVm* vm);
+
+#endif
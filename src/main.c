@@ -1,19 +1,6 @@
 //#define __USE_MINGW_ANSI_STDIO 1
-#define _CRT_SECURE_NO_WARNINGS
-
-// standard includes
-#include <stdlib.h>
-#include <stdarg.h>
-#include <stdio.h>
-#include <stdint.h>
-#include <string.h>
-
-// program includes
-#include "common.c"
-#include "buf.c"
-#include "bytecode.c"
-#include "assembler.c"
-#include "vm.c"
+// the VM, the same single translation unit liblitavm is built from
+#include "litavm.c"
 
 const char* USAGE =
 "<usage> litavm [options] file\n"
@@ -21,6 +8,20 @@ const char* USAGE =
         "  -d,--disassembly         Shows disassembly output\n"
         "  -s,--stack-size          Set the max stack size.  Defaults to 1024 bytes\n"
         "  -r,--ram                 Set the amount of RAM in bytes.  Defaults to 1 MiB\n"
+        "  -v,--verbose             Shows the dispatch engine and execution statistics\n"
+        "  --no-fuse                Disables fusing common instruction sequences into superinstructions\n"
+        "  --jit                    Compiles the code to native x86-64 code, falls back to the interpreter if it can't\n"
+        "  --trace-loops            Compiles the hot loops of the interpreted code into native x86-64 traces\n"
+        "  --guarded-ram            Reserves the 32-bit address space so out of range accesses fault instead of being checked\n"
+        "  --lazy-ram               Maps the RAM so only the pages that are used take up memory\n"
+        "  --huge-pages             Backs large mapped RAM by huge pages, implies --lazy-ram\n"
+        "  --protect-constants      Makes the constant pool read only, so constant loads are compiled into immediate values\n"
+        "  --emit                   Writes the assembled file to the .lbc bytecode file that follows instead of running it\n"
+        "  --cache                  Keeps the assembled programs in the directory that follows and loads them from there\n"
+        "                           instead of assembling them again.  Defaults to $LITAVM_CACHE, if it is set\n"
+        "  --cache-size             Set the size bound of the cache in bytes.  Defaults to 64 MiB\n"
+        "\n"
+        "The file is either assembly or an .lbc bytecode file written by --emit, which loads without assembling.\n"
         "\n\nExample:\n"
         "\tlitavm -d -s 4096 /scripts/hello.asm"
 ;        
@@ -34,9 +35,21 @@ int main(int argc, char** argv) {
     VmConfig config;
     config.ramSize = 1024 * 1024;
     config.stackSize = 1024;
+    config.fuseInstructions = 1;
+    config.traceLoops = 0;
+    config.guardedRam = 0;
+    config.lazyRam = 0;
+    config.hugePages = 0;
+    config.protectConstants = 0;
+    config.outputBufferSize = 0;
 
     int displayDisassembly = 0;
+    int verbose = 0;
+    int useJit = 0;
     const char* filename = NULL;
+    const char* emitFilename = NULL;
+    const char* cacheDir = getenv("LITAVM_CACHE");
+    uint64_t cacheSize = 0;
 
     for(int i = 1; i < argc; i++) {
         const char* arg = argv[i];
@@ -44,6 +57,30 @@ int main(int argc, char** argv) {
         if(!strcmp("-d", arg) || !strcmp("--disassembly", arg)) {
             displayDisassembly = 1;
         }
+        else if(!strcmp("-v", arg) || !strcmp("--verbose", arg)) {
+            verbose = 1;
+        }
+        else if(!strcmp("--no-fuse", arg)) {
+            config.fuseInstructions = 0;
+        }
+        else if(!strcmp("--jit", arg)) {
+            useJit = 1;
+        }
+        else if(!strcmp("--trace-loops", arg)) {
+            config.traceLoops = 1;
+        }
+        else if(!strcmp("--guarded-ram", arg)) {
+            config.guardedRam = 1;
+        }
+        else if(!strcmp("--lazy-ram", arg)) {
+            config.lazyRam = 1;
+        }
+        else if(!strcmp("--huge-pages", arg)) {
+            config.hugePages = 1;
+        }
+        else if(!strcmp("--protect-constants", arg)) {
+            config.protectConstants = 1;
+        }
         else if(!strcmp("-s", arg) || !strcmp("--stack-size", arg)) {
             if((i + 1) >= argc) {
                 vmError("Invalid number of parameters, must have a number after stack-size");
@@ -52,6 +89,27 @@ int main(int argc, char** argv) {
             config.stackSize = (size_t) strtol(param, NULL, 10);
             i++;
         }
+        else if(!strcmp("--emit", arg)) {
+            if((i + 1) >= argc) {
+                vmError("Invalid number of parameters, must have a file name after emit");
+            }
+            emitFilename = argv[i+1];
+            i++;
+        }
+        else if(!strcmp("--cache", arg)) {
+            if((i + 1) >= argc) {
+                vmError("Invalid number of parameters, must have a directory after cache");
+            }
+            cacheDir = argv[i+1];
+            i++;
+        }
+        else if(!strcmp("--cache-size", arg)) {
+            if((i + 1) >= argc) {
+                vmError("Invalid number of parameters, must have a number after cache-size");
+            }
+            cacheSize = (uint64_t) strtoull(argv[i+1], NULL, 10);
+            i++;
+        }
         else if(!strcmp("-r", arg) || !strcmp("--ram", arg)) {
             if((i + 1) >= argc) {
                 vmError("Invalid number of parameters, must have a number after ram");
@@ -70,19 +128,128 @@ int main(int argc, char** argv) {
         return 0;
     }
 
-    const char* assembly = readFile(filename);
-    
     Vm* vm = vmInit(&config);
-    Bytecode* code = compile(vm, assembly);
+    SyscallFiles* files = syscallRegisterStandard(vm);
+
+    // the names and lines are only kept for the disassembly and the .lbc
+    DebugInfo debug = { 0 };
+    int keepDebug = displayDisassembly || emitFilename;
+    Bytecode* code = NULL;
+    CompileCache* cache = NULL;
+    LbcFile* lbc = lbcOpen(filename);
+    if(lbc) {
+        if(keepDebug) {
+            lbcReadDebug(lbc, &debug);
+        }
+        code = lbcLoad(vm, lbc);
+    }
+    else {
+        char* assembly = readFile(filename);
+        cache = cacheDir && *cacheDir ? cacheInit(cacheDir, cacheSize) : NULL;
+        if(cache) {
+            code = cacheCompile(cache, vm, assembly, keepDebug ? &debug : NULL);
+        }
+        else {
+            code = keepDebug ? compileDebug(vm, assembly, &debug) : compile(vm, assembly);
+        }
+        litaFree(assembly);
+    }
+
+    if(emitFilename) {
+        if(!lbcWrite(emitFilename, vm, code, &debug)) {
+            vmError("Unable to write the bytecode file '%s'", emitFilename);
+        }
+        if(displayDisassembly) {
+            disassemble(code, &debug);
+        }
+
+        debugInfoFree(&debug);
+        bytecodeFree(code);
+        syscallFilesFree(files);
+        vmFree(vm);
+        return 0;
+    }
+
+    vmDecode(vm, code);
 
     if(displayDisassembly) {
-        disassemble(code);
+        disassemble(code, &debug);
     }
+    debugInfoFree(&debug);
     
-    vmExecute(vm, code);
+    JitCode* jit = useJit ? jitCompile(vm, code) : NULL;
+
+    clock_t start = clock();
+    if(jit) {
+        jitExecute(jit);
+    }
+    else {
+        vmExecute(vm, code);
+    }
+    clock_t end = clock();
+
+    if(verbose && jit) {
+        double seconds = (double)(end - start) / CLOCKS_PER_SEC;
+        printf("\nExecution: jit (%llu bytes of native code)\n", (unsigned long long)jit->size);
+        printf("Executed in %.3f seconds\n", seconds);
+    }
+    else if(verbose) {
+        double seconds = (double)(end - start) / CLOCKS_PER_SEC;
+        if(useJit) {
+            printf("\nThe code could not be compiled to native code, it ran on the interpreter");
+        }
+        printf("\nDispatch: %s\n", vmDispatchMode());
+        printf("Executed %llu instructions in %.3f seconds", 
+            (unsigned long long)vm->instructionCount, seconds);
+        if(seconds > 0) {
+            printf(" (%.2f million instructions per second)", (vm->instructionCount / seconds) / 1000000.0);
+        }
+        printf("\n");
+        printf("Dispatched %llu handlers, %llu dispatches saved by superinstructions\n",
+            (unsigned long long)vm->dispatchCount, 
+            (unsigned long long)(vm->instructionCount - vm->tracedCount - vm->dispatchCount));
+        if(config.traceLoops) {
+            printf("Compiled %u loop traces, %llu instructions ran in native traces\n",
+                vm->traceCount, (unsigned long long)vm->tracedCount);
+        }
+    }
+
+    if(verbose && cache) {
+        printf("Compile cache: %llu hits, %llu misses, %llu evictions, %llu failed writes\n",
+            (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+            (unsigned long long)cache->evictions, (unsigned long long)cache->failedWrites);
+    }
+
+    if(verbose) {
+        printf("RAM: %llu KiB resident of %llu KiB configured (%s)\n",
+            (unsigned long long)(ramResidentSize(vm->ram) / 1024),
+            (unsigned long long)(vm->ram->size / 1024),
+            vm->ram->guarded ? "guarded" : vm->ram->mapping ? "mapped" : "heap");
+        printf("Stack: %llu bytes at peak, of %llu bytes\n",
+            (unsigned long long)(vm->stackTop - vm->stackPeak),
+            (unsigned long long)(vm->stackTop - vm->stackLimit));
+    }
+
+    if(verbose && vm->heap) {
+        Heap* heap = vm->heap;
+        HeapStats* stats = &heap->stats;
+        uint64_t freeBytes = heapFreeBytes(heap);
+        printf("Heap: %llu allocations, %llu frees, %llu reallocations, %llu failed allocations\n",
+            (unsigned long long)stats->allocCount, (unsigned long long)stats->freeCount,
+            (unsigned long long)stats->reallocCount, (unsigned long long)stats->failedCount);
+        printf("Heap: %llu bytes in use, %llu bytes at peak, of %llu bytes\n",
+            (unsigned long long)stats->usedBytes, (unsigned long long)stats->peakUsedBytes,
+            (unsigned long long)heap->numOfPages * HEAP_PAGE_SIZE);
+        printf("Heap fragmentation: %.1f%% of the slab memory is unused, %.1f%% of the free memory is outside the largest free run\n",
+            stats->slabBytes ? 100.0 * (stats->slabBytes - stats->slabUsedBytes) / stats->slabBytes : 0.0,
+            freeBytes ? 100.0 * (freeBytes - heapLargestFreeBytes(heap)) / freeBytes : 0.0);
+    }
 
+    jitFree(jit);
     bytecodeFree(code);
+    cacheFree(cache);
 
+    syscallFilesFree(files);
     vmFree(vm);
     return 0;
 }
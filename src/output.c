@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "output.h"
+#include "buf.h"
+#include "common.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <unistd.h>
+    #include <errno.h>
+    #define OUTPUT_WRITE_FD(fd, bytes, len) write((fd), (bytes), (len))
+#elif defined(_WIN32)
+    #include <io.h>
+    #define OUTPUT_WRITE_FD(fd, bytes, len) _write((fd), (bytes), (unsigned int)MIN((len), (size_t)INT32_MAX))
+#endif
+
+Output* outputInit(size_t bufferSize) {
+    Output* output = (Output*) litaMalloc(sizeof(Output));
+    memset(output, 0, sizeof(Output));
+    output->size = bufferSize ? bufferSize : OUTPUT_DEFAULT_BUFFER_SIZE;
+    output->buffer = (char*) litaMalloc(output->size);
+    output->sink = OUTPUT_STREAM;
+    output->stream = stdout;
+    output->fd = -1;
+    return output;
+}
+
+void outputFree(Output* output) {
+    if(output) {
+        outputFlush(output);
+        buf_free(output->captured);
+        litaFree(output->buffer);
+        litaFree(output);
+    }
+}
+
+/* hands the bytes to the sink, a host write error drops them like printf would */
+static void outputSink(Output* output, const char* bytes, size_t len) {
+    output->flushCount++;
+    switch(output->sink) {
+        case OUTPUT_STREAM: {
+            fwrite(bytes, 1, len, output->stream);
+            break;
+        }
+        case OUTPUT_FD: {
+#ifdef OUTPUT_WRITE_FD
+            while(len) {
+                long written = (long)OUTPUT_WRITE_FD(output->fd, bytes, len);
+                if(written < 0) {
+#if defined(__unix__) || defined(__APPLE__)
+                    if(errno == EINTR) {
+                        continue;
+                    }
+#endif
+                    break;
+                }
+                bytes += written;
+                len -= (size_t)written;
+            }
+#endif
+            break;
+        }
+        case OUTPUT_CAPTURE: {
+            buf_fit(output->captured, buf_len(output->captured) + len);
+            memcpy(output->captured + buf_len(output->captured), bytes, len);
+            buf__hdr(output->captured)->len += len;
+            break;
+        }
+        case OUTPUT_CALLBACK: {
+            output->callback(output->context, bytes, len);
+            break;
+        }
+    }
+}
+
+void outputFlush(Output* output) {
+    if(output->len) {
+        outputSink(output, output->buffer, output->len);
+        output->len = 0;
+    }
+    if(output->sink == OUTPUT_STREAM) {
+        fflush(output->stream);
+    }
+}
+
+void outputToStream(Output* output, FILE* stream) {
+    outputFlush(output);
+    output->sink = OUTPUT_STREAM;
+    output->stream = stream;
+}
+
+void outputToFd(Output* output, int fd) {
+    outputFlush(output);
+    output->sink = OUTPUT_FD;
+    output->fd = fd;
+}
+
+void outputToCapture(Output* output) {
+    outputFlush(output);
+    output->sink = OUTPUT_CAPTURE;
+}
+
+void outputToCallback(Output* output, OutputCallback callback, void* context) {
+    outputFlush(output);
+    output->sink = OUTPUT_CALLBACK;
+    output->callback = callback;
+    output->context = context;
+}
+
+const char* outputCaptured(Output* output, size_t* len) {
+    outputFlush(output);
+    *len = buf_len(output->captured);
+    return output->captured ? output->captured : "";
+}
+
+void outputWrite(Output* output, const char* bytes, size_t len) {
+    if(len > output->size - output->len) {
+        outputFlush(output);
+        // what doesn't fit in the empty buffer skips it
+        if(len >= output->size) {
+            outputSink(output, bytes, len);
+            return;
+        }
+    }
+
+    memcpy(output->buffer + output->len, bytes, len);
+    output->len += len;
+}
+
+#ifndef LITA_PRINTF_FORMAT
+/* the two digit decimal numbers from 00 to 99, back to back */
+static const char outputDigitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static size_t outputNumOfDigits(uint64_t value) {
+    size_t digits = 1;
+    uint64_t limit = 10;
+    while(digits < 20 && value >= limit) {
+        digits++;
+        limit *= 10;
+    }
+    return digits;
+}
+
+/* writes the 'digits' last decimal digits of value, two at a time from the right */
+static void outputDigits(char* text, uint64_t value, size_t digits) {
+    char* end = text + digits;
+    while(end - text >= 2) {
+        const char* pair = &outputDigitPairs[(value % 100) * 2];
+        value /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    if(end != text) {
+        *--end = (char)('0' + value % 10);
+    }
+}
+
+/* formats like printf's "%d" */
+static size_t outputFormatInt(char* text, int32_t value) {
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    size_t len = value < 0;
+    size_t digits = outputNumOfDigits(magnitude);
+
+    text[0] = '-';
+    outputDigits(text + len, magnitude, digits);
+    return len + digits;
+}
+
+/*
+ * Formats like printf's "%f" does in the default rounding mode: the exact value of the float
+ * rounded to 6 decimals, ties to even.  The value is mantissa * 2^shift, so the fraction is
+ * at most 24 bits and its millionths fit in 64 bits.  Returns 0 for the values it leaves to
+ * snprintf, the infinities, the NaNs and the magnitudes from 2^64 on.
+ */
+static size_t outputFormatFloat(char* text, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+    if(exponent >= 127 + 64) {
+        return 0;
+    }
+    if(exponent) {
+        mantissa |= 0x800000;
+    }
+    else {
+        exponent = 1;
+    }
+
+    int shift = (int)exponent - 127 - 23;
+    uint64_t whole = 0;
+    uint64_t millionths = 0;
+    if(shift >= 0) {
+        whole = (uint64_t)mantissa << shift;
+    }
+    else {
+        int bitsOfFraction = -shift;
+        whole = bitsOfFraction < 32 ? mantissa >> bitsOfFraction : 0;
+        uint64_t fraction = bitsOfFraction < 32 ? mantissa & ((1u << bitsOfFraction) - 1) : mantissa;
+        uint64_t scaled = fraction * 1000000;
+        // from 64 bits of fraction on the millionths are below a half and round to 0
+        if(bitsOfFraction < 64) {
+            uint64_t half = 1ull << (bitsOfFraction - 1);
+            uint64_t rest = scaled & ((half << 1) - 1);
+            millionths = scaled >> bitsOfFraction;
+            if(rest > half || (rest == half && (millionths & 1))) {
+                millionths++;
+            }
+            if(millionths == 1000000) {
+                whole++;
+                millionths = 0;
+            }
+        }
+    }
+
+    size_t len = bits >> 31;
+    size_t digits = outputNumOfDigits(whole);
+    text[0] = '-';
+    outputDigits(text + len, whole, digits);
+    len += digits;
+    text[len++] = '.';
+    outputDigits(text + len, millionths, 6);
+    return len + 6;
+}
+
+/* room for 'len' more bytes in the buffer, NULL if the buffer is smaller than that */
+static char* outputReserve(Output* output, size_t len) {
+    if(len > output->size - output->len) {
+        outputFlush(output);
+        if(len > output->size) {
+            return NULL;
+        }
+    }
+    return output->buffer + output->len;
+}
+
+#endif
+
+/* the numbers are formatted straight into the buffer, unless LITA_PRINTF_FORMAT picks snprintf */
+void outputInt(Output* output, int32_t value) {
+#ifdef LITA_PRINTF_FORMAT
+    char text[16];
+    int len = snprintf(text, sizeof(text), "%d", value);
+    outputWrite(output, text, (size_t)len);
+#else
+    char* text = outputReserve(output, OUTPUT_MAX_INT_LEN);
+    if(text) {
+        output->len += outputFormatInt(text, value);
+    }
+    else {
+        char small[OUTPUT_MAX_INT_LEN];
+        outputWrite(output, small, outputFormatInt(small, value));
+    }
+#endif
+}
+
+void outputFloat(Output* output, float value) {
+#ifndef LITA_PRINTF_FORMAT
+    char* text = outputReserve(output, OUTPUT_MAX_FLOAT_LEN);
+    if(text) {
+        size_t len = outputFormatFloat(text, value);
+        if(len) {
+            output->len += len;
+            return;
+        }
+    }
+#endif
+    // FLT_MAX has 39 digits, plus the sign, point and 6 decimals
+    char small[64];
+    int len = snprintf(small, sizeof(small), "%f", value);
+    outputWrite(output, small, (size_t)len);
+}
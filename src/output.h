@@ -0,0 +1,79 @@
+#ifndef LITA_OUTPUT_H
+#define LITA_OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The console device behind the PRINT opcodes.  Every Vm owns one, the printed bytes
+ * collect in its buffer and only reach the sink when the buffer is full, on FLUSH and
+ * when vmExecute returns, so printing a string a character at a time costs a copy per
+ * character instead of a stdio call.  The sink is either:
+ *
+ *   OUTPUT_STREAM    a host FILE*, stdout by default, written with a single fwrite
+ *   OUTPUT_FD        a host file descriptor
+ *   OUTPUT_CAPTURE   a growing in-memory buffer, see outputCaptured
+ *   OUTPUT_CALLBACK  a host function
+ *
+ * Nothing is shared between the devices, Vms that capture or call back never take the
+ * lock of stdout.
+ */
+#define OUTPUT_DEFAULT_BUFFER_SIZE (16 * 1024)
+
+/* the longest "%d" of an int32, and of a float below 2^64 with "%f" */
+#define OUTPUT_MAX_INT_LEN   11
+#define OUTPUT_MAX_FLOAT_LEN 28
+
+typedef enum OutputSink {
+    OUTPUT_STREAM,
+    OUTPUT_FD,
+    OUTPUT_CAPTURE,
+    OUTPUT_CALLBACK,
+} OutputSink;
+
+typedef void (*OutputCallback)(void* context, const char* bytes, size_t len);
+
+typedef struct Output {
+    char*  buffer;
+    size_t len;
+    size_t size;              /* of the buffer, at least 1 */
+
+    OutputSink sink;
+    FILE*  stream;            /* OUTPUT_STREAM */
+    int    fd;                /* OUTPUT_FD */
+    char*  captured;          /* buf, OUTPUT_CAPTURE */
+    OutputCallback callback;  /* OUTPUT_CALLBACK */
+    void*  context;
+
+    uint64_t flushCount;      /* writes to the sink */
+} Output;
+
+/* a device writing to stdout, 'bufferSize' 0 picks OUTPUT_DEFAULT_BUFFER_SIZE */
+Output* outputInit(size_t bufferSize);
+
+/* flushes the buffered bytes */
+void    outputFree(Output* output);
+
+/* the buffered bytes go to the old sink before the sink changes */
+void    outputToStream(Output* output, FILE* stream);
+void    outputToFd(Output* output, int fd);
+void    outputToCapture(Output* output);
+void    outputToCallback(Output* output, OutputCallback callback, void* context);
+
+/* everything captured so far, flushed first and not 0 terminated, it stays valid until the next write */
+const char* outputCaptured(Output* output, size_t* len);
+
+void    outputFlush(Output* output);
+void    outputWrite(Output* output, const char* bytes, size_t len);
+void    outputInt(Output* output, int32_t value);
+void    outputFloat(Output* output, float value);
+
+inline static void outputChar(Output* output, char c) {
+    if(output->len == output->size) {
+        outputFlush(output);
+    }
+    output->buffer[output->len++] = c;
+}
+
+#endif
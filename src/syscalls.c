@@ -0,0 +1,163 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "syscalls.h"
+#include "vm.h"
+#include "buf.h"
+#include "common.h"
+
+static void syscallHash(Vm* vm, Register* regs, void* context) {
+    (void)context;
+    Address len = regs[REG_B].as.address;
+    const uint8_t* bytes = (const uint8_t*) vmSyscallArray(vm, regs[REG_A].as.address, len);
+
+    uint32_t hash = 2166136261u;
+    for(Address i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    regs[REG_A].as.iVal = (int32_t)hash;
+}
+
+static void syscallParseInt(Vm* vm, Register* regs, void* context) {
+    (void)context;
+    Address address = regs[REG_A].as.address;
+    const char* str = vmSyscallArray(vm, address, 0);
+    // up to the end of the guest's reach, see CHECK_RANGE
+    size_t limit = vm->ram->size - 1 - address;
+
+    size_t i = 0;
+    int negative = limit > 0 && str[0] == '-';
+    i += negative;
+
+    uint32_t value = 0;
+    size_t digits = i;
+    while(i < limit && str[i] >= '0' && str[i] <= '9') {
+        value = value * 10 + (uint32_t)(str[i] - '0');
+        i++;
+    }
+    // a lone '-' isn't a number, nothing is parsed
+    if(i == digits) {
+        i = 0;
+    }
+
+    regs[REG_A].as.iVal = (int32_t)(negative ? 0u - value : value);
+    regs[REG_B].as.address = address + (Address)i;
+}
+
+/* the string at the address, NULL if it runs past the end of the guest's reach */
+static const char* syscallString(Vm* vm, Address address) {
+    const char* str = vmSyscallArray(vm, address, 0);
+    return memchr(str, 0, vm->ram->size - 1 - address) ? str : NULL;
+}
+
+/* the open file of the handle, NULL if there is none */
+static FILE* syscallFile(SyscallFiles* files, Register handle) {
+    return handle.as.address < buf_len(files->files) ? files->files[handle.as.address] : NULL;
+}
+
+static void syscallOpen(Vm* vm, Register* regs, void* context) {
+    SyscallFiles* files = (SyscallFiles*) context;
+    static const char* modes[] = { "rb", "wb", "ab" };
+    const char* path = syscallString(vm, regs[REG_A].as.address);
+    Address mode = regs[REG_B].as.address;
+
+    FILE* file = path && mode < 3 ? fopen(path, modes[mode]) : NULL;
+    if(!file) {
+        regs[REG_A].as.iVal = -1;
+        return;
+    }
+    setvbuf(file, NULL, _IOFBF, SYSCALL_FILE_BUFFER_SIZE);
+
+    // the lowest free handle
+    Address handle = 0;
+    while(handle < buf_len(files->files) && files->files[handle]) {
+        handle++;
+    }
+    if(handle == buf_len(files->files)) {
+        buf_push(files->files, NULL);
+    }
+    files->files[handle] = file;
+    regs[REG_A].as.address = handle;
+}
+
+static void syscallRead(Vm* vm, Register* regs, void* context) {
+    FILE* file = syscallFile((SyscallFiles*) context, regs[REG_A]);
+    Address len = regs[REG_C].as.address;
+    if(!file) {
+        regs[REG_A].as.iVal = -1;
+        return;
+    }
+
+    size_t read = fread(vmSyscallWritableArray(vm, regs[REG_B].as.address, len), 1, len, file);
+    regs[REG_A].as.iVal = (read < len && ferror(file)) ? -1 : (int32_t)read;
+}
+
+static void syscallWrite(Vm* vm, Register* regs, void* context) {
+    FILE* file = syscallFile((SyscallFiles*) context, regs[REG_A]);
+    Address len = regs[REG_C].as.address;
+    if(!file) {
+        regs[REG_A].as.iVal = -1;
+        return;
+    }
+
+    size_t written = fwrite(vmSyscallArray(vm, regs[REG_B].as.address, len), 1, len, file);
+    regs[REG_A].as.iVal = written < len ? -1 : (int32_t)written;
+}
+
+static void syscallClose(Vm* vm, Register* regs, void* context) {
+    (void)vm;
+    SyscallFiles* files = (SyscallFiles*) context;
+    FILE* file = syscallFile(files, regs[REG_A]);
+    if(!file) {
+        regs[REG_A].as.iVal = -1;
+        return;
+    }
+
+    files->files[regs[REG_A].as.address] = NULL;
+    regs[REG_A].as.iVal = fclose(file) ? -1 : 0;
+}
+
+static void syscallMap(Vm* vm, Register* regs, void* context) {
+    (void)context;
+    const char* path = syscallString(vm, regs[REG_A].as.address);
+    Address address = regs[REG_B].as.address;
+    Address loaded = 0;
+    if(!path || !ramMapFile(vm->ram, path, &address, regs[REG_C].as.address, &loaded)) {
+        regs[REG_A].as.iVal = -1;
+        return;
+    }
+
+    regs[REG_A].as.address = address;
+    regs[REG_B].as.address = loaded;
+}
+
+SyscallFiles* syscallRegisterStandard(Vm* vm) {
+    SyscallFiles* files = (SyscallFiles*) litaMalloc(sizeof(SyscallFiles));
+    files->files = NULL;
+
+    vmRegisterSyscall(vm, SYSCALL_HASH, syscallHash, NULL);
+    vmRegisterSyscall(vm, SYSCALL_PARSEI, syscallParseInt, NULL);
+    vmRegisterSyscall(vm, SYSCALL_OPEN, syscallOpen, files);
+    vmRegisterSyscall(vm, SYSCALL_READ, syscallRead, files);
+    vmRegisterSyscall(vm, SYSCALL_WRITE, syscallWrite, files);
+    vmRegisterSyscall(vm, SYSCALL_CLOSE, syscallClose, files);
+    vmRegisterSyscall(vm, SYSCALL_MAP, syscallMap, NULL);
+    return files;
+}
+
+void syscallFilesFree(SyscallFiles* files) {
+    if(files) {
+        syscallFilesClose(files);
+        buf_free(files->files);
+        litaFree(files);
+    }
+}
+
+void syscallFilesClose(SyscallFiles* files) {
+    for(size_t i = 0; i < buf_len(files->files); i++) {
+        if(files->files[i]) {
+            fclose(files->files[i]);
+            files->files[i] = NULL;
+        }
+    }
+}
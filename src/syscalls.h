@@ -0,0 +1,46 @@
+#ifndef LITA_SYSCALLS_H
+#define LITA_SYSCALLS_H
+
+#include <stdio.h>
+#include "vm.h"
+
+/*
+ * The standard host functions of SYSCALL, the litavm executable registers them on its Vm.
+ * Embedders register them with syscallRegisterStandard, next to their own functions,
+ * which should then take numbers from SYSCALL_FIRST_FREE on.
+ *
+ * The file functions return -1 in $a when the host call fails.  They move the bytes
+ * straight between the file and the guest's RAM, through a SYSCALL_FILE_BUFFER_SIZE
+ * stdio buffer that reads larger than it bypass.
+ */
+typedef enum SyscallNumber {
+    SYSCALL_HASH,    // 32 bit FNV-1a hash of the $b bytes at address $a => $a = hash
+    SYSCALL_PARSEI,  // Parses the decimal int at address $a, with an optional '-' => $a = value, $b = address past the digits
+
+    SYSCALL_OPEN,    // Opens the file named by the string at address $a, $b = 0 to read, 1 to write, 2 to append => $a = handle
+    SYSCALL_READ,    // Reads up to $c bytes of the file $a to address $b => $a = bytes read, 0 at the end of the file
+    SYSCALL_WRITE,   // Writes the $c bytes at address $b to the file $a => $a = bytes written
+    SYSCALL_CLOSE,   // Closes the file $a => $a = 0
+    SYSCALL_MAP,     // Loads the file named by the string at address $a into the $c bytes at address $b, see ramMapFile => $a = address of the data, $b = its length
+
+    SYSCALL_FIRST_FREE
+} SyscallNumber;
+
+#define SYSCALL_FILE_BUFFER_SIZE (1024 * 1024)
+
+/* the files the guest opened, the handles are indexes into them */
+typedef struct SyscallFiles {
+    FILE** files;  /* buf, NULL once closed */
+} SyscallFiles;
+
+/* 
+ * the file functions share the returned files with the Vm's forks, it must be freed with
+ * syscallFilesFree, which closes what the guest left open, once they are done
+ */
+SyscallFiles* syscallRegisterStandard(Vm* vm);
+void          syscallFilesFree(SyscallFiles* files);
+
+/* closes what the guest left open, the handles start over from 0 */
+void          syscallFilesClose(SyscallFiles* files);
+
+#endif
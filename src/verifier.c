@@ -0,0 +1,122 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "verifier.h"
+#include "vm.h"
+#include "common.h"
+
+static int verifyFail(VerifyError* error, Address pc, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+
+    error->pc = pc;
+    return 0;
+}
+
+/* whether the instruction stores into its first argument, the IFs only compare it */
+static int verifyWritesArg1(Opcode opcode) {
+    switch(opcode) {
+        case IFI: case IFF: case IFB:
+        case IFEI: case IFEF: case IFEB:
+        case MEMCPY: case MEMSET:
+        case VADDI: case VADDF: case VSUBI: case VSUBF: case VMULI: case VMULF:
+        case VMINI: case VMINF: case VMAXI: case VMAXF: case VFMAI: case VFMAF:
+            return 0;
+        default:
+            return opcodeNumArgs(opcode) > 1;
+    }
+}
+
+int verify(Bytecode* code, VerifyError* error) {
+    int writesReturn = 0;
+
+    for(Address i = 0; i < code->length; i++) {
+        Instruction instr = code->instrs[i];
+        Opcode opcode = OPCODE(instr);
+        if(opcode >= MAX_OPCODES || !OpcodeStr[opcode]) {
+            return verifyFail(error, i, "Unknown opcode: %d", opcode);
+        }
+
+        Arg2Type arg2Type = opcodeArg2Type(opcode);
+        Address arg1 = ARG1_VALUE(instr);
+        Address arg2 = ARG2_VALUE(instr);
+
+        // the extended opcodes always have a first argument, see OPCODE_EXT
+        if((opcodeNumArgs(opcode) > 1 || arg2Type == ARG2_EXT_REGS) && arg1 >= MAX_REGISTERS) {
+            return verifyFail(error, i, "Invalid register index '%d' for opcode: '%s'", arg1, OpcodeStr[opcode]);
+        }
+
+        // mirrors how vmDecode reads the second argument
+        int isConstant = 0;
+        switch(arg2Type) {
+            case ARG2_NONE: {
+                break;
+            }
+            case ARG2_VALUE_INT:
+            case ARG2_VALUE_FLOAT: {
+                if(IS_ARG2_REG(instr)) {
+                    if(arg2 >= MAX_REGISTERS) {
+                        return verifyFail(error, i, "Invalid register index '%d' for opcode: '%s'", arg2, OpcodeStr[opcode]);
+                    }
+                }
+                else {
+                    isConstant = !IS_ARG2_IMM(instr) || arg2Type == ARG2_VALUE_FLOAT;
+                }
+                break;
+            }
+            case ARG2_CONST_INT: {
+                isConstant = !IS_ARG2_IMM(instr);
+                break;
+            }
+            case ARG2_CONST_FLOAT:
+            case ARG2_CONST_ADDR: {
+                isConstant = 1;
+                break;
+            }
+            case ARG2_DEST_REG: {
+                if(arg2 >= MAX_REGISTERS) {
+                    return verifyFail(error, i, "Invalid register index '%d' for opcode: '%s'", arg2, OpcodeStr[opcode]);
+                }
+
+                writesReturn |= (arg2 == REG_R && !IS_ARG1_ADDR(instr));
+                break;
+            }
+            case ARG2_EXT_REGS: {
+                if(IS_ARG1_ADDR(instr)) {
+                    return verifyFail(error, i, "Invalid address argument for opcode: '%s'", OpcodeStr[opcode]);
+                }
+
+                Address arg3 = EXT_ARG3_VALUE(instr);
+                Address arg4 = EXT_ARG4_VALUE(instr);
+                arg2 = EXT_ARG2_VALUE(instr);
+                if(arg2 >= MAX_REGISTERS || arg3 >= MAX_REGISTERS || arg4 >= MAX_REGISTERS) {
+                    return verifyFail(error, i, "Invalid register index '%d' for opcode: '%s'", 
+                        MAX(MAX(arg2, arg3), arg4), OpcodeStr[opcode]);
+                }
+                break;
+            }
+            case ARG2_TARGET: {
+                // the end of the program is a valid target, it halts
+                Address target = ARG_JMP_VALUE(instr);
+                if(target > code->length) {
+                    return verifyFail(error, i, "Invalid jump target '%d' for opcode: '%s'", target, OpcodeStr[opcode]);
+                }
+                break;
+            }
+        }
+
+        if(isConstant && arg2 >= code->numOfConstants) {
+            return verifyFail(error, i, "Invalid constant index '%d' for opcode: '%s'", arg2, OpcodeStr[opcode]);
+        }
+
+        writesReturn |= (verifyWritesArg1(opcode) && arg1 == REG_R && !IS_ARG1_ADDR(instr));
+        // a host function may write any register
+        writesReturn |= (opcode == SYSCALL);
+    }
+
+    code->verified = VERIFIED_CODE | (writesReturn ? 0 : VERIFIED_RETURNS);
+    return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "bytecode.h"
+
+/*
+ * The properties verify proves about a Bytecode, stored in Bytecode.verified.  The
+ * decoder and interpreter rely on these instead of validating the operands as they
+ * run, so every Bytecode is verified before it is decoded.
+ */
+#define VERIFIED_CODE     0x1  /* every opcode, register, constant index and jump target is valid */
+#define VERIFIED_RETURNS  0x2  /* $r is only written by CALL, so it only ever holds a return index */
+
+typedef struct VerifyError {
+    Address pc;           /* index of the offending instruction */
+    char    message[128];
+} VerifyError;
+
+/* checks every instruction once, returns false and fills in the error for the first invalid one */
+int verify(Bytecode* code, VerifyError* error);
+
+#endif
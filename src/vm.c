@@ -5,16 +5,102 @@
 #include <string.h>
 
 #include "vm.h"
+#include "jit.h"
+#include "verifier.h"
+#include "heap.h"
+#include "kernels.h"
+#include "output.h"
+#include "buf.h"
 #include "common.h"
 
+/*
+ * The interpreter dispatch engine is picked at build time.  GCC and Clang support
+ * labels as values, which allows each opcode handler to jump directly to the handler
+ * of the next instruction (direct threading) instead of funneling every instruction
+ * through the single indirect branch of the switch.  Define LITA_SWITCH_DISPATCH to
+ * force the portable switch loop.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(LITA_SWITCH_DISPATCH)
+    #define LITA_THREADED_DISPATCH 1
+#else
+    #define LITA_THREADED_DISPATCH 0
+#endif
+
+/* tells the compiler a code path is never taken, such as an opcode verify rejects */
+#if defined(__GNUC__) || defined(__clang__)
+    #define VM_UNREACHABLE() __builtin_unreachable()
+#elif defined(_MSC_VER)
+    #define VM_UNREACHABLE() __assume(0)
+#else
+    #define VM_UNREACHABLE() ((void)0)
+#endif
+
+/*
+ * Guarded RAM needs a 64 bit address space to reserve the guest address space in, and
+ * signals to catch the faulting accesses with.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+    #define LITA_MAPPED_RAM 1
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#else
+    #define LITA_MAPPED_RAM 0
+#endif
+
+/* snapshots keep their RAM in a memfd, which forks map copy-on-write */
+#if LITA_MAPPED_RAM && defined(__linux__)
+    #define LITA_COW_SNAPSHOTS 1
+#else
+    #define LITA_COW_SNAPSHOTS 0
+#endif
+
+#if LITA_MAPPED_RAM && UINTPTR_MAX > 0xffffffffu
+    #define LITA_GUARDED_RAM 1
+    #include <signal.h>
+    #include <setjmp.h>
+#else
+    #define LITA_GUARDED_RAM 0
+#endif
+
+/* the console device of the thread's running vmExecute or jitExecute, the errors flush it first */
+static LITA_THREAD_LOCAL Output* vmRunningOutput = NULL;
+
+/* 
+ * The locals the thread's running guarded RAM interpreter keeps the guest registers and its
+ * record in, so a fault of its unchecked accesses can still leave an exact Cpu32 behind, see
+ * vmSyncInterpreter.  The checked interpreter writes them back itself before it fails.
+ */
+typedef struct VmInterpreterState {
+    Cpu32*         cpu;
+    Register*      regs;  /* NULL while the Cpu32 is the one up to date, around traces and host functions */
+    DecodedInstr** rec;
+} VmInterpreterState;
+
+static LITA_THREAD_LOCAL VmInterpreterState* vmRunningInterpreter = NULL;
+
+/* writes the registers and the $pc of the running interpreter back to its Cpu32 */
+static void vmSyncInterpreter(void) {
+    VmInterpreterState* state = vmRunningInterpreter;
+    if(state && state->regs) {
+        memcpy(state->cpu->regs, state->regs, sizeof(Register) * MAX_REGISTERS);
+        state->cpu->pc.as.address = (*state->rec)->pc;
+    }
+}
+
 static void vmError(const char* format, ...) {
+    vmSyncInterpreter();
+    if(vmRunningOutput) {
+        outputFlush(vmRunningOutput);
+    }
+
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
     va_end(args);
     fputs("\n", stderr);
 
-    exit(2);
+    litaExit(2);
 }
 
 
@@ -23,53 +109,337 @@ Ram* ramInit(size_t size) {
     Ram* ram = (Ram*) mem;
     ram->size = size;
     ram->mem = mem + sizeof(Ram);
+    ram->mapping = NULL;
+    ram->mappingSize = 0;
+    ram->guarded = 0;
+    ram->readOnly = 0;
+    ram->image = 0;
+    ram->fileMapped = 0;
+
+    return ram;
+}
+
+#if LITA_MAPPED_RAM
+/* the untouched pages don't count against the commit limit, where the OS supports it */
+#ifdef MAP_NORESERVE
+    #define RAM_MAP_NORESERVE MAP_NORESERVE
+#else
+    #define RAM_MAP_NORESERVE 0
+#endif
+
+/* RAM this large is worth backing by huge pages, the usual x86-64 and arm64 huge page size */
+#define RAM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static size_t ramPageSize(void) {
+    return (size_t) sysconf(_SC_PAGESIZE);
+}
+
+/* 
+ * the bytes in front of guarded RAM, which puts the last byte, the one CHECK_RANGE never
+ * lets the guest reach, at the start of a page
+ */
+static size_t ramLeadSize(size_t size) {
+    size_t accessible = size - 1;
+    return ALIGN_UP(accessible, ramPageSize()) - accessible;
+}
+
+/* asks for transparent huge pages, the kernel falls back to normal pages on its own */
+static void ramAdviseHugePages(char* mem, size_t size) {
+#ifdef MADV_HUGEPAGE
+    char* start = (char*) ALIGN_UP_PTR(mem, RAM_HUGE_PAGE_SIZE);
+    char* end = (char*) ALIGN_DOWN_PTR(mem + size, RAM_HUGE_PAGE_SIZE);
+    if(start < end) {
+        madvise(start, (size_t)(end - start), MADV_HUGEPAGE);
+    }
+#else
+    (void)mem;
+    (void)size;
+#endif
+}
+
+Ram* ramInitMapped(size_t size, int hugePages) {
+    size_t mappingSize = ALIGN_UP(MAX(size, (size_t)1), ramPageSize());
+    char* mapping = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    // reserved huge pages are only there if the administrator set some aside
+    if(hugePages && size >= RAM_HUGE_PAGE_SIZE) {
+        size_t hugeSize = ALIGN_UP(size, (size_t)RAM_HUGE_PAGE_SIZE);
+        mapping = (char*) mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(mapping != MAP_FAILED) {
+            mappingSize = hugeSize;
+            hugePages = 0;
+        }
+    }
+#endif
+
+    if(mapping == MAP_FAILED) {
+        mapping = (char*) mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS | RAM_MAP_NORESERVE, -1, 0);
+        if(mapping == MAP_FAILED) {
+            return NULL;
+        }
+    }
+
+    if(hugePages && size >= RAM_HUGE_PAGE_SIZE) {
+        ramAdviseHugePages(mapping, mappingSize);
+    }
+
+    Ram* ram = (Ram*) litaMalloc(sizeof(Ram));
+    ram->size = size;
+    ram->mem = mapping;
+    ram->mapping = mapping;
+    ram->mappingSize = mappingSize;
+    ram->guarded = 0;
+    ram->readOnly = 0;
+    ram->image = 0;
+    ram->fileMapped = 0;
+
+    return ram;
+}
+#else
+Ram* ramInitMapped(size_t size, int hugePages) {
+    (void)size;
+    (void)hugePages;
+    return NULL;
+}
+#endif
+
+#if LITA_GUARDED_RAM
+/* the guarded RAM of the thread's running vmExecute, its faults jump back to ramFaultJump */
+static LITA_THREAD_LOCAL Ram* volatile ramFaultRam = NULL;
+static LITA_THREAD_LOCAL volatile Address ramFaultAddress = 0;
+static LITA_THREAD_LOCAL sigjmp_buf ramFaultJump;
+
+/* the handlers the host had before ramInstallFaultHandler, they get the faults that aren't guest accesses */
+static struct sigaction ramPreviousSegv;
+static struct sigaction ramPreviousBus;
+
+static void ramFaultHandler(int signum, siginfo_t* info, void* context) {
+    Ram* ram = ramFaultRam;
+    char* address = (char*) info->si_addr;
+    if(ram && address >= ram->mem && address < ram->mapping + ram->mappingSize) {
+        // the interpreter's frame is gone once the handler jumps
+        ramFaultAddress = (Address)(address - ram->mem);
+        vmSyncInterpreter();
+        siglongjmp(ramFaultJump, 1);
+    }
+
+    const struct sigaction* previous = signum == SIGBUS ? &ramPreviousBus : &ramPreviousSegv;
+    if(previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(signum, info, context);
+    }
+    else if(previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN) {
+        previous->sa_handler(signum);
+    }
+    else {
+        // the retried access gets the default action
+        sigaction(signum, previous, NULL);
+    }
+}
+
+static void ramInstallFaultHandler(void) {
+    static int installed = 0;
+    if(installed) {
+        return;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = ramFaultHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    // some systems report accesses to PROT_NONE pages as SIGBUS, a Vm created on another
+    // thread at the same time may have installed the handler already
+    struct sigaction previous;
+    sigaction(SIGSEGV, &action, &previous);
+    if(!(previous.sa_flags & SA_SIGINFO) || previous.sa_sigaction != ramFaultHandler) {
+        ramPreviousSegv = previous;
+    }
+    sigaction(SIGBUS, &action, &previous);
+    if(!(previous.sa_flags & SA_SIGINFO) || previous.sa_sigaction != ramFaultHandler) {
+        ramPreviousBus = previous;
+    }
+    installed = 1;
+}
+
+/* 
+ * guarded RAM from the first 'committed' bytes of the file if 'fd' is valid, see 
+ * ramInitImage, otherwise from anonymous memory
+ */
+static Ram* ramMapGuarded(size_t size, int hugePages, int fd) {
+    if(!size || size > ((size_t)1 << 32)) {
+        return NULL;
+    }
+
+    size_t pageSize = ramPageSize();
+    size_t offset = ramLeadSize(size);
+    size_t committed = offset + size - 1;
+
+    // any 32 bit address, plus the bytes a 4 byte access at the last one reaches
+    size_t reservedSize = offset + ((size_t)1 << 32) + pageSize;
+    char* reserved = (char*) mmap(NULL, reservedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(reserved == MAP_FAILED) {
+        return NULL;
+    }
+
+    int failed = 0;
+    if(committed && fd >= 0) {
+        failed = mmap(reserved, committed, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED;
+    }
+    else if(committed) {
+        failed = mprotect(reserved, committed, PROT_READ | PROT_WRITE) != 0;
+    }
+
+    if(failed) {
+        munmap(reserved, reservedSize);
+        return NULL;
+    }
+
+    if(hugePages && committed >= RAM_HUGE_PAGE_SIZE) {
+        ramAdviseHugePages(reserved, committed);
+    }
+
+    ramInstallFaultHandler();
+
+    Ram* ram = (Ram*) litaMalloc(sizeof(Ram));
+    ram->size = size;
+    ram->mem = reserved + offset;
+    ram->mapping = reserved;
+    ram->mappingSize = reservedSize;
+    ram->guarded = 1;
+    ram->readOnly = 0;
+    ram->image = fd >= 0;
+    ram->fileMapped = 0;
 
     return ram;
 }
 
+Ram* ramInitGuarded(size_t size, int hugePages) {
+    return ramMapGuarded(size, hugePages, -1);
+}
+#else
+Ram* ramInitGuarded(size_t size, int hugePages) {
+    (void)size;
+    (void)hugePages;
+    return NULL;
+}
+#endif
+
+#if LITA_COW_SNAPSHOTS
+/* 
+ * RAM mapped copy-on-write from an image file laid out like guarded RAM, with 
+ * ramLeadSize bytes in front of the RAM, see vmSnapshot
+ */
+static Ram* ramInitImage(size_t size, int guarded, int fd) {
+#if LITA_GUARDED_RAM
+    if(guarded) {
+        Ram* ram = ramMapGuarded(size, 0, fd);
+        if(ram) {
+            return ram;
+        }
+    }
+#else
+    (void)guarded;
+#endif
+
+    size_t offset = ramLeadSize(size);
+    size_t mappingSize = ALIGN_UP(offset + size, ramPageSize());
+    char* mapping = (char*) mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    Ram* ram = (Ram*) litaMalloc(sizeof(Ram));
+    ram->size = size;
+    ram->mem = mapping + offset;
+    ram->mapping = mapping;
+    ram->mappingSize = mappingSize;
+    ram->guarded = 0;
+    ram->readOnly = 0;
+    ram->image = 1;
+    ram->fileMapped = 0;
+
+    return ram;
+}
+#endif
+
 
 void ramFree(Ram* ram) {
     if(ram) {
+#if LITA_MAPPED_RAM
+        if(ram->mapping) {
+            munmap(ram->mapping, ram->mappingSize);
+        }
+#endif
         litaFree(ram);
     }
 }
 
+
 #define CHECK_RANGE(ram, startAddress, endAddress)                                  \
     do {                                                                            \
-        if( (startAddress) < 0 || ((startAddress) + (endAddress)) >= (ram)->size) { \
+        if(((startAddress) + (endAddress)) >= (ram)->size) {                        \
             vmError("Access violation error at address '0x%x' to '0x%x' \n",        \
                 (startAddress), ((startAddress) + (endAddress)) );                  \
-            exit(42);                                                               \
         }                                                                           \
     } while(0)
 
-void ramStoreString(Ram* ram, Address address, const char* value, size_t len) {
+/* 
+ * CHECK_RANGE for the stores, which also fail below ram->readOnly.  It is still a single
+ * unsigned compare, the addresses below the read only ones wrap around past the RAM.
+ */
+#define CHECK_STORE_RANGE(ram, startAddress, len)                                   \
+    do {                                                                            \
+        if((uint64_t)(Address)((startAddress) - (ram)->readOnly) + (len) >=         \
+            (ram)->size - (ram)->readOnly) {                                        \
+            ramStoreError((ram), (startAddress), (len));                            \
+        }                                                                           \
+    } while(0)
+
+LITA_COLD static void ramStoreError(Ram* ram, Address address, size_t len) {
+    if(address < ram->readOnly) {
+        vmError("Access violation error at address '0x%x', the constants below '0x%x' are read only \n",
+            address, ram->readOnly);
+    }
+    CHECK_RANGE(ram, address, len);
+}
+
+/* the error of a load out of the RAM, it returns an address for the range checks of the interpreter */
+LITA_COLD static Address ramRangeError(Ram* ram, Address address, size_t len) {
     CHECK_RANGE(ram, address, len);
+    return address;
+}
+
+void ramStoreString(Ram* ram, Address address, const char* value, size_t len) {
+    CHECK_STORE_RANGE(ram, address, len);
 
     memcpy(ram->mem + address, value, len);
     ram->mem[address + len] = 0;
 }
 
 void ramStoreBytes(Ram* ram, Address address, const char* value, size_t len) {
-    CHECK_RANGE(ram, address, len);
+    CHECK_STORE_RANGE(ram, address, len);
 
     memcpy(ram->mem + address, value, len);
 }
 
 void ramStoreInt32(Ram* ram, Address address, int32_t value) {
-    CHECK_RANGE(ram, address, sizeof(value));
+    CHECK_STORE_RANGE(ram, address, sizeof(value));
 
     memcpy(ram->mem + address, &value, sizeof(value));
 }
 
 void ramStoreFloat(Ram* ram, Address address, float value) {
-    CHECK_RANGE(ram, address, sizeof(value));
+    CHECK_STORE_RANGE(ram, address, sizeof(value));
 
     memcpy(ram->mem + address, &value, sizeof(value));
 }
 
 void ramStoreInt8(Ram* ram, Address address, int8_t value) {
-    CHECK_RANGE(ram, address, sizeof(value));
+    CHECK_STORE_RANGE(ram, address, sizeof(value));
 
     memcpy(ram->mem + address, &value, sizeof(value));
 }
@@ -77,6 +447,73 @@ void ramStoreInt8(Ram* ram, Address address, int8_t value) {
 
 
 
+/* 
+ * The C library versions of these pick SSE2/AVX2 (or wider) kernels for the host CPU at
+ * run time and fall back to scalar code elsewhere.
+ */
+void ramCopy(Ram* ram, Address to, Address from, size_t len) {
+    CHECK_STORE_RANGE(ram, to, len);
+    CHECK_RANGE(ram, from, len);
+
+    memmove(ram->mem + to, ram->mem + from, len);
+}
+
+void ramFill(Ram* ram, Address address, int8_t value, size_t len) {
+    CHECK_STORE_RANGE(ram, address, len);
+
+    memset(ram->mem + address, (uint8_t)value, len);
+}
+
+int ramCompare(Ram* ram, Address a, Address b, size_t len) {
+    CHECK_RANGE(ram, a, len);
+    CHECK_RANGE(ram, b, len);
+
+    int result = memcmp(ram->mem + a, ram->mem + b, len);
+    return (result > 0) - (result < 0);
+}
+
+/* the host address of the array of 'len' 4 byte elements at the address, checked once */
+static char* ramArray(Ram* ram, Address address, Address len) {
+    CHECK_RANGE(ram, address, (size_t)len * 4);
+    return ram->mem + address;
+}
+
+/* ramArray of an array that is written to */
+static char* ramWritableArray(Ram* ram, Address address, Address len) {
+    CHECK_STORE_RANGE(ram, address, (size_t)len * 4);
+    return ram->mem + address;
+}
+
+/* the bytes from the address to the end of the guest's reach, see CHECK_RANGE */
+static size_t ramStringLimit(Ram* ram, Address address) {
+    CHECK_RANGE(ram, address, 0);
+    return ram->size - 1 - address;
+}
+
+Address ramStringLength(Ram* ram, Address address) {
+    size_t len = kernelStrLen(ram->mem + address, ramStringLimit(ram, address));
+    CHECK_RANGE(ram, address, len + 1); // fails if there is no terminator
+
+    return (Address)len;
+}
+
+int ramStringCompare(Ram* ram, Address a, Address b) {
+    size_t limitA = ramStringLimit(ram, a);
+    size_t limitB = ramStringLimit(ram, b);
+    size_t at = kernelStrDiff(ram->mem + a, ram->mem + b, MIN(limitA, limitB));
+    CHECK_RANGE(ram, limitA < limitB ? a : b, at + 1);
+
+    int result = (uint8_t)ram->mem[a + at] - (uint8_t)ram->mem[b + at];
+    return (result > 0) - (result < 0);
+}
+
+Address ramStringFind(Ram* ram, Address address, int8_t value) {
+    size_t at = kernelStrChr(ram->mem + address, (char)value, ramStringLimit(ram, address));
+    CHECK_RANGE(ram, address, at + 1);
+
+    return ram->mem[address + at] == (char)value ? address + (Address)at : 0;
+}
+
 size_t ramReadBytes(Ram* ram, Address address, char* value, size_t len) {
     CHECK_RANGE(ram, address, len);
 
@@ -112,9 +549,147 @@ int8_t ramReadInt8(Ram* ram, Address address) {
     return result;
 }
 
+/*
+ * Accesses without the range check, these are only used on guarded RAM where an out
+ * of range access faults, and on the stack, whose bounds the interpreter checks
+ */
+inline static void ramUncheckedStoreInt32(char* mem, Address address, int32_t value) {
+    memcpy(mem + address, &value, sizeof(value));
+}
+
+inline static void ramUncheckedStoreFloat(char* mem, Address address, float value) {
+    memcpy(mem + address, &value, sizeof(value));
+}
+
+inline static void ramUncheckedStoreInt8(char* mem, Address address, int8_t value) {
+    memcpy(mem + address, &value, sizeof(value));
+}
+
+inline static int32_t ramUncheckedReadInt32(char* mem, Address address) {
+    int32_t result;
+    memcpy(&result, mem + address, sizeof(result));
+    return result;
+}
+
+inline static float ramUncheckedReadFloat(char* mem, Address address) {
+    float result;
+    memcpy(&result, mem + address, sizeof(result));
+    return result;
+}
+
+inline static int8_t ramUncheckedReadInt8(char* mem, Address address) {
+    int8_t result;
+    memcpy(&result, mem + address, sizeof(result));
+    return result;
+}
+
+
+void ramDiscard(Ram* ram, Address address, size_t len) {
+    CHECK_RANGE(ram, address, len);
+
+    char* start = ram->mem + address;
+    char* end = start + len;
+#if LITA_MAPPED_RAM
+    // private anonymous pages read back as zeros once they are dropped, image pages
+    // and the pages of mapped files would read back the file
+    if(ram->mapping && !ram->image && !ram->fileMapped) {
+        size_t pageSize = ramPageSize();
+        char* first = (char*) ALIGN_UP_PTR(start, pageSize);
+        char* last = (char*) ALIGN_DOWN_PTR(end, pageSize);
+        if(first < last && !madvise(first, (size_t)(last - first), MADV_DONTNEED)) {
+            memset(start, 0, (size_t)(first - start));
+            memset(last, 0, (size_t)(end - last));
+            return;
+        }
+    }
+#endif
+    memset(start, 0, len);
+}
+
+int ramMapFile(Ram* ram, const char* path, Address* address, Address len, Address* loaded) {
+    CHECK_STORE_RANGE(ram, *address, len);
+
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        return 0;
+    }
+
+    char* start = ram->mem + *address;
+    char* end = start + len;
+    size_t mapped = 0;
+#if LITA_MAPPED_RAM
+    struct stat info;
+    size_t pageSize = ramPageSize();
+    char* first = (char*) ALIGN_UP_PTR(start, pageSize);
+    if(ram->mapping && first < end && !fstat(fileno(file), &info)) {
+        size_t pages = ALIGN_DOWN(MIN((uint64_t)info.st_size, (uint64_t)(end - first)), pageSize);
+        // MAP_FIXED replaces the RAM pages, the data is only read when the guest touches it
+        if(pages && mmap(first, pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, 
+                fileno(file), 0) != MAP_FAILED) {
+            ram->fileMapped = 1;
+            start = first;
+            mapped = pages;
+            fseeko(file, (off_t)pages, SEEK_SET);
+        }
+    }
+#endif
+
+    size_t read = fread(start + mapped, 1, (size_t)(end - start) - mapped, file);
+    fclose(file);
+
+    *address = (Address)(start - ram->mem);
+    *loaded = (Address)(mapped + read);
+    return 1;
+}
+
+size_t ramResidentSize(Ram* ram) {
+#if LITA_MAPPED_RAM
+    // only the pages the guest can reach, the rest of a guarded mapping is never committed
+    size_t pageSize = ramPageSize();
+    char* first = (char*) ALIGN_DOWN_PTR(ram->mem, pageSize);
+    char* last = (char*) ALIGN_UP_PTR(ram->mem + ram->size, pageSize);
+
+    size_t numOfPages = (size_t)(last - first) / pageSize;
+#ifdef __APPLE__
+    char* pages = (char*) litaMalloc(numOfPages);
+#else
+    unsigned char* pages = (unsigned char*) litaMalloc(numOfPages);
+#endif
+    size_t resident = ram->size;
+    if(!mincore(first, (size_t)(last - first), pages)) {
+        resident = 0;
+        for(size_t i = 0; i < numOfPages; i++) {
+            resident += (pages[i] & 1) * pageSize;
+        }
+    }
+
+    litaFree(pages);
+    return MIN(resident, ram->size);
+#else
+    return ram->size;
+#endif
+}
+
+
+const char* RegisterNames[] = {
+    "$sp",
+    "$pc",
+    "$r",
+    "$h",
+    "$a",
+    "$b",
+    "$c",
+    "$d",
+    "$i",
+    "$j",
+    "$k",
+    "$u",
+    NULL
+};
 
 Cpu32* cpuInit() {
     Cpu32* cpu = (Cpu32*) litaMalloc(sizeof(Cpu32));
+    memset(cpu, 0, sizeof(Cpu32));
     return cpu;
 }
 void   cpuFree(Cpu32* cpu) {
@@ -164,578 +739,1107 @@ int    cpuGetRegisterIndex(const char* name) {
     return -1;
 }
 
+static Vm* vmNew(Ram* ram, size_t stackSize, int fuseInstructions, int traceLoops, int protectConstants,
+    size_t outputBufferSize) {
+    Vm* vm = (Vm*) litaMalloc(sizeof(Vm));
+    vm->ram = ram;
+    vm->cpu = cpuInit();
+    vm->stackSize = stackSize;
+    // the top byte is out of the guest's reach, see CHECK_RANGE
+    vm->stackTop = ram->size ? (Address)(ram->size - 1) : 0;
+    vm->stackLimit = vm->stackTop - (Address)MIN(stackSize, (size_t)vm->stackTop);
+    vm->stackSpan = vm->stackTop - vm->stackLimit;
+    vm->stackPeak = vm->stackTop;
+    vm->fuseInstructions = fuseInstructions;
+    vm->traceLoops = traceLoops;
+    vm->protectConstants = protectConstants;
+    vm->loops = NULL;
+    vm->heap = NULL;
+    vm->output = outputInit(outputBufferSize);
+    vm->syscalls = NULL;
+    vm->resetPoint = NULL;
+    vm->instructionCount = 0;
+    vm->dispatchCount = 0;
+    vm->tracedCount = 0;
+    vm->traceCount = 0;
+
+    return vm;
+}
+
 Vm*  vmInit(VmConfig* config) {
     if(config->stackSize > config->ramSize) {
         vmError("Invalid VM configuration the stack size (%d) is greater than the RAM size (%d)",
             config->stackSize, config->ramSize);
     }
 
-    Ram* ram = ramInit(config->ramSize);
-    Cpu32* cpu = cpuInit();
-
-    Vm* vm = (Vm*) litaMalloc(sizeof(Vm));
-    vm->ram = ram;
-    vm->cpu = cpu;
-    vm->stackSize = config->stackSize;
+    Ram* ram = NULL;
+    if(config->guardedRam) {
+        ram = ramInitGuarded(config->ramSize, config->hugePages);
+    }
+    if(!ram && (config->lazyRam || config->hugePages)) {
+        ram = ramInitMapped(config->ramSize, config->hugePages);
+    }
+    if(!ram) {
+        ram = ramInit(config->ramSize);
+    }
 
-    cpu->sp.as.address = config->ramSize - 1;
+    Vm* vm = vmNew(ram, config->stackSize, config->fuseInstructions, config->traceLoops, 
+        config->protectConstants, config->outputBufferSize);
+    vm->cpu->sp.as.address = vm->stackTop;
     return vm;
 }
 
 
+void vmProtectConstants(Vm* vm, Address end) {
+    // the last byte is out of the guest's reach anyway, see CHECK_RANGE
+    Ram* ram = vm->ram;
+    ram->readOnly = (Address)MIN((size_t)end, ram->size ? ram->size - 1 : 0);
+
+    if(vm->stackLimit < ram->readOnly) {
+        vm->stackLimit = MIN(ram->readOnly, vm->stackTop);
+        vm->stackSpan = vm->stackTop - vm->stackLimit;
+    }
+}
+
+int vmRegisterSyscall(Vm* vm, uint32_t number, VmSyscall function, void* context) {
+    if(number >= VM_MAX_SYSCALLS) {
+        return 0;
+    }
+
+    size_t len = buf_len(vm->syscalls);
+    if(number >= len) {
+        buf_fit(vm->syscalls, number + 1);
+        memset(vm->syscalls + len, 0, (number + 1 - len) * sizeof(VmSyscallEntry));
+        buf__hdr(vm->syscalls)->len = number + 1;
+    }
+
+    vm->syscalls[number] = (VmSyscallEntry){ .function = function, .context = context };
+    return 1;
+}
+
+char* vmSyscallArray(Vm* vm, Address address, size_t len) {
+    CHECK_RANGE(vm->ram, address, len);
+    return vm->ram->mem + address;
+}
+
+char* vmSyscallWritableArray(Vm* vm, Address address, size_t len) {
+    CHECK_STORE_RANGE(vm->ram, address, len);
+    return vm->ram->mem + address;
+}
+
+/* SYSCALL, the handler gets the registers the interpreter or native code is running on */
+static void vmSyscall(Vm* vm, Register* regs, uint32_t number) {
+    VmSyscallEntry* entry = number < buf_len(vm->syscalls) ? &vm->syscalls[number] : NULL;
+    if(!entry || !entry->function) {
+        vmError("Invalid syscall number '%u', no host function is registered for it \n", number);
+    }
+
+    entry->function(vm, regs, entry->context);
+}
+
+static void vmResetPointFree(struct VmResetPoint* point);
+
 void vmFree(Vm* vm) {
     if(vm) {
+        outputFree(vm->output);
+        buf_free(vm->syscalls);
+        vmResetPointFree(vm->resetPoint);
         cpuFree(vm->cpu);
         ramFree(vm->ram);
+        heapFree(vm->heap);
         litaFree(vm);
     }
 }
 
-inline static int32_t getArg2Int32(Vm* vm, Bytecode* code, Instruction instr) {
-    Ram* ram = vm->ram;
-    Cpu32* cpu = vm->cpu;
+#if LITA_COW_SNAPSHOTS
+/* writes the RAM into the image file, the all zero chunks are left as holes that read back as zeros */
+static int vmWriteImage(const char* mem, size_t size, int fd, size_t offset) {
+    const size_t chunkSize = 64 * 1024;
+    for(size_t at = 0; at < size; at += chunkSize) {
+        size_t len = MIN(chunkSize, size - at);
+        const char* chunk = mem + at;
+        if(!chunk[0] && !memcmp(chunk, chunk + 1, len - 1)) {
+            continue;
+        }
 
-    if(IS_ARG2_REG(instr)) {
-        return (IS_ARG2_ADDR(instr)) 
-            ? ramReadInt32(ram, cpu->regs[ARG2_VALUE(instr)].as.address)    
-            : cpu->regs[ARG2_VALUE(instr)].as.iVal;
+        if(pwrite(fd, chunk, len, (off_t)(offset + at)) != (ssize_t)len) {
+            return 0;
+        }
     }
 
-    return IS_ARG2_IMM(instr) 
-        ? ARG2_VALUE(instr)
-        : ramReadInt32(ram, code->constants[ARG2_VALUE(instr)]);
+    return 1;
 }
+#endif
+
+VmSnapshot* vmSnapshot(Vm* vm, Bytecode* code) {
+    vmDecode(vm, code);
+
+    VmSnapshot* snapshot = (VmSnapshot*) litaMalloc(sizeof(VmSnapshot));
+    snapshot->code = code;
+    snapshot->cpu = *vm->cpu;
+    snapshot->ramSize = vm->ram->size;
+    snapshot->guardedRam = vm->ram->guarded;
+    snapshot->stackSize = vm->stackSize;
+    snapshot->fuseInstructions = vm->fuseInstructions;
+    snapshot->traceLoops = vm->traceLoops;
+    snapshot->readOnly = vm->ram->readOnly;
+    snapshot->outputBufferSize = vm->output->size;
+    snapshot->heap = vm->heap ? heapClone(vm->heap) : NULL;
+    snapshot->syscalls = NULL;
+    for(size_t i = 0; i < buf_len(vm->syscalls); i++) {
+        buf_push(snapshot->syscalls, vm->syscalls[i]);
+    }
+    snapshot->fd = -1;
+    snapshot->image = NULL;
+
+    // the last byte is out of the guest's reach, see CHECK_RANGE, and past the end of guarded RAM
+    size_t accessible = vm->ram->size ? vm->ram->size - 1 : 0;
+
+#if LITA_COW_SNAPSHOTS
+    int fd = accessible ? memfd_create("litavm-snapshot", MFD_CLOEXEC) : -1;
+    if(fd >= 0) {
+        size_t offset = ramLeadSize(vm->ram->size);
+        size_t imageSize = ALIGN_UP(offset + vm->ram->size, ramPageSize());
+        if(!ftruncate(fd, (off_t)imageSize) && vmWriteImage(vm->ram->mem, accessible, fd, offset)) {
+            snapshot->fd = fd;
+            return snapshot;
+        }
 
-
-inline static int8_t getArg2Int8(Vm* vm, Bytecode* code, Instruction instr) {
-    Ram* ram = vm->ram;
-    Cpu32* cpu = vm->cpu;
-
-    if(IS_ARG2_REG(instr)) {
-        return (IS_ARG2_ADDR(instr)) 
-            ? ramReadInt8(ram, cpu->regs[ARG2_VALUE(instr)].as.address)    
-            : cpu->regs[ARG2_VALUE(instr)].as.bVal;
+        close(fd);
     }
+#endif
 
-    return IS_ARG2_IMM(instr) 
-        ? ARG2_VALUE(instr)
-        : ramReadInt8(ram, code->constants[ARG2_VALUE(instr)]);
+    snapshot->image = (char*) litaMalloc(MAX(accessible, (size_t)1));
+    memcpy(snapshot->image, vm->ram->mem, accessible);
+    return snapshot;
 }
 
+Vm* vmFork(VmSnapshot* snapshot) {
+    Ram* ram = NULL;
+    if(snapshot->image) {
+        ram = snapshot->guardedRam ? ramInitGuarded(snapshot->ramSize, 0) : NULL;
+        if(!ram) {
+            ram = ramInit(snapshot->ramSize);
+        }
 
-inline static float getArg2Float(Vm* vm, Bytecode* code, Instruction instr) {
-    Ram* ram = vm->ram;
-    Cpu32* cpu = vm->cpu;
+        memcpy(ram->mem, snapshot->image, snapshot->ramSize ? snapshot->ramSize - 1 : 0);
+    }
+#if LITA_COW_SNAPSHOTS
+    else {
+        ram = ramInitImage(snapshot->ramSize, snapshot->guardedRam, snapshot->fd);
+        if(!ram) {
+            vmError("Unable to map the RAM of the VM snapshot");
+        }
+    }
+#endif
 
-    if(IS_ARG2_REG(instr)) {
-        return (IS_ARG2_ADDR(instr)) 
-            ? ramReadFloat(ram, cpu->regs[ARG2_VALUE(instr)].as.address)    
-            : cpu->regs[ARG2_VALUE(instr)].as.fVal;
+    Vm* vm = vmNew(ram, snapshot->stackSize, snapshot->fuseInstructions, snapshot->traceLoops,
+        snapshot->readOnly != 0, snapshot->outputBufferSize);
+    *vm->cpu = snapshot->cpu;
+    if(snapshot->readOnly) {
+        vmProtectConstants(vm, snapshot->readOnly);
+    }
+    vm->heap = snapshot->heap ? heapClone(snapshot->heap) : NULL;
+    for(size_t i = 0; i < buf_len(snapshot->syscalls); i++) {
+        buf_push(vm->syscalls, snapshot->syscalls[i]);
     }
+    return vm;
+}
 
-    return ramReadFloat(ram, code->constants[ARG2_VALUE(instr)]);
+void vmSnapshotFree(VmSnapshot* snapshot) {
+    if(snapshot) {
+#if LITA_COW_SNAPSHOTS
+        if(snapshot->fd >= 0) {
+            close(snapshot->fd);
+        }
+#endif
+        heapFree(snapshot->heap);
+        buf_free(snapshot->syscalls);
+        litaFree(snapshot->image);
+        litaFree(snapshot);
+    }
 }
 
+/* the state of vmSetResetPoint */
+typedef struct VmResetPoint {
+    Cpu32  cpu;
+    struct Heap* heap;    /* a copy of the guest heap, NULL if there was none */
+
+    int    fd;            /* the memfd the RAM is mapped from, -1 if there is none */
+    char*  pages;         /* the pages of the RAM the guest can reach, mapped from the memfd */
+    size_t pagesSize;
+    char*  image;         /* the copy of the RAM if there is no memfd */
+} VmResetPoint;
+
+static void vmResetPointFree(VmResetPoint* point) {
+    if(point) {
+#if LITA_COW_SNAPSHOTS
+        if(point->fd >= 0) {
+            close(point->fd);
+        }
+#endif
+        heapFree(point->heap);
+        litaFree(point->image);
+        litaFree(point);
+    }
+}
 
-void vmExecute(Vm* vm, Bytecode* code) {
-    Cpu32* cpu = vm->cpu;
+#if LITA_COW_SNAPSHOTS
+/* moves the RAM into a memfd laid out like the image of vmSnapshot and maps it from there */
+static int vmMapResetImage(Vm* vm, VmResetPoint* point) {
     Ram* ram = vm->ram;
+    size_t accessible = ram->size ? ram->size - 1 : 0;
+    int fd = accessible ? memfd_create("litavm-reset", MFD_CLOEXEC) : -1;
+    if(fd < 0) {
+        return 0;
+    }
 
-    if(!code->length || !code->instrs) {
+    size_t offset = ramLeadSize(ram->size);
+    size_t imageSize = ALIGN_UP(offset + ram->size, ramPageSize());
+    Ram* image = NULL;
+    if(!ftruncate(fd, (off_t)imageSize) && vmWriteImage(ram->mem, accessible, fd, offset)) {
+        image = ramInitImage(ram->size, ram->guarded, fd);
+    }
+
+    if(!image) {
+        close(fd);
+        return 0;
+    }
+
+    image->readOnly = ram->readOnly;
+    ramFree(ram);
+    vm->ram = image;
+
+    point->fd = fd;
+    point->pages = image->mem - offset;
+    point->pagesSize = offset + accessible;
+    return 1;
+}
+#endif
+
+void vmSetResetPoint(Vm* vm) {
+    vmResetPointFree(vm->resetPoint);
+
+    VmResetPoint* point = (VmResetPoint*) litaMalloc(sizeof(VmResetPoint));
+    point->cpu = *vm->cpu;
+    point->heap = vm->heap ? heapClone(vm->heap) : NULL;
+    point->fd = -1;
+    point->pages = NULL;
+    point->pagesSize = 0;
+    point->image = NULL;
+    vm->resetPoint = point;
+
+#if LITA_COW_SNAPSHOTS
+    if(vmMapResetImage(vm, point)) {
         return;
     }
+#endif
 
-#define INSTR_AT(index) (&code->instrs[(index)])
+    size_t accessible = vm->ram->size ? vm->ram->size - 1 : 0;
+    point->image = (char*) litaMalloc(MAX(accessible, (size_t)1));
+    memcpy(point->image, vm->ram->mem, accessible);
+}
 
-#define SET_ARG1_INT(instr,value)                                                 \
-    SET_ARG1_INT_ARG(instr, ARG1_VALUE(instr), value)
+void vmReset(Vm* vm) {
+    VmResetPoint* point = vm->resetPoint;
+    if(!point) {
+        vmError("Unable to reset the VM, it has no reset point");
+    }
 
+    Ram* ram = vm->ram;
+#if LITA_COW_SNAPSHOTS
+    if(point->fd >= 0) {
+        // dropping the private copies of the written pages reads the image back into them,
+        // the untouched pages have no copies and cost nothing.  The pages ramMapFile mapped
+        // from other files are mapped from the image again.
+        int failed = 0;
+        if(ram->fileMapped) {
+            failed = mmap(point->pages, point->pagesSize, PROT_READ | PROT_WRITE, 
+                MAP_PRIVATE | MAP_FIXED, point->fd, 0) == MAP_FAILED;
+            ram->fileMapped = 0;
+        }
+        else {
+            failed = madvise(point->pages, point->pagesSize, MADV_DONTNEED) != 0;
+        }
 
-#define SET_ARG1_INT_ARG(instr,argValue,value)                                    \
-    do {                                                                          \
-        if (IS_ARG1_ADDR(instr))                                                  \
-            ramStoreInt32(ram, cpu->regs[(argValue)].as.address,(value));         \
-        else cpu->regs[(argValue)].as.iVal = (value);                             \
-    } while(0)
+        if(failed) {
+            vmError("Unable to map the RAM of the VM reset point");
+        }
+    }
+    else
+#endif
+    {
+        memcpy(ram->mem, point->image, ram->size ? ram->size - 1 : 0);
+    }
 
+    *vm->cpu = point->cpu;
+    heapFree(vm->heap);
+    vm->heap = point->heap ? heapClone(point->heap) : NULL;
+}
 
-#define SET_ARG1_FLOAT(instr,value)                                               \
-    SET_ARG1_FLOAT_ARG(instr,ARG1_VALUE(instr), value)
+/*
+ * The guest heap of ALLOC, FREE and REALLOC.  It is set up by the first ALLOC and spans
+ * from where $h points at that moment, past the constants unless the guest moved it, to 
+ * the bottom of the stack.  It never starts below read only constants.
+ */
+static Heap* vmHeap(Vm* vm, Address heapStart) {
+    if(!vm->heap) {
+        vm->heap = heapInit(MAX(heapStart, vm->ram->readOnly), vm->stackLimit);
+    }
 
-#define SET_ARG1_FLOAT_ARG(instr,argValue,value)                                  \
-    do {                                                                          \
-        if (IS_ARG1_ADDR(instr))                                                  \
-            ramStoreFloat(ram, cpu->regs[(argValue)].as.address,(value));         \
-        else cpu->regs[(argValue)].as.fVal = (value);                             \
-    } while(0)
+    return vm->heap;
+}
 
+/* 
+ * A PUSH or DUP that would take $sp below the stack limit, into the heap, or a POP past 
+ * the top of the stack
+ */
+static void vmStackError(Vm* vm, int overflow) {
+    Address sp = vm->cpu->sp.as.address;
+    if(overflow) {
+        vmError("Stack overflow error at $sp '0x%x', the stack of %u bytes is full \n", 
+            sp, vm->stackSpan);
+    }
+    vmError("Stack underflow error at $sp '0x%x', the stack is empty \n", sp);
+}
 
-#define SET_ARG1_INT8(instr,value)                                                \
-    SET_ARG1_INT8_ARG(instr,ARG1_VALUE(instr),value)
+/* FREE, returns false if the address isn't 0 or the start of a live block */
+static int vmHeapFree(Vm* vm, Address address) {
+    if(!address) {
+        return 1;
+    }
 
-#define SET_ARG1_INT8_ARG(instr,argValue,value)                                   \
-    do {                                                                          \
-        if (IS_ARG1_ADDR(instr))                                                  \
-            ramStoreInt8(ram, cpu->regs[(argValue)].as.address,(value));          \
-        else cpu->regs[argValue].as.bVal = (value);                               \
-    } while(0)
+    uint32_t size = vm->heap ? heapBlockSize(vm->heap, address) : 0;
+    if(!size || !heapRelease(vm->heap, address)) {
+        return 0;
+    }
 
-#define SET_ARG1_ADDR(instr,value)                                                \
-    SET_ARG1_ADDR_ARG(instr,ARG1_VALUE(instr),value)
+    // the pages of a large block go back to the OS, nothing has to be done for heap allocated RAM
+    if(size >= HEAP_PAGE_SIZE && vm->ram->mapping) {
+        ramDiscard(vm->ram, address, size);
+    }
+    return 1;
+}
 
-#define SET_ARG1_ADDR_ARG(instr,argValue,value)                                   \
-    do {                                                                          \
-        if (IS_ARG1_ADDR(instr))                                                  \
-            ramStoreInt32(ram, cpu->regs[(argValue)].as.address,(value));         \
-        else cpu->regs[(argValue)].as.address = (value);                          \
-    } while(0)
+/* 
+ * REALLOC, the block stays where it is if it shrinks by no more than half.  Returns false 
+ * if the address isn't 0 or the start of a live block.
+ */
+static int vmHeapRealloc(Vm* vm, Address heapStart, Address* address, uint32_t size) {
+    Heap* heap = vmHeap(vm, heapStart);
+    heap->stats.reallocCount++;
+    if(!*address) {
+        *address = heapAlloc(heap, size);
+        return 1;
+    }
 
+    uint32_t oldSize = heapBlockSize(heap, *address);
+    if(!oldSize) {
+        return 0;
+    }
+    if(size <= oldSize && (size > oldSize / 2 || oldSize <= (1 << HEAP_MIN_BLOCK_SHIFT))) {
+        return 1;
+    }
 
+    Address moved = heapAlloc(heap, size);
+    if(!moved) {
+        // a shrinking block can always stay where it is
+        *address = size <= oldSize ? *address : 0;
+        return 1;
+    }
 
-#define GET_ARG1_INT(instr)                                        \
-    ((IS_ARG1_ADDR(instr)) ?                                       \
-        ramReadInt32(ram, cpu->regs[ARG1_VALUE(instr)].as.address) \
-        : cpu->regs[ARG1_VALUE(instr)].as.iVal)
+    memcpy(vm->ram->mem + moved, vm->ram->mem + *address, MIN(oldSize, size));
+    vmHeapFree(vm, *address);
+    *address = moved;
+    return 1;
+}
 
-#define GET_ARG1_INT8(instr)                                       \
-    ((IS_ARG1_ADDR(instr)) ?                                       \
-        ramReadInt8(ram, cpu->regs[ARG1_VALUE(instr)].as.address)  \
-        : cpu->regs[ARG1_VALUE(instr)].as.bVal)
+/*
+ * Opcodes that have a handler variant for every combination of operand modes, so
+ * the handlers never have to test the address/register/immediate/constant bits:
+ *
+ *   X(kind, opcode, type, operator)
+ *
+ * 'kind' selects the handler body (see the VM_HANDLER_* macros in vmInterpret) and
+ * 'type' the value type the operands are read and written as.
+ *
+ * The variants are named after the opcode and the operand modes, arg1 being either
+ * a register (R) or the memory the register points to (M), and arg2 additionally an
+ * immediate value (I) or a constant (K).  ADDI_MR is 'addi &$a $b'.  Floats can't be
+ * encoded as immediates, their I variants run the constants vmDecode folded.
+ */
+#define VM_COMPARE_OPS(X)        \
+    X(COMPARE, IFI,   INT,   >)  \
+    X(COMPARE, IFF,   FLOAT, >)  \
+    X(COMPARE, IFB,   INT8,  >)  \
+    X(COMPARE, IFEI,  INT,   >=) \
+    X(COMPARE, IFEF,  FLOAT, >=) \
+    X(COMPARE, IFEB,  INT8,  >=)
+
+/*
+ * The packed vector opcodes that combine two arrays element by element, see kernels.h:
+ *
+ *   X(opcode, kernel, operator)
+ */
+#define VM_VECTOR_OPS(X)                        \
+    X(VADDI, kernelVectorInt32, KERNEL_ADD)     \
+    X(VADDF, kernelVectorFloat, KERNEL_ADD)     \
+    X(VSUBI, kernelVectorInt32, KERNEL_SUB)     \
+    X(VSUBF, kernelVectorFloat, KERNEL_SUB)     \
+    X(VMULI, kernelVectorInt32, KERNEL_MUL)     \
+    X(VMULF, kernelVectorFloat, KERNEL_MUL)     \
+    X(VMINI, kernelVectorInt32, KERNEL_MIN)     \
+    X(VMINF, kernelVectorFloat, KERNEL_MIN)     \
+    X(VMAXI, kernelVectorInt32, KERNEL_MAX)     \
+    X(VMAXF, kernelVectorFloat, KERNEL_MAX)
+
+#define VM_SPECIALIZED_OPS(X)    \
+    X(MOVE,    MOVI,  INT,   =)  \
+    X(MOVE,    MOVF,  FLOAT, =)  \
+    X(MOVE,    MOVB,  INT8,  =)  \
+    X(PUSH,    PUSHI, INT,   =)  \
+    X(PUSH,    PUSHF, FLOAT, =)  \
+    X(PUSH,    PUSHB, INT8,  =)  \
+    VM_COMPARE_OPS(X)            \
+    X(BINARY,  ADDI,  INT,   +)  \
+    X(BINARY,  ADDF,  FLOAT, +)  \
+    X(BINARY,  ADDB,  INT8,  +)  \
+    X(BINARY,  SUBI,  INT,   -)  \
+    X(BINARY,  SUBF,  FLOAT, -)  \
+    X(BINARY,  SUBB,  INT8,  -)  \
+    X(BINARY,  MULI,  INT,   *)  \
+    X(BINARY,  MULF,  FLOAT, *)  \
+    X(BINARY,  MULB,  INT8,  *)  \
+    X(DIVIDE,  DIVI,  INT,   /)  \
+    X(DIVIDE,  DIVF,  FLOAT, /)  \
+    X(DIVIDE,  DIVB,  INT8,  /)  \
+    X(DIVIDE,  MODI,  INT,   %)  \
+    X(FMOD,    MODF,  FLOAT, %)  \
+    X(DIVIDE,  MODB,  INT8,  %)  \
+    X(BINARY,  ORI,   INT,   |)  \
+    X(BINARY,  ORB,   INT8,  |)  \
+    X(BINARY,  ANDI,  INT,   &)  \
+    X(BINARY,  ANDB,  INT8,  &)  \
+    X(UNARY,   NOTI,  INT,   ~)  \
+    X(UNARY,   NOTB,  INT8,  ~)  \
+    X(BINARY,  XORI,  INT,   ^)  \
+    X(BINARY,  XORB,  INT8,  ^)  \
+    X(BINARY,  SZRLI, INT,   >>) \
+    X(BINARY,  SZRLB, INT8,  >>) \
+    X(BINARY,  SRLI,  INT,   >>) \
+    X(BINARY,  SRLB,  INT8,  >>) \
+    X(BINARY,  SLLI,  INT,   <<) \
+    X(BINARY,  SLLB,  INT8,  <<)
+
+/* the operand mode values match the DECODED_ARG2_* modes */
+#define VM_MODE_R 0
+#define VM_MODE_M 1
+#define VM_MODE_I 2
+#define VM_MODE_K 3
+#define VM_MODE_INDEX(m1, m2) (VM_MODE_##m1 * 4 + VM_MODE_##m2)
+
+#define VM_ARG2_MODES(X, kind, op, type, sym, m1)     \
+    X(kind, op, type, sym, m1, R)                     \
+    X(kind, op, type, sym, m1, M)                     \
+    X(kind, op, type, sym, m1, I)                     \
+    X(kind, op, type, sym, m1, K)
+
+#define VM_ARG1_MODES_ALL(X, kind, op, type, sym)     \
+    VM_ARG2_MODES(X, kind, op, type, sym, R)          \
+    VM_ARG2_MODES(X, kind, op, type, sym, M)
+#define VM_ARG1_MODES_REG(X, kind, op, type, sym)     \
+    VM_ARG2_MODES(X, kind, op, type, sym, R)
+
+// PUSH has no first argument, so only its register form exists
+#define VM_ARG1_MODES_MOVE    VM_ARG1_MODES_ALL
+#define VM_ARG1_MODES_PUSH    VM_ARG1_MODES_REG
+#define VM_ARG1_MODES_COMPARE VM_ARG1_MODES_ALL
+#define VM_ARG1_MODES_BINARY  VM_ARG1_MODES_ALL
+#define VM_ARG1_MODES_DIVIDE  VM_ARG1_MODES_ALL
+#define VM_ARG1_MODES_FMOD    VM_ARG1_MODES_ALL
+#define VM_ARG1_MODES_UNARY   VM_ARG1_MODES_ALL
+
+/* expands X(kind, opcode, type, operator, arg1 mode, arg2 mode) for every variant of the opcode */
+#define VM_VARIANTS(X, kind, op, type, sym) VM_ARG1_MODES_##kind(X, kind, op, type, sym)
+
+#define VM_VARIANT_ENUM(kind, op, type, sym, m1, m2) op##_##m1##m2,
+#define VM_DECLARE_VARIANTS(kind, op, type, sym) VM_VARIANTS(VM_VARIANT_ENUM, kind, op, type, sym)
+
+#define VM_COMPARE_JMP_ENUM(kind, op, type, sym, m1, m2) op##_##m1##m2##_JMP,
+#define VM_DECLARE_COMPARE_JMPS(kind, op, type, sym) VM_VARIANTS(VM_COMPARE_JMP_ENUM, kind, op, type, sym)
+
+/* interpreter only opcodes, these are never encoded in a Bytecode instruction */
+enum {
+    OP_HALT = MAX_OPCODES,  // end of the decoded instruction stream
+    OP_RET_UNCHECKED,       // RET without the return index check, see VERIFIED_RETURNS
+    OP_SYNC_PC,             // stores $pc, then runs the handler picked by decodeHandler
+    OP_TRACE,               // records the instruction into the loop trace, then runs it
+
+    VM_SPECIALIZED_OPS(VM_DECLARE_VARIANTS)
+
+    /* 
+     * Superinstructions, see vmFuse.  A superinstruction replaces the handler of the first
+     * instruction of a group and executes the whole group in one dispatch.
+     */
+    VM_COMPARE_OPS(VM_DECLARE_COMPARE_JMPS) // IF* x y; JMP :label
+
+    ADDI_RI_JMP,                            // ADDI $a #1; JMP :label
+    ADDI_RR_JMP,                            // ADDI $a $b; JMP :label
+    SUBI_RI_JMP,                            // SUBI $a #1; JMP :label
+    SUBI_RR_JMP,                            // SUBI $a $b; JMP :label
+    MOVI_RI_ADDI_RR,                        // MOVI $a #0; ADDI $a $b
+    MOVI_RI_ADDI_RR_ADDI_RR,                // MOVI $a #0; ADDI $a $b; ADDI $a $c
+
+    MAX_VM_OPCODES
+};
+
+#define VM_FIRST_FUSED_OPCODE IFI_RR_JMP
+
+#define VM_VARIANT_ENTRY(kind, op, type, sym, m1, m2) [VM_MODE_INDEX(m1, m2)] = op##_##m1##m2,
+#define VM_VARIANT_ROW(kind, op, type, sym) [op] = { VM_VARIANTS(VM_VARIANT_ENTRY, kind, op, type, sym) },
+
+/* the specialized variant of an opcode by operand modes, 0 if the opcode has no such variant */
+static const uint16_t vmVariants[MAX_OPCODES][8] = {
+    VM_SPECIALIZED_OPS(VM_VARIANT_ROW)
+};
+
+#define VM_COMPARE_JMP_ENTRY(kind, op, type, sym, m1, m2) [op##_##m1##m2] = op##_##m1##m2##_JMP,
+#define VM_COMPARE_JMP_ROW(kind, op, type, sym) VM_VARIANTS(VM_COMPARE_JMP_ENTRY, kind, op, type, sym)
+
+/* the compare and branch superinstruction of an IF variant, 0 if there is none */
+static const uint16_t vmCompareJmps[MAX_VM_OPCODES] = {
+    VM_COMPARE_OPS(VM_COMPARE_JMP_ROW)
+};
+
+#undef VM_VARIANT_ENUM
+#undef VM_DECLARE_VARIANTS
+#undef VM_COMPARE_JMP_ENUM
+#undef VM_DECLARE_COMPARE_JMPS
+#undef VM_VARIANT_ENTRY
+#undef VM_VARIANT_ROW
+#undef VM_COMPARE_JMP_ENTRY
+#undef VM_COMPARE_JMP_ROW
+
+/* the interpreter loop with range checked RAM accesses, and without them for guarded RAM */
+static void vmInterpret(Vm* vm, Bytecode* code, DecodedInstr* rec);
+#if LITA_GUARDED_RAM
+static void vmInterpretUnchecked(Vm* vm, Bytecode* code, DecodedInstr* rec);
+#endif
+
+#if LITA_THREADED_DISPATCH
+/* the handler addresses of the interpreters, indexed by opcode */
+static const void* const* vmCheckedHandlers = NULL;
+static const void* const* vmUncheckedHandlers = NULL;
+
+/* the handlers of the interpreter that runs the Vm */
+static const void* const* vmHandlerTable(Vm* vm) {
+    if(!vmCheckedHandlers) {
+        vmInterpret(NULL, NULL, NULL);
+#if LITA_GUARDED_RAM
+        vmInterpretUnchecked(NULL, NULL, NULL);
+#endif
+    }
 
-#define GET_ARG1_FLOAT(instr)                                      \
-    ((IS_ARG1_ADDR(instr)) ?                                       \
-        ramReadFloat(ram, cpu->regs[ARG1_VALUE(instr)].as.address) \
-        : cpu->regs[ARG1_VALUE(instr)].as.fVal)
+    return vm->ram->guarded ? vmUncheckedHandlers : vmCheckedHandlers;
+}
+#endif
+
+/* picks the handler of a record from its opcode and decoded operand modes */
+static uint16_t decodeHandler(Opcode opcode, DecodedInstr* rec) {
+    // once their operand is decoded, the constant loads are plain moves
+    switch(opcode) {
+        case LDCI:
+        case LDCA: opcode = MOVI; break;
+        case LDCF: opcode = MOVF; break;
+        case LDCB: opcode = MOVB; break;
+        default: break;
+    }
 
-#define GET_ARG2_INT(instr)                                        \
-    getArg2Int32(vm, code, instr)
+    // PUSH has no first argument, so its arg1 bits are ignored
+    int arg1Mode = (IS_DECODED_ARG1_ADDR(rec) && opcodeNumArgs(opcode) > 1) ? VM_MODE_M : VM_MODE_R;
+    uint16_t variant = vmVariants[opcode][arg1Mode * 4 + DECODED_ARG2_MODE(rec)];
 
-#define GET_ARG2_FLOAT(instr)                                      \
-    getArg2Float(vm, code, instr)
+    return variant ? variant : opcode;
+}
 
-#define GET_ARG2_INT8(instr)                                       \
-    getArg2Int8(vm, code, instr)
+/*
+ * The interpreter does not keep $pc up to date, its value is the index of the instruction
+ * being executed, so reads of it are resolved into immediate values and constant addresses 
+ * here.  Returns true if the instruction still reads $pc at run time, in which case the 
+ * interpreter stores $pc before running it.
+ */
+static int decodePcOperands(Opcode opcode, DecodedInstr* rec) {
+    Arg2Type arg2Type = opcodeArg2Type(opcode);
+    if(arg2Type == ARG2_EXT_REGS) {
+        return rec->arg1 == REG_PC || rec->arg2.ext.reg2 == REG_PC || 
+               rec->arg2.ext.reg3 == REG_PC || rec->arg2.ext.reg4 == REG_PC;
+    }
 
-#define GET_CONST_INT(instr)                                       \
-    ((IS_ARG2_IMM(instr)) ?                                        \
-        ARG2_VALUE(instr)                                          \
-        : ramReadInt32(ram, code->constants[ARG2_VALUE(instr)]))
+    if(arg2Type == ARG2_VALUE_INT || arg2Type == ARG2_VALUE_FLOAT) {
+        int arg2Mode = DECODED_ARG2_MODE(rec);
+        if((arg2Mode == DECODED_ARG2_REG || arg2Mode == DECODED_ARG2_ADDR) && rec->arg2.reg == REG_PC) {
+            if(arg2Mode == DECODED_ARG2_ADDR) {
+                rec->mode = (rec->mode & ~DECODED_ARG2_MASK) | DECODED_ARG2_CONST;
+                rec->arg2.address = rec->pc;
+            }
+            else if(arg2Type == ARG2_VALUE_INT) {
+                rec->mode = (rec->mode & ~DECODED_ARG2_MASK) | DECODED_ARG2_IMM;
+                rec->arg2.iVal = rec->pc;
+            }
+            else {
+                return 1;
+            }
 
-#define GET_CONST_INT8(instr)                                      \
-    ((IS_ARG2_IMM(instr)) ?                                        \
-        (int8_t)ARG2_VALUE(instr)                                  \
-        : ramReadInt8(ram, code->constants[ARG2_VALUE(instr)]))
+            rec->opcode = decodeHandler(opcode, rec);
+        }
+    }
 
-#define GET_CONST_FLOAT(instr)                                     \
-    (ramReadFloat(ram, code->constants[ARG2_VALUE(instr)]))
+    return rec->arg1 == REG_PC && (opcodeNumArgs(opcode) > 1 || arg2Type == ARG2_DEST_REG);
+}
 
-#define GET_CONST_ADDR(instr)                                      \
-    (code->constants[ARG2_VALUE(instr)])
+static Address decodeConstant(Bytecode* code, Instruction instr) {
+    return code->constants[ARG2_VALUE(instr)];
+}
 
-#define OP_INT(instr,op)                                           \
-    do {                                                           \
-        int32_t aValue = GET_ARG1_INT(instr);                      \
-        int32_t bValue = GET_ARG2_INT(instr);                      \
-        int32_t result = aValue op bValue;                         \
-        SET_ARG1_INT(instr, result);                               \
-    } while(0)
+/* 
+ * Turns a constant operand into an immediate value if all of its bytes are in the read only
+ * constants, where they can't change anymore, see vmProtectConstants
+ */
+static void decodeFoldConstant(Ram* ram, Opcode opcode, DecodedInstr* rec) {
+    size_t size = opcodeArg2Size(opcode);
+    Address address = rec->arg2.address;
+    if((uint64_t)address + size > ram->readOnly) {
+        return;
+    }
 
-#define OP_INT8(instr,op)                                          \
-    do {                                                           \
-        int8_t aValue = GET_ARG1_INT8(instr);                      \
-        int8_t bValue = GET_ARG2_INT8(instr);                      \
-        int8_t result = aValue op bValue;                          \
-        SET_ARG1_INT8(instr, result);                              \
-    } while(0)
+    rec->mode = (rec->mode & ~DECODED_ARG2_MASK) | DECODED_ARG2_IMM;
+    if(size == 1) {
+        rec->arg2.iVal = ramReadInt8(ram, address);
+    }
+    else {
+        // the bits of a float constant are its immediate fVal
+        rec->arg2.iVal = ramReadInt32(ram, address);
+    }
+}
 
-#define OP_FLOAT(instr,op)                                         \
-    do {                                                           \
-        float aValue = GET_ARG1_FLOAT(instr);                      \
-        float bValue = GET_ARG2_FLOAT(instr);                      \
-        float result = aValue op bValue;                           \
-        SET_ARG1_FLOAT(instr, result);                             \
-    } while(0)    
-
-#define CHECK_DIV_ZERO_INT(instr)                                  \
-    do {                                                           \
-        int32_t value = GET_ARG2_INT(instr);                       \
-        if(value == 0) vmError("DivideByZeroError\n");             \
-    } while(0)
+/*
+ * Rewrites common instruction sequences into superinstructions.  Only the handler of the
+ * first record of a group changes, its operands are read from the records that follow.  
+ * Those records are left untouched, so a jump landing in the middle of a group still runs 
+ * the remaining instructions one at a time.
+ */
+static void vmFuse(DecodedInstr* decoded, Address length) {
+    // the trailing HALT records make it safe to look ahead past the last instruction
+    for(Address i = 0; i < length; i++) {
+        DecodedInstr* rec = &decoded[i];
+        DecodedInstr* next = &decoded[i + 1];
+
+        if(next->opcode == JMP) {
+            switch(rec->opcode) {
+                case ADDI_RI: rec->opcode = ADDI_RI_JMP; break;
+                case ADDI_RR: rec->opcode = ADDI_RR_JMP; break;
+                case SUBI_RI: rec->opcode = SUBI_RI_JMP; break;
+                case SUBI_RR: rec->opcode = SUBI_RR_JMP; break;
+                default: {
+                    if(vmCompareJmps[rec->opcode]) {
+                        rec->opcode = vmCompareJmps[rec->opcode];
+                    }
+                }
+            }
+        }
+        else if(rec->opcode == MOVI_RI && next->opcode == ADDI_RR && next->arg1 == rec->arg1) {
+            DecodedInstr* last = &decoded[i + 2];
+            rec->opcode = (last->opcode == ADDI_RR && last->arg1 == rec->arg1)
+                ? MOVI_RI_ADDI_RR_ADDI_RR
+                : MOVI_RI_ADDI_RR;
+        }
+    }
+}
 
-#define CHECK_DIV_ZERO_INT8(instr)                                 \
-    do {                                                           \
-        int8_t value = GET_ARG2_INT8(instr);                       \
-        if(value == 0) vmError("DivideByZeroError\n");             \
-    } while(0)
+#if LITA_THREADED_DISPATCH
+/* stores the handler addresses of the Vm's interpreter in the decoded records */
+static void vmBindHandlers(Vm* vm, Bytecode* code) {
+    const void* const* handlers = vmHandlerTable(vm);
+    for(size_t i = 0; i < code->length + 2; i++) {
+        code->decoded[i].handler = handlers[code->decoded[i].opcode];
+    }
+}
+#endif
 
-#define CHECK_DIV_ZERO_FLOAT(instr)                                \
-    do {                                                           \
-        float value = GET_ARG2_FLOAT(instr);                       \
-        if(value == 0) vmError("DivideByZeroError\n");             \
-    } while(0)
+void vmDecode(Vm* vm, Bytecode* code) {
+    if(code->decoded) {
+        return;
+    }
 
+    // the operands are only validated once here, the decoder and interpreter rely on it
+    VerifyError error;
+    if(!(code->verified & VERIFIED_CODE) && !verify(code, &error)) {
+        vmError("%s at instruction: %d", error.message, error.pc);
+    }
 
-    Instruction* pc = code->instrs;
-    Instruction* end = INSTR_AT(code->length - 1);
-            
-    while(pc <= end) {
-        cpu->pc.as.address = (Address)(pc - code->instrs); 
+    // the two trailing HALT records catch falling off the end of the program as well
+    // as an IF instruction at the end of the program skipping past it
+    size_t numOfRecords = code->length + 2;
+    DecodedInstr* decoded = (DecodedInstr*) litaMalloc(sizeof(DecodedInstr) * numOfRecords);
+
+    for(Address i = 0; i < numOfRecords; i++) {
+        DecodedInstr* rec = &decoded[i];
+        rec->pc = i;
+        rec->arg1 = 0;
+        rec->mode = 0;
+        rec->arg2.iVal = 0;
+
+        if(i >= code->length) {
+            rec->opcode = OP_HALT;
+            continue;
+        }
 
-        Instruction instr = *pc++;        
-        int32_t opcode = OPCODE(instr);
-        
-        
-        //printf("Opcode: '%5s' Arg1: %5d Arg2: %5d PC: %5d  \n", 
-        //    OpcodeStr[opcode], ARG1_VALUE(instr), ARG2_VALUE(instr), cpu->pc.as.address);
+        Instruction instr = code->instrs[i];
+        Opcode opcode = OPCODE(instr);
 
-        switch(opcode) {
-            case NOOP: {
-                break;
-            }
-            case JMP: {
-                pc = INSTR_AT(ARG_JMP_VALUE(instr));
-                break;
-            }
-            case CALL: {
-                cpu->r.as.address = pc - code->instrs;
-                pc = INSTR_AT(ARG_JMP_VALUE(instr));
-                break;
-            }
-            case RET: {
-                pc = INSTR_AT(cpu->r.as.address);
+        rec->opcode = opcode;
+        rec->arg1 = ARG1_VALUE(instr);
+        if(IS_ARG1_ADDR(instr)) {
+            rec->mode |= DECODED_ARG1_ADDR;
+        }
+
+        switch(opcodeArg2Type(opcode)) {
+            case ARG2_NONE: {
                 break;
             }
-            case MOVI: {
-                SET_ARG1_INT(instr, GET_ARG2_INT(instr));
+            case ARG2_VALUE_INT:
+            case ARG2_VALUE_FLOAT: {
+                if(IS_ARG2_REG(instr)) {
+                    rec->mode |= IS_ARG2_ADDR(instr) ? DECODED_ARG2_ADDR : DECODED_ARG2_REG;
+                    rec->arg2.reg = ARG2_VALUE(instr);
+                }
+                else if(IS_ARG2_IMM(instr) && opcodeArg2Type(opcode) == ARG2_VALUE_INT) {
+                    rec->mode |= DECODED_ARG2_IMM;
+                    rec->arg2.iVal = ARG2_VALUE(instr);
+                }
+                else {
+                    rec->mode |= DECODED_ARG2_CONST;
+                    rec->arg2.address = decodeConstant(code, instr);
+                }
                 break;
             }
-            case MOVF: {
-                SET_ARG1_FLOAT(instr, GET_ARG2_FLOAT(instr));
+            case ARG2_CONST_INT: {
+                if(IS_ARG2_IMM(instr)) {
+                    rec->mode |= DECODED_ARG2_IMM;
+                    rec->arg2.iVal = ARG2_VALUE(instr);
+                }
+                else {
+                    rec->mode |= DECODED_ARG2_CONST;
+                    rec->arg2.address = decodeConstant(code, instr);
+                }
                 break;
             }
-            case MOVB: {
-                SET_ARG1_INT8(instr, GET_ARG2_INT8(instr));
+            case ARG2_CONST_FLOAT: {
+                rec->mode |= DECODED_ARG2_CONST;
+                rec->arg2.address = decodeConstant(code, instr);
                 break;
             }
-            case LDCI: {
-                SET_ARG1_INT(instr, GET_CONST_INT(instr));
+            case ARG2_CONST_ADDR: {
+                rec->mode |= DECODED_ARG2_IMM;
+                rec->arg2.address = decodeConstant(code, instr);
                 break;
             }
-            case LDCF: {
-                SET_ARG1_FLOAT(instr, GET_CONST_FLOAT(instr));
+            case ARG2_DEST_REG: {
+                rec->arg1 = ARG2_VALUE(instr);
                 break;
             }
-            case LDCB: {
-                SET_ARG1_INT8(instr, GET_CONST_INT8(instr));
+            case ARG2_EXT_REGS: {
+                rec->mode = 0;
+                rec->arg2.ext.reg2 = EXT_ARG2_VALUE(instr);
+                rec->arg2.ext.reg3 = EXT_ARG3_VALUE(instr);
+                rec->arg2.ext.reg4 = EXT_ARG4_VALUE(instr);
                 break;
             }
-            case LDCA: {
-                SET_ARG1_ADDR(instr, GET_CONST_ADDR(instr));
+            case ARG2_TARGET: {
+                // jumping to the end of the program halts it
+                rec->arg2.target = &decoded[ARG_JMP_VALUE(instr)];
                 break;
             }
-            case PUSHI: {
-                int32_t value = GET_ARG2_INT(instr);
+        }
 
-                cpu->sp.as.address -= ADDRESS_SIZE;
-                ramStoreInt32(ram, cpu->sp.as.address, value);
-                break;
-            }
-            case PUSHF: {
-                float value = GET_ARG2_FLOAT(instr);
+        if(DECODED_ARG2_MODE(rec) == DECODED_ARG2_CONST) {
+            decodeFoldConstant(vm->ram, opcode, rec);
+        }
 
-                cpu->sp.as.address -= ADDRESS_SIZE;
-                ramStoreFloat(ram, cpu->sp.as.address, value);
-                break;
-            }
-            case PUSHB: {
-                int8_t value = GET_ARG2_INT8(instr);
+        rec->opcode = decodeHandler(opcode, rec);
 
-                cpu->sp.as.address -= 1;
-                ramStoreInt8(ram, cpu->sp.as.address, value);
-                break;
-            }
-            case POPI: {
-                int32_t value = ramReadInt32(ram, cpu->sp.as.address);
-                cpu->sp.as.address += ADDRESS_SIZE;
-                
-                SET_ARG1_INT_ARG(instr, ARG2_VALUE(instr), value);
-                break;
-            }
-            case POPF: {
-                float value = ramReadFloat(ram, cpu->sp.as.address);
-                cpu->sp.as.address += ADDRESS_SIZE;
+        if(decodePcOperands(opcode, rec)) {
+            rec->opcode = OP_SYNC_PC;
+        }
+        else if(opcode == RET && (code->verified & VERIFIED_RETURNS)) {
+            rec->opcode = OP_RET_UNCHECKED;
+        }
+    }
 
-                SET_ARG1_FLOAT_ARG(instr, ARG2_VALUE(instr), value);
-                break;
-            }
-            case POPB: {
-                int8_t value = ramReadInt8(ram, cpu->sp.as.address);
-                cpu->sp.as.address += 1;
+    if(vm->fuseInstructions) {
+        vmFuse(decoded, code->length);
+    }
 
-                SET_ARG1_INT8_ARG(instr, ARG2_VALUE(instr), value);
-                break;
-            }
-            case DUPI: {
-                int32_t value = ramReadInt32(ram, cpu->sp.as.address);
-                cpu->sp.as.address -= ADDRESS_SIZE;
-                ramStoreInt32(ram, cpu->sp.as.address, value);
-                
-                SET_ARG1_INT_ARG(instr, ARG2_VALUE(instr), value);
-                break;
-            }
-            case DUPF: {
-                float value = ramReadFloat(ram, cpu->sp.as.address);
-                cpu->sp.as.address -= ADDRESS_SIZE;
-                ramStoreFloat(ram, cpu->sp.as.address, value);
-                
-                SET_ARG1_FLOAT_ARG(instr, ARG2_VALUE(instr), value);
-                break;
-            }
-            case DUPB: {
-                int8_t value = ramReadInt8(ram, cpu->sp.as.address);
-                cpu->sp.as.address -= 1;
-                ramStoreInt8(ram, cpu->sp.as.address, value);
-                
-                SET_ARG1_INT8_ARG(instr, ARG2_VALUE(instr), value);
-                break;
-            }
-            case IFI: {
-                int32_t yValue = GET_ARG2_INT(instr);
-                int32_t xValue = GET_ARG1_INT(instr);
+    code->decoded = decoded;
 
-                if(xValue > yValue) {
-                    pc++;
-                }
+#if LITA_THREADED_DISPATCH
+    vmBindHandlers(vm, code);
+#endif
+}
 
-                break;
-            }
-            case IFF: {
-                float yValue = GET_ARG2_FLOAT(instr);
-                float xValue = GET_ARG1_FLOAT(instr);
 
-                if(xValue > yValue) {
-                    pc++;
-                }
+/*
+ * Hot loop tracing.  Every backward jump counts an iteration of the loop at its target,
+ * once a loop head reaches VM_HOT_LOOP_THRESHOLD the next iteration is recorded: all the
+ * records are switched to OP_TRACE, which logs the record and then runs the instruction.
+ * When the iteration gets back to the head the logged path, which includes the way every
+ * IF went, is compiled by jitCompileTrace.  From then on the backward jumps to the head
+ * run the trace, which returns into the interpreter when the path is not taken anymore.
+ */
+#define VM_HOT_LOOP_THRESHOLD 1000
+#define VM_MAX_TRACE_LENGTH   512
+
+typedef struct VmLoops {
+    uint32_t*  hotCounts;  /* backward jumps to each record since it was last looked at */
+    JitTrace** traces;     /* the compiled trace of each loop head */
+    uint8_t*   rejected;   /* loop heads whose iteration could not be compiled */
+
+    /* the iteration being recorded */
+    int        recording;
+    Address    head;
+    Address*   path;       /* buf of the record indexes */
+    uint16_t*  opcodes;    /* the opcodes replaced by OP_TRACE */
+
+    const void* const* handlers; /* of the interpreter running the loops, for the threaded dispatch */
+} VmLoops;
+
+static VmLoops* vmLoopsInit(Vm* vm, Bytecode* code) {
+    size_t numOfRecords = code->length + 2;
+
+    VmLoops* loops = (VmLoops*) litaMalloc(sizeof(VmLoops));
+    loops->hotCounts = (uint32_t*) litaMalloc(sizeof(uint32_t) * numOfRecords);
+    loops->traces = (JitTrace**) litaMalloc(sizeof(JitTrace*) * numOfRecords);
+    loops->rejected = (uint8_t*) litaMalloc(sizeof(uint8_t) * numOfRecords);
+    loops->opcodes = (uint16_t*) litaMalloc(sizeof(uint16_t) * numOfRecords);
+    loops->recording = 0;
+    loops->head = 0;
+    loops->path = NULL;
+#if LITA_THREADED_DISPATCH
+    loops->handlers = vmHandlerTable(vm);
+#else
+    (void)vm;
+    loops->handlers = NULL;
+#endif
+
+    memset(loops->hotCounts, 0, sizeof(uint32_t) * numOfRecords);
+    memset(loops->traces, 0, sizeof(JitTrace*) * numOfRecords);
+    memset(loops->rejected, 0, sizeof(uint8_t) * numOfRecords);
+    memset(loops->opcodes, 0, sizeof(uint16_t) * numOfRecords);
+
+    return loops;
+}
 
-                break;
-            }
-            case IFB: {
-                int8_t yValue = GET_ARG2_INT8(instr);
-                int8_t xValue = GET_ARG1_INT8(instr);
+static void vmSetOpcode(VmLoops* loops, DecodedInstr* rec, uint16_t opcode) {
+    rec->opcode = opcode;
+#if LITA_THREADED_DISPATCH
+    rec->handler = loops->handlers[opcode];
+#else
+    (void)loops;
+#endif
+}
 
-                if(xValue > yValue) {
-                    pc++;
-                }
+static void vmStartRecording(Bytecode* code, VmLoops* loops, Address head) {
+    loops->recording = 1;
+    loops->head = head;
+    buf_clear(loops->path);
 
-                break;
-            }
-            case IFEI: {
-                int32_t yValue = GET_ARG2_INT(instr);
-                int32_t xValue = GET_ARG1_INT(instr);
+    for(Address i = 0; i < code->length; i++) {
+        loops->opcodes[i] = code->decoded[i].opcode;
+        vmSetOpcode(loops, &code->decoded[i], OP_TRACE);
+    }
+}
 
-                if(xValue >= yValue) {
-                    pc++;
-                }
+static void vmStopRecording(Bytecode* code, VmLoops* loops) {
+    for(Address i = 0; i < code->length; i++) {
+        vmSetOpcode(loops, &code->decoded[i], loops->opcodes[i]);
+    }
 
-                break;
-            }
-            case IFEF: {
-                float yValue = GET_ARG2_FLOAT(instr);
-                float xValue = GET_ARG1_FLOAT(instr);
+    loops->recording = 0;
+}
 
-                if(xValue >= yValue) {
-                    pc++;
-                }
+/* also ends the recording, which an error may have left the records switched to OP_TRACE in */
+static void vmLoopsFree(Bytecode* code, VmLoops* loops) {
+    if(loops) {
+        if(loops->recording) {
+            vmStopRecording(code, loops);
+        }
+        for(Address i = 0; i < code->length + 2; i++) {
+            jitFreeTrace(loops->traces[i]);
+        }
 
-                break;
-            }
-            case IFEB: {
-                int8_t yValue = GET_ARG2_INT8(instr);
-                int8_t xValue = GET_ARG1_INT8(instr);
+        buf_free(loops->path);
+        litaFree(loops->hotCounts);
+        litaFree(loops->traces);
+        litaFree(loops->rejected);
+        litaFree(loops->opcodes);
+        litaFree(loops);
+    }
+}
 
-                if(xValue >= yValue) {
-                    pc++;
-                }
+/* logs the record being executed by OP_TRACE, returns the opcode to run it with */
+static uint16_t vmTraceRecord(Vm* vm, Bytecode* code, VmLoops* loops, DecodedInstr* rec) {
+    Address index = rec->pc;
 
-                break;
-            }
-            case PRINTI: {
-                printf("%d", GET_ARG2_INT(instr));
-                break;
-            }
-            case PRINTF: {
-                printf("%f", GET_ARG2_FLOAT(instr));
-                break;
-            }
-            case PRINTB: {
-                printf("%d", GET_ARG2_INT8(instr));
-                break;
-            }
-            case PRINTC: {
-                printf("%c", (char)GET_ARG2_INT8(instr));
-                break;
-            }
+    if(index == loops->head && buf_len(loops->path)) {
+        vmStopRecording(code, loops);
 
-            /* ===================================================
-            * ALU operations 
-            * ===================================================
-            */
-            case ADDI: {
-                OP_INT(instr, +);
-                break;
-            }
-            case ADDF: {
-                OP_FLOAT(instr, +);
-                break;
-            }
-            case ADDB: {
-                OP_INT8(instr, +);
-                break;
-            }
-            case SUBI: {
-                OP_INT(instr, -);
-                break;
-            }
-            case SUBF: {
-                OP_FLOAT(instr, -);
-                break;
-            }
-            case SUBB: {
-                OP_INT8(instr, -);
-                break;
-            }
-            case MULI: {
-                OP_INT(instr, *);
-                break;
-            }
-            case MULF: {
-                OP_FLOAT(instr, *);
-                break;
-            }
-            case MULB: {
-                OP_INT8(instr, *);
-                break;
-            }
-            case DIVI: {
-                CHECK_DIV_ZERO_INT(instr);
-                OP_INT(instr, /);
-                break;
-            }
-            case DIVF: {
-                CHECK_DIV_ZERO_FLOAT(instr);
-                OP_FLOAT(instr, /);
-                break;
-            }
-            case DIVB: {
-                CHECK_DIV_ZERO_INT8(instr);
-                OP_INT8(instr, /);
-                break;
-            }
-            case MODI: {
-                CHECK_DIV_ZERO_INT(instr);
-                OP_INT(instr, %);
-                break;
-            }
-            case MODF: {
-                CHECK_DIV_ZERO_FLOAT(instr);
-                
-                float aValue = GET_ARG1_FLOAT(instr);
-                float bValue = GET_ARG2_FLOAT(instr);
-                float result = (int)aValue % (int)bValue;
-                SET_ARG1_FLOAT(instr, result);    
-                break;
-            }
-            case MODB: {
-                CHECK_DIV_ZERO_INT8(instr);
-                OP_INT8(instr, %);
-                break;
-            }
-            case ORI: {
-                OP_INT(instr, |);
-                break;
-            }
-            case ORB: {
-                OP_INT8(instr, |);
-                break;
-            }
-            case ANDI: {
-                OP_INT(instr, &);
-                break;
-            }
-            case ANDB: {
-                OP_INT8(instr, &);
-                break;
-            }
-            case NOTI: {
-                int32_t value = ~GET_ARG2_INT(instr);
-                SET_ARG1_INT(instr, value);
-                break;
-            }
-            case NOTB: {
-                int8_t value = ~GET_ARG2_INT8(instr);
-                SET_ARG1_INT8(instr, value);
-                break;
-            }
-            case XORI: {
-                OP_INT(instr, ^);
-                break;
-            }
-            case XORB: {
-                OP_INT8(instr, ^);
-                break;
-            }
-            case SZRLI: {
-                OP_INT(instr, >>);
-                break;
-            }
-            case SZRLB: {
-                OP_INT8(instr, >>);
-                break;
-            }
-            case SRLI: {
-                OP_INT(instr, >>);
-                break;
-            }
-            case SRLB: {
-                OP_INT8(instr, >>);
-                break;
-            }
-            case SLLI: {
-                OP_INT(instr, <<);
-                break;
-            }
-            case SLLB: {
-                OP_INT8(instr, <<);
-                break;
-            }
-            default: {
-                vmError("Unknown opcode: %d\n", opcode);
-            }
+        JitTrace* trace = jitCompileTrace(vm, code, loops->path, buf_len(loops->path));
+        if(trace) {
+            loops->traces[index] = trace;
+            vm->traceCount++;
+        }
+        else {
+            loops->rejected[index] = 1;
+        }
+        return rec->opcode;
+    }
+
+    if(buf_len(loops->path) >= VM_MAX_TRACE_LENGTH) {
+        vmStopRecording(code, loops);
+        loops->rejected[loops->head] = 1;
+        return rec->opcode;
+    }
+
+    buf_push(loops->path, index);
+
+    // a superinstruction runs several records in one dispatch, the path needs every one of them
+    uint16_t opcode = loops->opcodes[index];
+    return (opcode >= VM_FIRST_FUSED_OPCODE) ? decodeHandler(OPCODE(code->instrs[index]), rec) : opcode;
+}
+
+/* a backward jump to a hot loop head, returns the record to continue at */
+static DecodedInstr* vmHotLoop(Bytecode* code, VmLoops* loops, DecodedInstr* head) {
+    Address index = head->pc;
+
+    JitTrace* trace = loops->traces[index];
+    if(trace) {
+        // keeps the counter from overflowing, the head stays hot
+        loops->hotCounts[index] = VM_HOT_LOOP_THRESHOLD;
+        return &code->decoded[jitExecuteTrace(trace)];
+    }
+
+    loops->hotCounts[index] = 0;
+    if(!loops->recording && !loops->rejected[index]) {
+        vmStartRecording(code, loops, index);
+    }
+
+    return head;
+}
+
+
+const char* vmDispatchMode() {
+#if LITA_THREADED_DISPATCH
+    return "threaded";
+#else
+    return "switch";
+#endif
+}
+
+/* switches the RETs back to the handler that checks the return index */
+static void vmCheckReturns(Vm* vm, Bytecode* code) {
+#if LITA_THREADED_DISPATCH
+    const void* const* handlers = vmHandlerTable(vm);
+#else
+    (void)vm;
+#endif
+    for(Address i = 0; i < code->length; i++) {
+        DecodedInstr* rec = &code->decoded[i];
+        if(rec->opcode == OP_RET_UNCHECKED) {
+            rec->opcode = RET;
+#if LITA_THREADED_DISPATCH
+            rec->handler = handlers[RET];
+#endif
         }
     }
+}
+
+#if LITA_GUARDED_RAM
+static void vmExecuteGuarded(Vm* vm, Bytecode* code) {
+    // a guest access outside of the RAM faults and the signal handler jumps back here,
+    // the faulting address is the first byte of the access that is out of range.  The
+    // fault doesn't tell how wide the access was, so the error doesn't claim where it ends
+    VmInterpreterState* runningInterpreter = vmRunningInterpreter;
+    if(sigsetjmp(ramFaultJump, 1)) {
+        ramFaultRam = NULL;
+        vmRunningInterpreter = runningInterpreter;
+        vmError("Access violation error at address '0x%x', the RAM ends at '0x%x' \n", 
+            ramFaultAddress, vm->ram->size);
+    }
+
+    ramFaultRam = vm->ram;
+    vmInterpretUnchecked(vm, code, code->decoded);
+    ramFaultRam = NULL;
+}
+#endif
+
+void vmExecute(Vm* vm, Bytecode* code) {
+    if(!code->length || !code->instrs) {
+        return;
+    }
+
+    if(!code->decoded) {
+        vmDecode(vm, code);
+    }
+
+#if LITA_THREADED_DISPATCH
+    // the code may have been decoded for a Vm with the other kind of RAM
+    if(code->decoded[code->length].handler != vmHandlerTable(vm)[OP_HALT]) {
+        vmBindHandlers(vm, code);
+    }
+#endif
+
+    // verify can't know the value $r starts out with, the RETs have to check it if 
+    // it isn't a return index
+    if(vm->cpu->r.as.address > code->length) {
+        vmCheckReturns(vm, code);
+    }
 
-#undef INSTR_AT 
-#undef SET_ARG1_INT   
-#undef SET_ARG1_FLOAT
-#undef SET_ARG1_INT8
-#undef SET_ARG1_ADDR
-#undef SET_ARG1_INT_ARG   
-#undef SET_ARG1_FLOAT_ARG
-#undef SET_ARG1_INT8_ARG
-#undef SET_ARG1_ADDR_ARG
-#undef GET_ARG1_INT
-#undef GET_ARG1_FLOAT
-#undef GET_ARG2_INT
-#undef GET_ARG2_FLOAT
-#undef GET_ARG2_INT8
-#undef GET_CONST_INT
-#undef GET_CONST_INT8
-#undef GET_CONST_FLOAT
-#undef GET_CONST_ADDR
-#undef OP_INT
-#undef OP_INT8
-#undef OP_FLOAT
-#undef CHECK_DIV_ZERO_INT
-#undef CHECK_DIV_ZERO_INT8
-#undef CHECK_DIV_ZERO_FLOAT
+    uint64_t tracedCount = vm->tracedCount;
+    vm->loops = vm->traceLoops ? vmLoopsInit(vm, code) : NULL;
+
+    Output* runningOutput = vmRunningOutput;
+    vmRunningOutput = vm->output;
+
+#if LITA_GUARDED_RAM
+    if(vm->ram->guarded) {
+        vmExecuteGuarded(vm, code);
+    }
+    else {
+        vmInterpret(vm, code, code->decoded);
+    }
+#else
+    vmInterpret(vm, code, code->decoded);
+#endif
+
+    outputFlush(vm->output);
+    vmRunningOutput = runningOutput;
+
+    vmLoopsFree(code, vm->loops);
+    vm->loops = NULL;
+    vm->instructionCount += vm->tracedCount - tracedCount;
 }
+
+/*
+ * The interpreter loop is a template, see interpreter.c
+ */
+#define VM_INTERPRET          vmInterpret
+#define VM_INTERPRET_HANDLERS vmCheckedHandlers
+#define VM_CHECKED_RAM        1
+#include "interpreter.c"
+
+#if LITA_GUARDED_RAM
+#define VM_INTERPRET          vmInterpretUnchecked
+#define VM_INTERPRET_HANDLERS vmUncheckedHandlers
+#define VM_CHECKED_RAM        0
+#include "interpreter.c"
+#endif
@@ -7,17 +7,68 @@
 typedef struct Ram {
     size_t size;
     char*  mem;
+
+    char*  mapping;      /* the mmap'ed memory mem is part of, NULL for heap allocated RAM */
+    size_t mappingSize;
+    int    guarded;      /* see ramInitGuarded */
+    int    image;        /* mapped copy-on-write from a VmSnapshot, see vmFork */
+    int    fileMapped;   /* some pages are mapped from a file by ramMapFile */
+    Address readOnly;    /* the guest can't store below this address, see vmProtectConstants */
 } Ram;
 
 Ram* ramInit(size_t size);
+
+/*
+ * RAM in an anonymous mapping, where the OS only commits the pages that are touched.  With
+ * 'hugePages', RAM of at least RAM_HUGE_PAGE_SIZE is backed by huge pages, either reserved 
+ * ones (MAP_HUGETLB) or transparent ones.  Returns NULL if the platform doesn't support it.
+ */
+Ram* ramInitMapped(size_t size, int hugePages);
+
+/*
+ * RAM placed at the start of a reservation of the whole 32 bit guest address space, where
+ * everything past the RAM is inaccessible.  Out of range guest accesses fault instead of 
+ * having to be checked, so the interpreter runs without range checks.  Returns NULL if
+ * the platform doesn't support it.
+ */
+Ram* ramInitGuarded(size_t size, int hugePages);
 void ramFree(Ram* ram);
 
+/* zeroes the range, the whole pages in it are given back to the OS if the RAM is mapped */
+void   ramDiscard(Ram* ram, Address address, size_t len);
+
+/*
+ * Loads as much of the file at 'path' as fits into the 'len' bytes at '*address'.  In mapped
+ * RAM the whole pages of the file are mapped copy-on-write into the range, from its first
+ * page boundary on, so they are only read once the guest touches them and only copied if
+ * it writes to them, the rest is read in.  Elsewhere all of it is read in at the address.
+ * Returns false if the file can't be opened, otherwise sets '*address' to where the data
+ * starts and '*loaded' to its length.  The range must not be read only.
+ */
+int  ramMapFile(Ram* ram, const char* path, Address* address, Address len, Address* loaded);
+
+/* the bytes of RAM backed by physical memory, all of it where that can't be determined */
+size_t ramResidentSize(Ram* ram);
+
 void ramStoreString(Ram* ram, Address address, const char* value, size_t len);
 void ramStoreBytes(Ram* ram, Address address, const char* value, size_t len);
 void ramStoreInt32(Ram* ram, Address address, int32_t value);
 void ramStoreFloat(Ram* ram, Address address, float value);
 void ramStoreInt8(Ram* ram, Address address, int8_t value);
 
+/* the bulk operations of MEMCPY, MEMSET and MEMCMP, each range is checked once */
+void ramCopy(Ram* ram, Address to, Address from, size_t len);
+void ramFill(Ram* ram, Address address, int8_t value, size_t len);
+int  ramCompare(Ram* ram, Address a, Address b, size_t len);
+
+/* 
+ * The string operations of STRLEN, STRCMP, STRCHR and PRINTS.  A string may run up to the
+ * end of the RAM, a missing terminator is an access violation.
+ */
+Address ramStringLength(Ram* ram, Address address);
+int     ramStringCompare(Ram* ram, Address a, Address b);
+Address ramStringFind(Ram* ram, Address address, int8_t value);
+
 size_t  ramReadBytes(Ram* ram, Address address, char* value, size_t len);
 int32_t ramReadInt32(Ram* ram, Address address);
 float   ramReadFloat(Ram* ram, Address address);
@@ -34,6 +85,20 @@ typedef struct Register {
     } as;
 } Register;
 
+#define MAX_REGISTERS 12
+
+/* indexes of the reserved registers in Cpu32.regs */
+#define REG_SP 0
+#define REG_PC 1
+#define REG_R  2
+#define REG_H  3
+
+/* the argument and result registers of the SYSCALL convention, see VmSyscall */
+#define REG_A  4
+#define REG_B  5
+#define REG_C  6
+#define REG_D  7
+
 typedef struct Cpu32 {
     union {
         struct {
@@ -51,44 +116,182 @@ typedef struct Cpu32 {
             Register u;
         };
         struct {
-            Register regs[12];
+            Register regs[MAX_REGISTERS];
         };
     };
 } Cpu32;
 
-const char* RegisterNames[] = {
-    "$sp",
-    "$pc",
-    "$r",
-    "$h",
-    "$a",
-    "$b",
-    "$c",
-    "$d",
-    "$i",
-    "$j",
-    "$k",
-    "$u",
-    NULL
-};
+/* the assembler names of the registers, in the order of Cpu32.regs */
+extern const char* RegisterNames[];
 
 Cpu32* cpuInit();
 void   cpuFree(Cpu32* cpu);
 int    cpuGetRegisterIndex(const char* name);
 
+/*
+ * An instruction decoded ahead of time by vmDecode.  The interpreter runs an array of these
+ * rather than the raw Bytecode instructions, so the operand encoding, constant lookups and 
+ * jump targets are all resolved once at load time instead of on every execution.
+ */
+typedef struct DecodedInstr {
+    const void* handler;  /* the interpreter handler, only used by the threaded dispatch engine */
+    union {
+        uint32_t reg;                 /* register index */
+        int32_t  iVal;                /* immediate value */
+        float    fVal;                /* immediate value of the float opcodes, a folded constant */
+        Address  address;             /* address of the constant in RAM */
+        struct DecodedInstr* target;  /* JMP/CALL destination */
+        struct {
+            uint8_t reg2;
+            uint8_t reg3;
+            uint8_t reg4;
+        } ext;                        /* the other registers of the extended opcodes */
+    } arg2;
+    Address  pc;      /* index of the instruction in the Bytecode */
+    uint16_t opcode;
+    uint8_t  arg1;    /* register index */
+    uint8_t  mode;    /* DECODED_ARG1_ADDR | DECODED_ARG2_* */
+} DecodedInstr;
+
+#define DECODED_ARG2_REG   0x0
+#define DECODED_ARG2_ADDR  0x1
+#define DECODED_ARG2_IMM   0x2
+#define DECODED_ARG2_CONST 0x3
+#define DECODED_ARG2_MASK  0x3
+#define DECODED_ARG1_ADDR  0x4
+
+#define DECODED_ARG2_MODE(rec) ((rec)->mode & DECODED_ARG2_MASK)
+#define IS_DECODED_ARG1_ADDR(rec) (((rec)->mode & DECODED_ARG1_ADDR) != 0)
+
 typedef struct VmConfig {
     size_t stackSize;
     size_t ramSize;
+    int    fuseInstructions; /* rewrite common instruction sequences into superinstructions */
+    int    traceLoops;       /* compile hot loops into native traces, see vmExecute */
+    int    guardedRam;       /* use ramInitGuarded if the platform supports it */
+    int    lazyRam;          /* use ramInitMapped if the platform supports it */
+    int    hugePages;        /* back mapped RAM by huge pages */
+    int    protectConstants; /* make the constant pool read only, see vmProtectConstants */
+    size_t outputBufferSize; /* of the console device, 0 for OUTPUT_DEFAULT_BUFFER_SIZE */
 } VmConfig;
 
+/*
+ * A host function the guest calls with SYSCALL.  It works on the guest registers in place,
+ * by convention it takes its arguments in $a to $d, or on the stack, and leaves its result
+ * in $a.  $pc holds the index of the SYSCALL instruction and must not be changed.  Guest
+ * pointers are turned into host pointers by vmSyscallArray, which checks the range once.
+ */
+struct Vm;
+typedef void (*VmSyscall)(struct Vm* vm, Register* regs, void* context);
+
+typedef struct VmSyscallEntry {
+    VmSyscall function;
+    void*     context;
+} VmSyscallEntry;
+
+#define VM_MAX_SYSCALLS 1024
+
 typedef struct Vm {
     size_t stackSize;
+    Address stackLimit;        /* lowest address of the stack, the heap ends below it */
+    Address stackTop;          /* $sp of the empty stack, PUSH and POP stay in [stackLimit, stackTop) */
+    Address stackSpan;         /* stackTop - stackLimit */
+    Address stackPeak;         /* lowest $sp a PUSH or DUP reached, the high-water mark of the stack */
     Ram*   ram;
     Cpu32* cpu;
+    int    fuseInstructions;
+    int    traceLoops;
+    int    protectConstants;
+
+    struct VmLoops* loops;     /* the hot loop counters and traces of the code being executed */
+    struct Heap*    heap;      /* the guest heap, NULL until the first ALLOC */
+    struct Output*  output;    /* the console device of the print opcodes, writes to stdout unless redirected */
+    VmSyscallEntry* syscalls;  /* buf indexed by the syscall number, see vmRegisterSyscall */
+    struct VmResetPoint* resetPoint; /* the state vmReset goes back to, NULL until vmSetResetPoint */
+
+    uint64_t instructionCount; /* number of instructions executed by vmExecute */
+    uint64_t dispatchCount;    /* number of handler dispatches, less than instructionCount when superinstructions ran */
+    uint64_t tracedCount;      /* number of instructions executed by native loop traces */
+    uint32_t traceCount;       /* number of loop traces compiled */
 } Vm;
 
 Vm*  vmInit(VmConfig* config);
 void vmFree(Vm* vm);
 void vmExecute(Vm* vm, Bytecode* code);
 
+/*
+ * A prepared Vm frozen as a template, its RAM, registers and the code it runs.  The Vms 
+ * vmFork creates from it start out in that state, with the RAM pages mapped copy-on-write
+ * from the snapshot where the platform supports it (Linux memfds), so creating one doesn't
+ * copy the RAM and a fork only copies the pages it writes.  Elsewhere forks copy the RAM.
+ */
+typedef struct VmSnapshot {
+    Bytecode* code;       /* decoded, the forks run it one at a time */
+    Cpu32     cpu;
+    size_t    ramSize;
+    int       guardedRam;
+    size_t    stackSize;
+    int       fuseInstructions;
+    int       traceLoops;
+    Address   readOnly;   /* see vmProtectConstants */
+    size_t    outputBufferSize;
+    struct Heap* heap;    /* a copy of the Vm's guest heap, each fork gets its own copy of it */
+    VmSyscallEntry* syscalls;  /* buf, the forks start out with the Vm's syscalls */
+
+    int       fd;         /* the memfd holding the RAM image, -1 if there is none */
+    char*     image;      /* the RAM image if there is no memfd */
+} VmSnapshot;
+
+/* the Vm is left as it is, the code must outlive the snapshot.  The forks print to stdout. */
+VmSnapshot* vmSnapshot(Vm* vm, Bytecode* code);
+Vm*         vmFork(VmSnapshot* snapshot);
+void        vmSnapshotFree(VmSnapshot* snapshot);
+
+/*
+ * Records the RAM, the registers and the guest heap as the state vmReset goes back to,
+ * usually right after the code is loaded.  Where the platform supports it (Linux memfds)
+ * the RAM is moved into an image file and mapped copy-on-write from it, as the RAM of a
+ * vmFork is, so the guest's writes land in private copies of the pages and a reset only
+ * drops the pages that were written.  Heap allocated RAM moves to a new address, so this
+ * must be called before the code is compiled to native code.  Elsewhere the RAM is copied
+ * and a reset copies all of it back.  Calling it again moves the reset point.
+ */
+void vmSetResetPoint(Vm* vm);
+
+/*
+ * Restores the state of vmSetResetPoint, the RAM, Cpu32 and the guest heap, so the code
+ * can run again from the start.  The registered syscalls, the console device and the
+ * statistics are kept.
+ */
+void vmReset(Vm* vm);
+
+/*
+ * Makes the RAM below 'end', the constant pool, read only for the guest.  Stores into it
+ * are access violations, the stack and the guest heap are kept out of it, and vmDecode
+ * folds the constant operands read from it into immediate values, so a constant load
+ * becomes a register move.  The assembler calls this once the constants are in place if
+ * the Vm was configured with 'protectConstants'.  Code decoded with folded constants must
+ * only run on Vms that protect the same constants.
+ */
+void vmProtectConstants(Vm* vm, Address end);
+
+/* 
+ * Makes the function the handler of SYSCALL 'number', a NULL function removes it.  Returns
+ * false if the number is VM_MAX_SYSCALLS or above.  A SYSCALL of a number without a handler
+ * is an error.
+ */
+int   vmRegisterSyscall(Vm* vm, uint32_t number, VmSyscall function, void* context);
+
+/* the host address of the 'len' bytes at the guest address, access violations are errors */
+char* vmSyscallArray(Vm* vm, Address address, size_t len);
+
+/* vmSyscallArray of bytes the host writes to, which also must not be read only constants */
+char* vmSyscallWritableArray(Vm* vm, Address address, size_t len);
+
+/* builds the decoded instruction stream for the code; vmExecute does this on demand if it has not been done */
+void vmDecode(Vm* vm, Bytecode* code);
+
+/* name of the interpreter dispatch engine this build was compiled with, either "threaded" or "switch" */
+const char* vmDispatchMode();
+
 #endif